@@ -0,0 +1,272 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide an allocation trace recorder for the custom heap allocators.
+ * Every thread that makes an allocator call while a trace is recording is given a ring
+ * buffer of its own, and it is the only thread that writes to it, so appending a record
+ * takes no lock: the thread writes the record and then publishes it by moving the ring's
+ * head. A writer thread is the only one that reads the rings, and moves each ring's tail
+ * past the records it has written out, which frees their slots for the recording thread.
+ * The rings are mapped from the operating system and the writer only calls into the C
+ * library, so recording never calls back into an allocator.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "./alloc_trace.h"
+
+/* the number of records in each thread's ring, which is a power of two, the most threads
+ * that can be recorded, and how long the writer sleeps once it has drained every ring
+ */
+#define RING_RECORDS (1 << 14)
+#define MAX_THREADS 64
+#define WRITER_SLEEP_NS 1000000
+
+typedef struct
+{
+  /* the next slot the recording thread writes, and the next slot the writer reads, which
+   * only ever go up and are kept on cache lines of their own
+   */
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t tail __attribute__((aligned(64)));
+
+  uint32_t thread;
+  trace_record_t records[RING_RECORDS] __attribute__((aligned(64)));
+} ring_t;
+
+bool trace_recording;
+__thread int trace_suspended;
+
+static __thread ring_t *thread_ring;
+
+static ring_t *rings[MAX_THREADS];
+static uint32_t num_rings;
+static bool threads_dropped;
+
+static FILE *trace_file;
+static pthread_t writer;
+static bool writer_stopping;
+static bool write_failed;
+
+/* Function: claim_ring
+ * -----------------
+ * This function gives the calling thread a ring of its own, or returns null if there are
+ * already rings for as many threads as can be recorded. Rings are kept for the life of the
+ * process, so a thread keeps its ring from one trace to the next.
+ */
+static ring_t *claim_ring(void)
+{
+  uint32_t index = __atomic_fetch_add(&num_rings, 1, __ATOMIC_RELAXED);
+
+  if (index >= MAX_THREADS)
+  {
+    threads_dropped = true;
+
+    return NULL;
+  }
+
+  ring_t *ring = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (ring == MAP_FAILED)
+  {
+    threads_dropped = true;
+
+    return NULL;
+  }
+
+  ring->thread = index;
+
+  __atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+
+  return ring;
+}
+
+/* Function: trace_record
+ * -----------------
+ * This function writes a record into the next slot of the calling thread's ring and then
+ * publishes it, yielding to the writer while the ring is full.
+ */
+void trace_record(enum trace_op op, void *ptr, void *new_ptr, size_t size)
+{
+  if (thread_ring == NULL && (thread_ring = claim_ring()) == NULL)
+  {
+    return;
+  }
+
+  ring_t *ring = thread_ring;
+  uint64_t head = ring->head;
+
+  while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_RECORDS)
+  {
+    sched_yield();
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  trace_record_t *record = &ring->records[head & (RING_RECORDS - 1)];
+
+  record->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  record->ptr = (uintptr_t)ptr;
+  record->new_ptr = (uintptr_t)new_ptr;
+  record->size = size;
+  record->thread = ring->thread;
+  record->op = op;
+
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Function: drain_rings
+ * -----------------
+ * This function writes out the records published in every ring since it was last drained,
+ * in at most two runs per ring since the records may wrap around its end, and returns how
+ * many records it wrote.
+ */
+static size_t drain_rings(void)
+{
+  size_t num_written = 0;
+  uint32_t nrings = __atomic_load_n(&num_rings, __ATOMIC_RELAXED);
+
+  for (uint32_t i = 0; i < nrings && i < MAX_THREADS; i++)
+  {
+    ring_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+
+    if (ring == NULL)
+    {
+      continue;
+    }
+
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (tail < head)
+    {
+      size_t start = tail & (RING_RECORDS - 1);
+      size_t run = RING_RECORDS - start;
+
+      if (run > head - tail)
+      {
+        run = head - tail;
+      }
+
+      if (fwrite(&ring->records[start], sizeof(trace_record_t), run, trace_file) != run)
+      {
+        write_failed = true;
+      }
+
+      tail += run;
+      num_written += run;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  return num_written;
+}
+
+/* Function: write_trace
+ * -----------------
+ * This function is the writer thread, which drains the rings until it is told to stop,
+ * sleeping whenever there was nothing to write. It drains them once more after being told
+ * to stop, so that every call recorded before then is written.
+ */
+static void *write_trace(void *arg)
+{
+  while (!__atomic_load_n(&writer_stopping, __ATOMIC_ACQUIRE))
+  {
+    if (drain_rings() == 0)
+    {
+      struct timespec sleep = {0, WRITER_SLEEP_NS};
+
+      nanosleep(&sleep, NULL);
+    }
+  }
+
+  drain_rings();
+
+  return NULL;
+}
+
+/* Function: trace_start
+ * -----------------
+ * This function writes the header of a new trace file, empties any rings left from an
+ * earlier trace and starts the writer thread, before turning recording on.
+ */
+bool trace_start(const char *path)
+{
+  if (trace_file != NULL)
+  {
+    return false;
+  }
+
+  trace_file = fopen(path, "wb");
+
+  if (trace_file == NULL)
+  {
+    return false;
+  }
+
+  trace_header_t header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(trace_record_t);
+
+  write_failed = fwrite(&header, sizeof(header), 1, trace_file) != 1;
+  threads_dropped = false;
+  writer_stopping = false;
+
+  for (uint32_t i = 0; i < num_rings && i < MAX_THREADS; i++)
+  {
+    if (rings[i] != NULL)
+    {
+      rings[i]->tail = rings[i]->head;
+    }
+  }
+
+  if (pthread_create(&writer, NULL, write_trace, NULL) != 0)
+  {
+    fclose(trace_file);
+    trace_file = NULL;
+
+    return false;
+  }
+
+  __atomic_store_n(&trace_recording, true, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/* Function: trace_stop
+ * -----------------
+ * This function turns recording off, waits for the writer thread to write out the last
+ * records and closes the trace file. Calls that were in the middle of recording when it
+ * was turned off may still be written, or be lost, as they happen to race the writer.
+ */
+bool trace_stop(void)
+{
+  if (trace_file == NULL)
+  {
+    return false;
+  }
+
+  __atomic_store_n(&trace_recording, false, __ATOMIC_RELEASE);
+  __atomic_store_n(&writer_stopping, true, __ATOMIC_RELEASE);
+
+  pthread_join(writer, NULL);
+
+  bool ok = !write_failed && !threads_dropped;
+
+  if (fclose(trace_file) != 0)
+  {
+    ok = false;
+  }
+
+  trace_file = NULL;
+
+  return ok;
+}
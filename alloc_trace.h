@@ -0,0 +1,129 @@
+/* File: alloc_trace.h
+ * -------------------
+ * Interface for the allocation trace recorder that the custom heap
+ * allocators report their calls to, and the format of the trace file it
+ * writes. While recording, each thread appends a record of every mymalloc,
+ * myrealloc and myfree call it makes to a ring buffer of its own, without
+ * taking a lock, and a writer thread drains the rings to the trace file.
+ * trace2script turns a trace file back into a script for the test harness.
+ */
+#ifndef _ALLOC_TRACE_H
+#define _ALLOC_TRACE_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t
+
+// Magic bytes at the start of every trace file, and its format version
+#define TRACE_MAGIC "ALLOCTRC"
+#define TRACE_VERSION 1
+
+// Header at the start of a trace file, followed by trace_record_t records
+// until the end of the file. The records of different threads are
+// interleaved in the order they were flushed, not the order of their calls.
+typedef struct {
+    char magic[8];          // TRACE_MAGIC, not NUL-terminated
+    uint32_t version;       // TRACE_VERSION
+    uint32_t record_size;   // sizeof(trace_record_t) on the machine that wrote it
+} trace_header_t;
+
+enum trace_op {
+    TRACE_ALLOC = 1,
+    TRACE_FREE,
+    TRACE_REALLOC
+};
+
+// A single allocator call. Blocks are identified by their address.
+typedef struct {
+    uint64_t ns;            // CLOCK_MONOTONIC time of the call
+    uint64_t ptr;           // block handed out or freed, or the block passed to realloc
+    uint64_t new_ptr;       // block realloc returned
+    uint64_t size;          // bytes asked for by malloc or realloc
+    uint32_t thread;        // index of the thread that made the call
+    uint32_t op;            // a trace_op
+} trace_record_t;
+
+// Whether calls are being recorded, and how deeply the calling thread is
+// inside an allocator call that shouldn't have its own inner calls recorded.
+// They are only here so that the calls the allocators make can be inlined.
+extern bool trace_recording;
+extern __thread int trace_suspended;
+
+/* Function: trace_start
+ * ---------------------
+ * Creates the trace file at path and starts recording into it, with a
+ * writer thread flushing the threads' ring buffers. Returns false if the
+ * file or the thread couldn't be created, or a trace is already running.
+ */
+bool trace_start(const char *path);
+
+/* Function: trace_stop
+ * --------------------
+ * Stops recording, flushes every record still buffered and closes the trace
+ * file. Returns false if any of the trace couldn't be written, or calls were
+ * left out because too many threads made them.
+ */
+bool trace_stop(void);
+
+/* Function: trace_record
+ * ----------------------
+ * Appends a record of a call to the calling thread's ring buffer, waiting
+ * for the writer thread if the ring is full. Allocators call the functions
+ * below rather than this.
+ */
+void trace_record(enum trace_op op, void *ptr, void *new_ptr, size_t size);
+
+/* Function: trace_malloc
+ * ----------------------
+ * Called by an allocator with each block it hands out and the number of
+ * bytes asked for.
+ */
+static inline void trace_malloc(void *ptr, size_t size)
+{
+  if (trace_recording && trace_suspended == 0)
+  {
+    trace_record(TRACE_ALLOC, ptr, NULL, size);
+  }
+}
+
+/* Function: trace_free
+ * --------------------
+ * Called by an allocator with each pointer it is asked to free.
+ */
+static inline void trace_free(void *ptr)
+{
+  if (trace_recording && trace_suspended == 0)
+  {
+    trace_record(TRACE_FREE, ptr, NULL, 0);
+  }
+}
+
+/* Function: trace_realloc
+ * -----------------------
+ * Called by an allocator with each pointer it is asked to resize, the number
+ * of bytes asked for, and the pointer it returns. Any blocks the allocator
+ * allocates and frees on the way should be hidden with trace_suspend.
+ */
+static inline void trace_realloc(void *old_ptr, void *new_ptr, size_t size)
+{
+  if (trace_recording && trace_suspended == 0)
+  {
+    trace_record(TRACE_REALLOC, old_ptr, new_ptr, size);
+  }
+}
+
+/* Function: trace_suspend, trace_resume
+ * -------------------------------------
+ * Stop and start again recording the calling thread's calls. They nest.
+ */
+static inline void trace_suspend(void)
+{
+  trace_suspended++;
+}
+
+static inline void trace_resume(void)
+{
+  trace_suspended--;
+}
+
+#endif
@@ -14,6 +14,52 @@
 // maximum size of block that must be accommodated
 #define MAX_REQUEST_SIZE (1 << 30)
 
+// Expected lifetime of a block, used to keep blocks that die together apart
+// from blocks that stay around
+typedef enum {
+    LIFETIME_SHORT,     // freed soon after it is allocated
+    LIFETIME_LONG,      // the default for mymalloc
+    LIFETIME_PERMANENT  // never freed
+} lifetime_hint_t;
+
+// Number of power-of-two size classes that free blocks are counted in
+#define HEAP_STATS_CLASSES 48
+
+// Totals the allocator keeps up to date as it goes, so that they can be read
+// in constant time.  The call counts run from the last myinit, and include the
+// blocks that myrealloc allocates and frees when it moves a block.
+typedef struct {
+    size_t committed_bytes; // bytes of the segment given over to blocks so far
+    size_t live_bytes;      // bytes of allocated blocks, headers included, within that
+    size_t live_blocks;     // number of allocated blocks
+    size_t free_bytes;      // bytes of free blocks, headers included, within that
+    size_t free_blocks;     // number of free blocks
+    size_t free_blocks_by_class[HEAP_STATS_CLASSES]; // free blocks of [2^k, 2^(k+1)) bytes
+    size_t largest_free_bytes; // size of the largest free block, header included
+    size_t mallocs;         // number of blocks allocated
+    size_t frees;           // number of blocks freed
+    size_t reallocs;        // number of calls to myrealloc
+} heap_stats_t;
+
+// Number of bits of a block's header that hold its allocation tag, and the
+// number of tags.  Tag 0 is for blocks allocated without a tag.
+#define HEAP_TAG_BITS 8
+#define HEAP_MAX_TAGS (1 << HEAP_TAG_BITS)
+
+// Blocks allocated under a tag and not yet freed, kept up to date as blocks
+// are allocated, resized and freed so that they can be read in constant time
+typedef struct {
+    size_t live_bytes;      // bytes of the blocks, headers included
+    size_t live_blocks;     // number of blocks
+} heap_tag_stats_t;
+
+// How thoroughly validate_heap_level checks the heap
+typedef enum {
+    VALIDATE_CHEAP,         // the allocator's totals only, in constant time
+    VALIDATE_INCREMENTAL,   // also the blocks near the latest calls and a window that rolls over the heap
+    VALIDATE_FULL           // every block, as validate_heap does
+} validate_level_t;
+
 
 
 /* Function: myinit
@@ -33,6 +79,37 @@ bool myinit(void *heap_start, size_t heap_size);
  */
 void *mymalloc(size_t requested_size);
 
+/* Function: mymalloc_hint
+ * -----------------------
+ * Custom version of malloc that takes a hint about how long the block
+ * will live. Allocators may place blocks with different lifetimes in
+ * different regions of the heap. mymalloc is the same as passing
+ * LIFETIME_LONG. Freeing a LIFETIME_PERMANENT block may do nothing, and
+ * growing one with myrealloc may leave the old block behind, except for the
+ * most recently allocated one.
+ */
+void *mymalloc_hint(size_t requested_size, lifetime_hint_t hint);
+
+/* Function: mymalloc_tagged
+ * -------------------------
+ * Custom version of malloc that allocates the block under the given tag,
+ * whatever the thread's current tag is.  Returns NULL if the tag isn't
+ * below HEAP_MAX_TAGS.
+ */
+void *mymalloc_tagged(size_t requested_size, unsigned tag);
+
+/* Function: myset_tag
+ * -------------------
+ * Sets the tag that this thread's calls to mymalloc and mymalloc_hint
+ * allocate blocks under, and returns the tag it replaces, so that a
+ * subsystem can put it back when it is done.  A tag that isn't below
+ * HEAP_MAX_TAGS leaves the current tag as it is.  A block keeps its tag
+ * when myrealloc moves it, except in an allocator whose freed blocks stay
+ * live, like the bump allocator, which has nowhere to keep a block's tag
+ * and allocates the copy under the current tag.
+ */
+unsigned myset_tag(unsigned tag);
+
 
 /* Function: myrealloc
  * -------------------
@@ -57,4 +134,36 @@ void myfree(void *ptr);
  */
 bool validate_heap();
 
+/* Function: validate_heap_level
+ * -----------------------------
+ * Checks the heap as thoroughly as the given level asks, returning true if
+ * all is well.  Each incremental check does a bounded amount of work, and
+ * a run of them covers the whole heap, so they can be left on after every
+ * request where a full walk would be too slow.
+ */
+bool validate_heap_level(validate_level_t level);
+
+/* Function: myheap_stats
+ * ----------------------
+ * Fills in a summary of the heap from the totals the allocator keeps,
+ * taking constant time rather than walking the heap like validate_heap.
+ */
+void myheap_stats(heap_stats_t *stats);
+
+/* Function: myheap_tag_stats
+ * --------------------------
+ * Fills in the blocks and bytes live under a tag, in constant time.  Over
+ * every tag, the bytes add up to the live bytes of myheap_stats.
+ */
+void myheap_tag_stats(unsigned tag, heap_tag_stats_t *stats);
+
+/* Function: mydump_heap_binary
+ * ----------------------------
+ * Writes a snapshot of the heap to fd in the format of heap_dump.h, with a
+ * record for each block and for the allocator's own overhead, in address
+ * order.  The heap isn't changed and nothing is allocated, so it can be
+ * called between any two requests.  Returns false if the write fails.
+ */
+bool mydump_heap_binary(int fd);
+
 #endif
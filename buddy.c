@@ -0,0 +1,1374 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide a binary buddy heap allocator, to compare against
+ * the implicit and explicit allocators. Every block is a power of two in size
+ * and starts at a multiple of its size from the start of the heap, so the buddy
+ * of a block is found by flipping a single bit of its offset. Whether a block
+ * of each order is free is kept in one bitmap per order, and the free blocks of
+ * each order are kept on a doubly linked list, so splitting and merging take
+ * O(log n) steps. Blocks have no header: the order and tag of each block are
+ * kept beside the bitmaps, so a request of 2^k bytes fits a block of 2^k.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./allocator.h"
+#include "./debug_break.h"
+#include "./alloc_trace.h"
+#include "./heap_dump.h"
+#include "./heap_profile.h"
+#include "./probes.h"
+
+#define BITS_PER_WORD 64
+
+/* the smallest block holds a free list node, and the largest order bounds the arrays
+ * indexed by order
+ */
+#define MIN_ORDER 4
+#define MAX_ORDER 48
+
+/* incremental checks of the heap walk regions of this order: the regions holding the
+ * blocks touched by the latest calls, and the next region of a window that rolls over
+ * the heap
+ */
+#define WINDOW_ORDER 16
+#define TOUCHED_REGIONS 2
+
+static void *segment_start;
+static size_t segment_size;
+static void *segment_end;
+static size_t nused;
+
+/* the heap is one block of order heap_order at the start of the segment, and the
+ * bitmaps for every order are kept at the end of the segment, after a byte for the
+ * order and a byte for the tag of each block of MIN_ORDER. A block's order and tag
+ * are kept in the bytes for the first block of MIN_ORDER it covers.
+ */
+static size_t heap_order;
+static uint64_t *bitmaps[MAX_ORDER + 1];
+static uint8_t *block_orders;
+static uint8_t *block_tags;
+
+typedef struct node node_t;
+
+/* free blocks hold a node at their start */
+struct node
+{
+  node_t *prev;
+  node_t *next;
+};
+
+static node_t *free_lists[MAX_ORDER + 1];
+
+/* totals for myheap_stats: the end of the highest block allocated so far, the free blocks
+ * of each order that start below it, and the calls that have handed out, freed or resized
+ * blocks
+ */
+static size_t high_water;
+static size_t free_blocks;
+static size_t free_blocks_by_order[MAX_ORDER + 1];
+static size_t mallocs;
+static size_t frees;
+static size_t reallocs;
+
+/* the tag this thread allocates blocks under, and the blocks and bytes live under each tag */
+static __thread unsigned current_tag;
+static size_t tag_live_bytes[HEAP_MAX_TAGS];
+static size_t tag_live_blocks[HEAP_MAX_TAGS];
+
+/* the offsets of the blocks touched by calls since the last incremental check of the heap,
+ * and the offset of the region that the rolling window of incremental checks comes to next
+ */
+static size_t touched_offsets[TOUCHED_REGIONS];
+static size_t num_touched;
+static size_t window_offset;
+
+/* Function: roundup
+ * -----------------
+ * This function rounds up the given number to the given multiple, which
+ * must be a power of 2, and returns the result.  (you saw this code in lab1!).
+ */
+size_t roundup(size_t num, size_t mult)
+{
+  return (num + mult - 1) & ~(mult - 1);
+}
+
+/* Function: order_size
+ * -----------------
+ * This function returns the number of bytes in a block of the given order.
+ */
+size_t order_size(size_t order)
+{
+  return (size_t)1 << order;
+}
+
+/* Function: block_at
+ * -----------------
+ * This function returns a pointer to the block at the given offset from the start of
+ * the heap, which is also its payload.
+ */
+void *block_at(size_t offset)
+{
+  return (char *)segment_start + offset;
+}
+
+/* Function: block_offset
+ * -----------------
+ * This function returns the offset of a block from the start of the heap.
+ */
+size_t block_offset(void *block)
+{
+  return (char *)block - (char *)segment_start;
+}
+
+/* Function: get_order
+ * -----------------
+ * This function returns the order of the block at the given offset.
+ */
+size_t get_order(size_t offset)
+{
+  return block_orders[offset >> MIN_ORDER];
+}
+
+/* Function: set_order
+ * -----------------
+ * This function sets the order of the block at the given offset.
+ */
+void set_order(size_t offset, size_t order)
+{
+  block_orders[offset >> MIN_ORDER] = order;
+}
+
+/* Function: get_tag
+ * -----------------
+ * This function returns the allocation tag of the allocated block at the given offset.
+ */
+unsigned get_tag(size_t offset)
+{
+  return block_tags[offset >> MIN_ORDER];
+}
+
+/* Function: set_tag
+ * -----------------
+ * This function sets the allocation tag of the allocated block at the given offset.
+ */
+void set_tag(size_t offset, unsigned tag)
+{
+  block_tags[offset >> MIN_ORDER] = tag;
+}
+
+/* Function: count_tagged
+ * -----------------
+ * This function records in the totals for a block's tag that the allocated block at the
+ * given offset has appeared (a delta of 1) or gone (a delta of -1).
+ */
+void count_tagged(size_t offset, long delta)
+{
+  unsigned tag = get_tag(offset);
+
+  tag_live_bytes[tag] += delta * order_size(get_order(offset));
+  tag_live_blocks[tag] += delta;
+}
+
+/* Function: buddy_of
+ * -----------------
+ * This function returns the offset of the buddy of the block of the given order at the
+ * given offset, which differs from it only in the bit for the size of the block.
+ */
+size_t buddy_of(size_t offset, size_t order)
+{
+  return offset ^ order_size(order);
+}
+
+/* Function: order_for
+ * -----------------
+ * This function returns the order of the smallest block that can hold a payload of the
+ * given size.
+ */
+size_t order_for(size_t size)
+{
+  size_t order = MIN_ORDER;
+
+  while (order_size(order) < size)
+  {
+    order++;
+  }
+
+  return order;
+}
+
+/* Function: bitmap_words
+ * -----------------
+ * This function returns the number of words in the bitmap for blocks of the given order,
+ * on a heap of the given order.
+ */
+size_t bitmap_words(size_t order, size_t top_order)
+{
+  size_t nblocks = order_size(top_order - order);
+
+  return roundup(nblocks, BITS_PER_WORD) / BITS_PER_WORD;
+}
+
+/* Function: bitmaps_size
+ * -----------------
+ * This function returns the number of bytes taken by the bitmaps of every order, on a
+ * heap of the given order.
+ */
+size_t bitmaps_size(size_t top_order)
+{
+  size_t num_words = 0;
+
+  for (size_t order = MIN_ORDER; order <= top_order; order++)
+  {
+    num_words += bitmap_words(order, top_order);
+  }
+
+  return num_words * sizeof(uint64_t);
+}
+
+/* Function: metadata_size
+ * -----------------
+ * This function returns the number of bytes taken by the orders and tags of the blocks
+ * and by the bitmaps of every order, on a heap of the given order.
+ */
+size_t metadata_size(size_t top_order)
+{
+  return 2 * order_size(top_order - MIN_ORDER) + bitmaps_size(top_order);
+}
+
+/* Function: is_free
+ * -----------------
+ * This function returns whether or not the block of the given order at the given offset
+ * is free, by reading its bit in the bitmap for its order.
+ */
+bool is_free(size_t offset, size_t order)
+{
+  size_t index = offset >> order;
+
+  return (bitmaps[order][index / BITS_PER_WORD] >> (index % BITS_PER_WORD)) & 1;
+}
+
+/* Function: set_free
+ * -----------------
+ * This function sets the bit for the block of the given order at the given offset.
+ */
+void set_free(size_t offset, size_t order, bool free)
+{
+  size_t index = offset >> order;
+  uint64_t mask = (uint64_t)1 << (index % BITS_PER_WORD);
+
+  if (free)
+  {
+    bitmaps[order][index / BITS_PER_WORD] |= mask;
+  }
+  else
+  {
+    bitmaps[order][index / BITS_PER_WORD] &= ~mask;
+  }
+}
+
+/* Function: is_freed
+ * -----------------
+ * This function returns whether or not the block of the given order at the given offset
+ * lies inside any free block, which may have been merged into a larger one since.
+ */
+bool is_freed(size_t offset, size_t order)
+{
+  for (; order <= heap_order; order++)
+  {
+    if (is_free(offset & ~(order_size(order) - 1), order))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Function: count_free_block
+ * -----------------
+ * This function records in the totals for myheap_stats that the free block of the given
+ * order at the given offset has appeared (a delta of 1) or gone (a delta of -1). Only
+ * the free blocks that start below the high-water mark are counted.
+ */
+void count_free_block(size_t offset, size_t order, long delta)
+{
+  if (offset < high_water)
+  {
+    free_blocks += delta;
+    free_blocks_by_order[order] += delta;
+  }
+}
+
+/* Function: free_block_containing
+ * -----------------
+ * This function returns the order of the free block that the byte at the given offset lies
+ * in, or 0 if it lies in an allocated block.
+ */
+size_t free_block_containing(size_t offset)
+{
+  for (size_t order = MIN_ORDER; order <= heap_order; order++)
+  {
+    if (is_free(offset & ~(order_size(order) - 1), order))
+    {
+      return order;
+    }
+  }
+
+  return 0;
+}
+
+/* Function: add_free_block
+ * -----------------
+ * This function marks the block of the given order at the given offset as free, and adds
+ * it to the front of the free list for its order.
+ */
+void add_free_block(size_t offset, size_t order)
+{
+  node_t *free_node = block_at(offset);
+
+  set_order(offset, order);
+
+  free_node->prev = NULL;
+  free_node->next = free_lists[order];
+
+  if (free_lists[order] != NULL)
+  {
+    free_lists[order]->prev = free_node;
+  }
+
+  free_lists[order] = free_node;
+
+  set_free(offset, order, true);
+
+  count_free_block(offset, order, 1);
+}
+
+/* Function: detach_free_block
+ * -----------------
+ * This function removes the free block of the given order at the given offset from the
+ * free list for its order, and marks it as not free.
+ */
+void detach_free_block(size_t offset, size_t order)
+{
+  node_t *free_node = block_at(offset);
+
+  if (free_node->prev != NULL)
+  {
+    free_node->prev->next = free_node->next;
+  }
+  else
+  {
+    free_lists[order] = free_node->next;
+  }
+
+  if (free_node->next != NULL)
+  {
+    free_node->next->prev = free_node->prev;
+  }
+
+  set_free(offset, order, false);
+
+  count_free_block(offset, order, -1);
+}
+
+/* Function: raise_high_water
+ * -----------------
+ * This function records that the block of the given order at the given offset is in use,
+ * moving the high-water mark up to its end if it lies beyond it. Nothing past the old mark
+ * has been handed out before, so everything between it and the block is free, and the
+ * free blocks that start there are counted now that they lie below the mark.
+ */
+void raise_high_water(size_t offset, size_t order)
+{
+  if (offset + order_size(order) <= high_water)
+  {
+    return;
+  }
+
+  size_t curr = high_water;
+
+  high_water = offset + order_size(order);
+
+  while (curr < offset)
+  {
+    size_t free_order = free_block_containing(curr);
+
+    if (free_order == 0)
+    {
+      break;
+    }
+
+    size_t free_offset = curr & ~(order_size(free_order) - 1);
+
+    /* a free block that straddles the old mark was counted already */
+    if (free_offset == curr)
+    {
+      count_free_block(curr, free_order, 1);
+    }
+
+    curr = free_offset + order_size(free_order);
+  }
+}
+
+/* Function: touch_block
+ * -----------------
+ * This function records that a call has touched the block at the given offset, so that the
+ * next incremental check of the heap walks the region it lies in.
+ */
+void touch_block(size_t offset)
+{
+  memmove(&touched_offsets[1], &touched_offsets[0], (TOUCHED_REGIONS - 1) * sizeof(size_t));
+
+  touched_offsets[0] = offset;
+
+  if (num_touched < TOUCHED_REGIONS)
+  {
+    num_touched++;
+  }
+}
+
+/* Function: split_block
+ * -----------------
+ * This function splits an allocated block of order from_order down to order to_order,
+ * freeing the upper half at each step. The upper halves can't be merged with anything,
+ * since their buddy is the lower half we keep.
+ */
+void split_block(size_t offset, size_t from_order, size_t to_order)
+{
+  while (from_order > to_order)
+  {
+    from_order--;
+
+    add_free_block(offset + order_size(from_order), from_order);
+  }
+
+  set_order(offset, to_order);
+}
+
+/* Function: myinit
+ * -----------------
+ * This function returns true if initialization was successful, or false otherwise.
+ * The heap is the largest power of two that fits in the segment alongside the orders and
+ * tags of its blocks and its bitmaps, and starts out as a single free block.
+ */
+bool myinit(void *heap_start, size_t heap_size)
+{
+  segment_start = heap_start;
+  segment_size = heap_size;
+  segment_end = (char *)segment_start + segment_size;
+
+  /* find the largest heap whose orders, tags and bitmaps fit behind it in the segment */
+  heap_order = MAX_ORDER;
+
+  while (heap_order >= MIN_ORDER && order_size(heap_order) + metadata_size(heap_order) + ALIGNMENT > segment_size)
+  {
+    heap_order--;
+  }
+
+  if (heap_order < MIN_ORDER)
+  {
+    return false;
+  }
+
+  size_t bitmap_bytes = bitmaps_size(heap_order);
+  uint64_t *bitmap_ptr = (uint64_t *)(((uintptr_t)segment_end - bitmap_bytes) & ~(uintptr_t)(ALIGNMENT - 1));
+
+  memset(bitmap_ptr, 0, bitmap_bytes);
+
+  /* a block's order and tag are written whenever it is split off, so they need no clearing */
+  block_tags = (uint8_t *)bitmap_ptr - order_size(heap_order - MIN_ORDER);
+  block_orders = block_tags - order_size(heap_order - MIN_ORDER);
+
+  for (size_t order = 0; order <= MAX_ORDER; order++)
+  {
+    bitmaps[order] = NULL;
+    free_lists[order] = NULL;
+  }
+
+  high_water = 0;
+  free_blocks = 0;
+
+  memset(free_blocks_by_order, 0, sizeof(free_blocks_by_order));
+
+  mallocs = 0;
+  frees = 0;
+  reallocs = 0;
+
+  memset(tag_live_bytes, 0, sizeof(tag_live_bytes));
+  memset(tag_live_blocks, 0, sizeof(tag_live_blocks));
+
+  num_touched = 0;
+  window_offset = 0;
+
+  for (size_t order = MIN_ORDER; order <= heap_order; order++)
+  {
+    bitmaps[order] = bitmap_ptr;
+    bitmap_ptr += bitmap_words(order, heap_order);
+  }
+
+  add_free_block(0, heap_order);
+
+  nused = 0;
+
+  return true;
+}
+
+/* Function: allocate_block
+ * -----------------
+ * This function takes the first free block of the smallest order that can hold the
+ * requested size, splitting it down to the order needed. It returns null if no free
+ * block is big enough.
+ */
+void *allocate_block(size_t requested_size)
+{
+  /* handle the case where malloc is passed a value of 0 */
+  if (requested_size == 0)
+  {
+    return NULL;
+  }
+
+  /* if requested_size is greater than max request size we return null */
+  if (requested_size > MAX_REQUEST_SIZE)
+  {
+    return NULL;
+  }
+
+  size_t needed_order = order_for(requested_size);
+  size_t order = needed_order;
+
+  /* find the smallest order with a free block */
+  while (order <= heap_order && free_lists[order] == NULL)
+  {
+    order++;
+  }
+
+  if (order > heap_order)
+  {
+    return NULL;
+  }
+
+  size_t offset = block_offset(free_lists[order]);
+
+  detach_free_block(offset, order);
+
+  split_block(offset, order, needed_order);
+
+  nused += order_size(needed_order);
+
+  raise_high_water(offset, needed_order);
+
+  mallocs++;
+
+  set_tag(offset, current_tag);
+  count_tagged(offset, 1);
+
+  touch_block(offset);
+
+  void *payload = block_at(offset);
+
+  heap_profile_malloc(payload, requested_size);
+
+  trace_malloc(payload, requested_size);
+
+  return payload;
+}
+
+/* Function: mymalloc
+ * -----------------
+ * This function allocates a block for the requested size with the default lifetime.
+ */
+void *mymalloc(size_t requested_size)
+{
+  return mymalloc_hint(requested_size, LIFETIME_LONG);
+}
+
+/* Function: mymalloc_hint
+ * -----------------
+ * The buddy allocator places blocks by size alone, so the lifetime hint makes no
+ * difference. This function allocates a block with allocate_block, between the probes that
+ * mark the entry and return of each malloc.
+ */
+void *mymalloc_hint(size_t requested_size, lifetime_hint_t hint)
+{
+  HEAP_PROBE2(malloc__entry, requested_size, hint);
+
+  void *payload = allocate_block(requested_size);
+
+  HEAP_PROBE2(malloc__return, payload, requested_size);
+
+  return payload;
+}
+
+/* Function: mymalloc_tagged
+ * -----------------
+ * This function allocates a block for the requested size under the given tag, and returns
+ * null if the tag is out of range.
+ */
+void *mymalloc_tagged(size_t requested_size, unsigned tag)
+{
+  if (tag >= HEAP_MAX_TAGS)
+  {
+    return NULL;
+  }
+
+  unsigned old_tag = current_tag;
+
+  current_tag = tag;
+
+  void *payload = mymalloc(requested_size);
+
+  current_tag = old_tag;
+
+  return payload;
+}
+
+/* Function: myset_tag
+ * -----------------
+ * This function sets the tag this thread allocates blocks under, unless it is out of
+ * range, and returns the tag it had before.
+ */
+unsigned myset_tag(unsigned tag)
+{
+  unsigned old_tag = current_tag;
+
+  if (tag < HEAP_MAX_TAGS)
+  {
+    current_tag = tag;
+  }
+
+  return old_tag;
+}
+
+/* Function: release_block
+ * -----------------
+ * This function frees a block, merging it with its buddy for as long as the buddy is free.
+ * If the block has already been freed it does nothing.
+ */
+void release_block(void *ptr)
+{
+  /* if we try to free a null pointer, then do nothing */
+  if (ptr == NULL)
+  {
+    return;
+  }
+
+  trace_free(ptr);
+
+  size_t offset = block_offset(ptr);
+  size_t order = get_order(offset);
+
+  /* do nothing if pointer is already free */
+  if (is_freed(offset, order))
+  {
+    return;
+  }
+
+  frees++;
+
+  count_tagged(offset, -1);
+
+  heap_profile_free(ptr);
+
+  nused -= order_size(order);
+
+  /* merge with the buddy at each order while it is free */
+  while (order < heap_order)
+  {
+    size_t buddy = buddy_of(offset, order);
+
+    if (!is_free(buddy, order))
+    {
+      break;
+    }
+
+    detach_free_block(buddy, order);
+
+    offset &= buddy;
+    order++;
+  }
+
+  add_free_block(offset, order);
+
+  touch_block(offset);
+}
+
+/* Function: myfree
+ * -----------------
+ * This function frees a block with release_block, between the probes that mark the entry
+ * and return of each free.
+ */
+void myfree(void *ptr)
+{
+  HEAP_PROBE1(free__entry, ptr);
+
+  release_block(ptr);
+
+  HEAP_PROBE1(free__return, ptr);
+}
+
+/* Function: grow_in_place
+ * -----------------
+ * This function attempts to grow an allocated block to the given order by absorbing its
+ * buddy at each order, which needs the block to be the lower buddy and the buddy to be
+ * free all the way up. It returns true if the block was grown, and false otherwise.
+ */
+bool grow_in_place(size_t offset, size_t order, size_t needed_order)
+{
+  if (needed_order > heap_order || (offset & (order_size(needed_order) - 1)) != 0)
+  {
+    return false;
+  }
+
+  for (size_t curr_order = order; curr_order < needed_order; curr_order++)
+  {
+    if (!is_free(offset + order_size(curr_order), curr_order))
+    {
+      return false;
+    }
+  }
+
+  for (size_t curr_order = order; curr_order < needed_order; curr_order++)
+  {
+    detach_free_block(offset + order_size(curr_order), curr_order);
+  }
+
+  set_order(offset, needed_order);
+
+  return true;
+}
+
+/* Function: resize_block
+ * -----------------
+ * This function resizes a block, in place where possible. Shrinking splits the block
+ * down and frees the upper halves, and growing first tries to absorb the free buddies
+ * above the block before moving it.
+ */
+void *resize_block(void *old_ptr, size_t new_size)
+{
+  reallocs++;
+
+  if (old_ptr != NULL)
+  {
+    touch_block(block_offset(old_ptr));
+  }
+
+  /* if old_ptr is null then it is simply a mymalloc call */
+  if (old_ptr == NULL)
+  {
+    return mymalloc(new_size);
+  }
+
+  /* a new_size of 0 is simply a myfree call */
+  if (new_size == 0)
+  {
+    myfree(old_ptr);
+
+    return NULL;
+  }
+
+  if (new_size > MAX_REQUEST_SIZE)
+  {
+    return NULL;
+  }
+
+  size_t offset = block_offset(old_ptr);
+  size_t order = get_order(offset);
+  size_t needed_order = order_for(new_size);
+
+  if (needed_order <= order)
+  {
+    split_block(offset, order, needed_order);
+
+    nused -= order_size(order) - order_size(needed_order);
+
+    tag_live_bytes[get_tag(offset)] -= order_size(order) - order_size(needed_order);
+
+    heap_profile_resize(old_ptr, new_size);
+
+    return old_ptr;
+  }
+
+  if (grow_in_place(offset, order, needed_order))
+  {
+    nused += order_size(needed_order) - order_size(order);
+
+    tag_live_bytes[get_tag(offset)] += order_size(needed_order) - order_size(order);
+
+    raise_high_water(offset, needed_order);
+
+    heap_profile_resize(old_ptr, new_size);
+
+    return old_ptr;
+  }
+
+  void *new_ptr = mymalloc(new_size);
+
+  if (new_ptr == NULL)
+  {
+    return NULL;
+  }
+
+  memcpy(new_ptr, old_ptr, order_size(order));
+
+  myfree(old_ptr);
+
+  return new_ptr;
+}
+
+/* Function: myrealloc
+ * -----------------
+ * This function resizes a block with resize_block, between the probes that mark the entry
+ * and return of each realloc, and records the call in the allocation trace as a single
+ * resize, hiding the blocks that resize_block allocates and frees on the way. A block
+ * that moves is allocated under the tag it had.
+ */
+void *myrealloc(void *old_ptr, size_t new_size)
+{
+  HEAP_PROBE2(realloc__entry, old_ptr, new_size);
+
+  trace_suspend();
+
+  unsigned tag = current_tag;
+
+  if (old_ptr != NULL)
+  {
+    current_tag = get_tag(block_offset(old_ptr));
+  }
+
+  void *new_ptr = resize_block(old_ptr, new_size);
+
+  current_tag = tag;
+
+  trace_resume();
+
+  trace_realloc(old_ptr, new_ptr, new_size);
+
+  HEAP_PROBE3(realloc__return, new_ptr, old_ptr, new_size);
+
+  return new_ptr;
+}
+
+/* Function: size_class
+ * -----------------
+ * This function returns the class of myheap_stats that a free block of the given number of
+ * bytes is counted in, which is the power of two at or below it.
+ */
+int size_class(size_t bytes)
+{
+  int class = 0;
+
+  while (class < HEAP_STATS_CLASSES - 1 && (bytes >> (class + 1)) != 0)
+  {
+    class++;
+  }
+
+  return class;
+}
+
+/* Function: myheap_stats
+ * -----------------
+ * This function fills in a summary of the heap from the totals kept as blocks are allocated
+ * and freed. The committed bytes run up to the end of the highest block allocated so far,
+ * and the free blocks counted are the ones that start below it. A free block that straddles
+ * the mark is counted up to the mark, so the free blocks add up to the bytes that aren't
+ * allocated below it.
+ */
+void myheap_stats(heap_stats_t *stats)
+{
+  stats->committed_bytes = high_water;
+  stats->live_bytes = nused;
+  stats->live_blocks = mallocs - frees;
+  stats->free_bytes = high_water - nused;
+  stats->free_blocks = free_blocks;
+  stats->largest_free_bytes = 0;
+
+  memset(stats->free_blocks_by_class, 0, sizeof(stats->free_blocks_by_class));
+
+  for (size_t order = MIN_ORDER; order <= heap_order; order++)
+  {
+    stats->free_blocks_by_class[size_class(order_size(order))] += free_blocks_by_order[order];
+  }
+
+  /* find the free block that straddles the mark, if there is one, and count it cut short */
+  size_t straddle_order = (high_water > 0 && high_water < order_size(heap_order)) ? free_block_containing(high_water) : 0;
+  size_t straddle_bytes = 0;
+
+  if (straddle_order != 0)
+  {
+    straddle_bytes = high_water & (order_size(straddle_order) - 1);
+
+    if (straddle_bytes == 0)
+    {
+      straddle_order = 0;
+    }
+    else
+    {
+      stats->free_blocks_by_class[size_class(order_size(straddle_order))]--;
+      stats->free_blocks_by_class[size_class(straddle_bytes)]++;
+    }
+  }
+
+  for (size_t order = heap_order; order >= MIN_ORDER; order--)
+  {
+    if (free_blocks_by_order[order] > (order == straddle_order))
+    {
+      stats->largest_free_bytes = order_size(order);
+
+      break;
+    }
+  }
+
+  if (straddle_bytes > stats->largest_free_bytes)
+  {
+    stats->largest_free_bytes = straddle_bytes;
+  }
+
+  stats->mallocs = mallocs;
+  stats->frees = frees;
+  stats->reallocs = reallocs;
+}
+
+/* Function: myheap_tag_stats
+ * -----------------
+ * This function fills in the blocks and bytes live under a tag from the totals kept as
+ * blocks come and go, and resize in place.
+ */
+void myheap_tag_stats(unsigned tag, heap_tag_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+
+  if (tag < HEAP_MAX_TAGS)
+  {
+    stats->live_bytes = tag_live_bytes[tag];
+    stats->live_blocks = tag_live_blocks[tag];
+  }
+}
+
+/* Function: validate_blocks
+ * -----------------
+ * This function walks the blocks from the given offset up to the given end, which must both
+ * lie on block boundaries, checking that free blocks have been merged with their buddies
+ * and that allocated blocks are well formed. It adds the bytes in use and the free blocks of
+ * each order it finds to the given totals, and returns true if all is well.
+ */
+bool validate_blocks(size_t start, size_t end, size_t *num_bytes_used, size_t num_free_blocks[])
+{
+  size_t offset = start;
+
+  /* loop over each block, taking the largest free block that starts here if there is one */
+  while (offset < end)
+  {
+    size_t order = heap_order;
+
+    while (order >= MIN_ORDER && ((offset & (order_size(order) - 1)) != 0 || !is_free(offset, order)))
+    {
+      order--;
+    }
+
+    if (order >= MIN_ORDER)
+    {
+      /* a free block and its buddy should have been merged */
+      if (order < heap_order && is_free(buddy_of(offset, order), order))
+      {
+        printf("Free block at %p was not merged with its buddy!\n", block_at(offset));
+
+        breakpoint();
+
+        return false;
+      }
+
+      num_free_blocks[order]++;
+    }
+    else
+    {
+      order = get_order(offset);
+
+      /* an allocated block must have a valid order and start at a multiple of its size */
+      if (order < MIN_ORDER || order > heap_order || (offset & (order_size(order) - 1)) != 0)
+      {
+        printf("Block at %p has a bad order of %ld!\n", block_at(offset), order);
+
+        breakpoint();
+
+        return false;
+      }
+
+      /* every allocated block lies below the high-water mark */
+      if (offset + order_size(order) > high_water)
+      {
+        printf("Block at %p lies past the high-water mark!\n", block_at(offset));
+
+        breakpoint();
+
+        return false;
+      }
+
+      *num_bytes_used += order_size(order);
+    }
+
+    offset += order_size(order);
+  }
+
+  return true;
+}
+
+/* Function: validate_region
+ * -----------------
+ * This function checks the blocks in the region of the given order at the given offset. A
+ * single block may cover the whole region, so it first descends from the top of the heap
+ * looking for one, and otherwise walks the blocks inside the region. It returns true if
+ * all is well.
+ */
+bool validate_region(size_t region, size_t region_order)
+{
+  size_t num_bytes_used = 0;
+  size_t num_free_blocks[MAX_ORDER + 1] = {0};
+
+  for (size_t order = heap_order; order > region_order; order--)
+  {
+    size_t offset = region & ~(order_size(order) - 1);
+    size_t block_order = get_order(offset);
+
+    /* a free block, or an allocated block whose order says it is this big, covers the region */
+    if (is_free(offset, order) || block_order == order)
+    {
+      return validate_blocks(offset, offset + order_size(order), &num_bytes_used, num_free_blocks);
+    }
+
+    /* otherwise this block has been split, and the block starting here is smaller */
+    if (block_order > order)
+    {
+      printf("Block at %p has a bad order of %ld!\n", block_at(offset), block_order);
+
+      breakpoint();
+
+      return false;
+    }
+  }
+
+  return validate_blocks(region, region + order_size(region_order), &num_bytes_used, num_free_blocks);
+}
+
+/* Function: validate_totals
+ * -----------------
+ * This function checks the totals the allocator keeps against each other and against the
+ * size of the heap, which takes constant time. It returns true if they agree.
+ */
+bool validate_totals()
+{
+  /* if we have used more heap than what is available then throw an error */
+  if (nused > segment_size)
+  {
+    printf("You have used more heap than whats available!\n");
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the blocks in use don't fit below the high-water mark */
+  if (nused > high_water || high_water > order_size(heap_order))
+  {
+    printf("The heap uses %ld bytes below a high-water mark of %ld in a heap of %ld bytes!\n", nused, high_water, order_size(heap_order));
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t num_order_blocks = 0;
+
+  for (size_t order = MIN_ORDER; order <= heap_order; order++)
+  {
+    num_order_blocks += free_blocks_by_order[order];
+  }
+
+  /* return false if the orders don't add up to the free blocks */
+  if (num_order_blocks != free_blocks)
+  {
+    printf("The orders hold %ld free blocks, but the statistics say %ld!\n", num_order_blocks, free_blocks);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if more blocks have been freed than were ever handed out */
+  if (frees > mallocs)
+  {
+    printf("The heap has freed %ld blocks, but only handed out %ld!\n", frees, mallocs);
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t tagged_bytes = 0;
+  size_t tagged_blocks = 0;
+
+  for (int tag = 0; tag < HEAP_MAX_TAGS; tag++)
+  {
+    tagged_bytes += tag_live_bytes[tag];
+    tagged_blocks += tag_live_blocks[tag];
+  }
+
+  /* return false if the totals by tag don't add up to the blocks that are live */
+  if (tagged_blocks != mallocs - frees || tagged_bytes != nused)
+  {
+    printf("The tags hold %ld blocks of %ld bytes, but %ld blocks of %ld bytes are live!\n", tagged_blocks, tagged_bytes, mallocs - frees, nused);
+
+    breakpoint();
+
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: validate_heap_level
+ * -----------------
+ * This function validates the heap as thoroughly as the level asks. The cheap level only
+ * checks the totals, and the incremental level also walks the regions holding the blocks
+ * touched since the last incremental check and the next region of a window that rolls over
+ * the whole heap, so its cost is bounded by the size of a region rather than of the heap.
+ */
+bool validate_heap_level(validate_level_t level)
+{
+  if (level == VALIDATE_FULL)
+  {
+    return validate_heap();
+  }
+
+  if (!validate_totals())
+  {
+    return false;
+  }
+
+  if (level == VALIDATE_CHEAP)
+  {
+    return true;
+  }
+
+  size_t region_order = (heap_order < WINDOW_ORDER) ? heap_order : WINDOW_ORDER;
+  size_t region_mask = ~(order_size(region_order) - 1);
+
+  for (size_t i = 0; i < num_touched; i++)
+  {
+    if (!validate_region(touched_offsets[i] & region_mask, region_order))
+    {
+      return false;
+    }
+  }
+
+  num_touched = 0;
+
+  if (!validate_region(window_offset, region_order))
+  {
+    return false;
+  }
+
+  window_offset = (window_offset + order_size(region_order)) & (order_size(heap_order) - 1);
+
+  return true;
+}
+
+/* Function: validate_heap
+ * -----------------
+ * This function validates the heap periodically to make sure all is OK. It walks every
+ * block on the heap checking that free blocks have been merged with their buddies, and
+ * that the free lists and nused agree with the blocks. If everything is OK we return
+ * true, otherwise we return false.
+ */
+bool validate_heap()
+{
+  if (!validate_totals())
+  {
+    return false;
+  }
+
+  size_t num_bytes_used = 0;
+  size_t num_free_blocks[MAX_ORDER + 1] = {0};
+
+  if (!validate_blocks(0, order_size(heap_order), &num_bytes_used, num_free_blocks))
+  {
+    return false;
+  }
+
+  /* return false if the number of bytes used and nused don't match */
+  if (num_bytes_used != nused)
+  {
+    printf("Your program uses %ld bytes, but nused says %ld bytes are accounted for!\n", num_bytes_used, nused);
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t num_counted_total = 0;
+
+  /* return false if the free lists don't hold exactly the free blocks */
+  for (size_t order = MIN_ORDER; order <= heap_order; order++)
+  {
+    size_t num_listed = 0;
+    size_t num_counted = 0;
+    node_t *prev = NULL;
+
+    for (node_t *curr = free_lists[order]; curr != NULL; curr = curr->next)
+    {
+      if (curr->prev != prev || get_order(block_offset(curr)) != order)
+      {
+        printf("Free list for order %ld is corrupted at %p!\n", order, curr);
+
+        breakpoint();
+
+        return false;
+      }
+
+      num_listed++;
+      num_counted += (block_offset(curr) < high_water);
+      prev = curr;
+    }
+
+    num_counted_total += num_counted;
+
+    if (num_listed != num_free_blocks[order])
+    {
+      printf("Free list for order %ld holds %ld blocks, but %ld blocks are free!\n", order, num_listed, num_free_blocks[order]);
+
+      breakpoint();
+
+      return false;
+    }
+
+    /* return false if the total kept for myheap_stats has drifted from the free list */
+    if (num_counted != free_blocks_by_order[order])
+    {
+      printf("Free list for order %ld holds %ld blocks below the high-water mark, but the statistics say %ld!\n", order, num_counted, free_blocks_by_order[order]);
+
+      breakpoint();
+
+      return false;
+    }
+  }
+
+  /* return false if the total kept for myheap_stats has drifted from the free lists */
+  if (num_counted_total != free_blocks)
+  {
+    printf("The free lists hold %ld blocks below the high-water mark, but the statistics say %ld!\n", num_counted_total, free_blocks);
+
+    breakpoint();
+
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: dump_heap
+ * -------------------
+ * This function prints out the the block contents of the heap. It is not
+ * called anywhere, but is a useful helper function to call from gdb when
+ * tracing through programs. It prints out the total range of the heap, and
+ * information about each block within it.
+ */
+void dump_heap()
+{
+  printf("Segment start: %p\n", segment_start);
+  printf("Segment end: %p\n", segment_end);
+  printf("Segment size: %ld bytes\n", segment_size);
+  printf("Heap order: %ld (%ld bytes)\n", heap_order, order_size(heap_order));
+  printf("Block orders and tags: %p\n", block_orders);
+  printf("Bitmaps: %p\n", bitmaps[MIN_ORDER]);
+  printf("Nused: %ld bytes\n\n", nused);
+
+  printf("%21s %12s %5s\n", "POINTER", "SIZE", "FREE");
+  printf("----------------------------------------\n");
+
+  size_t offset = 0;
+
+  /* loop over each block and print them in a table-like format */
+  while (offset < order_size(heap_order))
+  {
+    size_t order = heap_order;
+
+    while (order >= MIN_ORDER && ((offset & (order_size(order) - 1)) != 0 || !is_free(offset, order)))
+    {
+      order--;
+    }
+
+    int free = (order >= MIN_ORDER);
+
+    if (!free)
+    {
+      order = get_order(offset);
+    }
+
+    printf("Block:   [%p   %10ld   %2d]\n", block_at(offset), order_size(order), free);
+
+    offset += order_size(order);
+  }
+}
+
+/* Function: mydump_heap_binary
+ * -----------------
+ * This function writes a snapshot of the heap to fd, walking its blocks as dump_heap does.
+ * Free space past the high water mark, and the space between the heap and the orders and
+ * tags of its blocks, is unused, and the orders, tags and bitmaps are overhead.
+ */
+bool mydump_heap_binary(int fd)
+{
+  heap_dump_t dump;
+  size_t offset = 0;
+
+  heap_dump_start(&dump, fd, segment_start, segment_size);
+
+  while (offset < order_size(heap_order))
+  {
+    size_t order = heap_order;
+
+    while (order >= MIN_ORDER && ((offset & (order_size(order) - 1)) != 0 || !is_free(offset, order)))
+    {
+      order--;
+    }
+
+    int free = (order >= MIN_ORDER);
+
+    if (!free)
+    {
+      order = get_order(offset);
+    }
+
+    /* free blocks past the high water mark have never been handed out, and a free block
+     * that straddles it is free only up to the mark, as myheap_stats counts it
+     */
+    if (!free)
+    {
+      heap_dump_block(&dump, block_at(offset), order_size(order), DUMP_ALLOCATED, get_tag(offset));
+    }
+    else if (offset >= high_water)
+    {
+      heap_dump_block(&dump, block_at(offset), order_size(order), DUMP_UNUSED, 0);
+    }
+    else if (offset + order_size(order) > high_water)
+    {
+      heap_dump_block(&dump, block_at(offset), high_water - offset, DUMP_FREE, 0);
+      heap_dump_block(&dump, block_at(high_water), offset + order_size(order) - high_water, DUMP_UNUSED, 0);
+    }
+    else
+    {
+      heap_dump_block(&dump, block_at(offset), order_size(order), DUMP_FREE, 0);
+    }
+
+    offset += order_size(order);
+  }
+
+  char *heap_end = (char *)block_at(0) + order_size(heap_order);
+
+  heap_dump_block(&dump, heap_end, (char *)block_orders - heap_end, DUMP_UNUSED, 0);
+  heap_dump_block(&dump, block_orders, (char *)segment_end - (char *)block_orders, DUMP_OVERHEAD, 0);
+
+  return heap_dump_finish(&dump);
+}
@@ -14,6 +14,10 @@
 #include <string.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./alloc_trace.h"
+#include "./heap_dump.h"
+#include "./heap_profile.h"
+#include "./probes.h"
 
 // how many bytes are printed per line in dump_heap
 #define BYTES_PER_LINE 32
@@ -22,6 +26,17 @@ static void *segment_start;
 static size_t segment_size;
 static size_t nused;
 
+// calls that have handed out, freed or resized blocks, for myheap_stats
+static size_t mallocs;
+static size_t frees;
+static size_t reallocs;
+
+// the tag this thread allocates blocks under, and the blocks and bytes handed
+// out under each tag, which stay live since they are never reused
+static __thread unsigned current_tag;
+static size_t tag_live_bytes[HEAP_MAX_TAGS];
+static size_t tag_live_blocks[HEAP_MAX_TAGS];
+
 /* Function: myinit
  * ----------------
  * This function initializes our global variables based on the specified
@@ -32,6 +47,11 @@ bool myinit(void *heap_start, size_t heap_size)
   segment_start = heap_start;
   segment_size = heap_size;
   nused = 0;
+  mallocs = 0;
+  frees = 0;
+  reallocs = 0;
+  memset(tag_live_bytes, 0, sizeof(tag_live_bytes));
+  memset(tag_live_blocks, 0, sizeof(tag_live_blocks));
   return true;
 }
 
@@ -45,13 +65,13 @@ size_t roundup(size_t sz, size_t mult)
   return (sz + mult - 1) & ~(mult - 1);
 }
 
-/* Function: mymalloc
- * ------------------
+/* Function: allocate_block
+ * -------------------------
  * This function satisfies an allocation request by placing
  * the allocated block at the end of the heap.  No search means
  * it is fast, but no memory recycling means very poor utilization.
  */
-void *mymalloc(size_t requested_size)
+void *allocate_block(size_t requested_size)
 {
   size_t needed = roundup(requested_size, ALIGNMENT);
   if (needed + nused > segment_size)
@@ -60,29 +80,125 @@ void *mymalloc(size_t requested_size)
   }
   void *ptr = (char *)segment_start + nused;
   nused += needed;
+  mallocs++;
+  tag_live_bytes[current_tag] += needed;
+  tag_live_blocks[current_tag]++;
+  heap_profile_malloc(ptr, requested_size);
+  trace_malloc(ptr, requested_size);
   return ptr;
 }
 
+/* Function: mymalloc
+ * ------------------
+ * This function allocates a block for the requested size with the default
+ * lifetime.
+ */
+void *mymalloc(size_t requested_size)
+{
+  return mymalloc_hint(requested_size, LIFETIME_LONG);
+}
+
+/* Function: mymalloc_hint
+ * -----------------------
+ * The bump allocator places every block at the end of the heap, so the
+ * lifetime hint makes no difference.  This function allocates a block with
+ * allocate_block, between the probes that mark the entry and return of each
+ * malloc.
+ */
+void *mymalloc_hint(size_t requested_size, lifetime_hint_t hint)
+{
+  HEAP_PROBE2(malloc__entry, requested_size, hint);
+  void *ptr = allocate_block(requested_size);
+  HEAP_PROBE2(malloc__return, ptr, requested_size);
+  return ptr;
+}
+
+/* Function: mymalloc_tagged
+ * -------------------------
+ * This function allocates a block for the requested size under the given
+ * tag, and returns null if the tag is out of range.
+ */
+void *mymalloc_tagged(size_t requested_size, unsigned tag)
+{
+  if (tag >= HEAP_MAX_TAGS)
+  {
+    return NULL;
+  }
+  unsigned old_tag = current_tag;
+  current_tag = tag;
+  void *ptr = mymalloc(requested_size);
+  current_tag = old_tag;
+  return ptr;
+}
+
+/* Function: myset_tag
+ * -------------------
+ * This function sets the tag this thread allocates blocks under, unless it
+ * is out of range, and returns the tag it had before.
+ */
+unsigned myset_tag(unsigned tag)
+{
+  unsigned old_tag = current_tag;
+  if (tag < HEAP_MAX_TAGS)
+  {
+    current_tag = tag;
+  }
+  return old_tag;
+}
+
 /* Function: myfree
  * ----------------
- * This function does nothing - fast!... but lame :(
+ * This function does nothing - fast!... but lame :(  It only counts the
+ * call, fires its probes and tells the heap profiler and the allocation
+ * trace, so that they show which blocks the client is done with.
  */
-void myfree(void *ptr) {}
+void myfree(void *ptr)
+{
+  HEAP_PROBE1(free__entry, ptr);
+  if (ptr != NULL)
+  {
+    frees++;
+    heap_profile_free(ptr);
+    trace_free(ptr);
+  }
+  HEAP_PROBE1(free__return, ptr);
+}
 
-/* Function: realloc
- * -----------------
+/* Function: resize_block
+ * ----------------------
  * This function satisfies requests for resizing previously-allocated memory
  * blocks by allocating a new block of the requested size and moving the
  * existing contents to that region.  It's not particularly efficient.
  */
-void *myrealloc(void *old_ptr, size_t new_size)
+void *resize_block(void *old_ptr, size_t new_size)
 {
+  reallocs++;
   void *new_ptr = mymalloc(new_size);
   memcpy(new_ptr, old_ptr, new_size);
   myfree(old_ptr);
   return new_ptr;
 }
 
+/* Function: myrealloc
+ * ---------------------
+ * This function resizes a block with resize_block, between the probes that
+ * mark the entry and return of each realloc, and records the call in the
+ * allocation trace as a single resize rather than as the malloc and free it
+ * is made of.  Blocks have no headers to keep their tags in, so unlike the
+ * other allocators, the copy is allocated under the thread's current tag
+ * rather than the tag of the block it replaces.
+ */
+void *myrealloc(void *old_ptr, size_t new_size)
+{
+  HEAP_PROBE2(realloc__entry, old_ptr, new_size);
+  trace_suspend();
+  void *new_ptr = resize_block(old_ptr, new_size);
+  trace_resume();
+  trace_realloc(old_ptr, new_ptr, new_size);
+  HEAP_PROBE3(realloc__return, new_ptr, old_ptr, new_size);
+  return new_ptr;
+}
+
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
@@ -101,6 +217,49 @@ bool validate_heap()
   return true;
 }
 
+/* Function: validate_heap_level
+ * -----------------------------
+ * Checking the bump allocator already takes constant time, so every level
+ * does the same checks as validate_heap.
+ */
+bool validate_heap_level(validate_level_t level)
+{
+  return validate_heap();
+}
+
+/* Function: myheap_stats
+ * ----------------------
+ * Everything up to the end of the last block is committed and stays live,
+ * since none of it is ever free to be used again.
+ */
+void myheap_stats(heap_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->committed_bytes = nused;
+  stats->live_bytes = nused;
+  stats->live_blocks = mallocs - frees;
+  stats->mallocs = mallocs;
+  stats->frees = frees;
+  stats->reallocs = reallocs;
+}
+
+/* Function: myheap_tag_stats
+ * --------------------------
+ * Blocks have no headers to keep their tags in, so a block freed or moved
+ * by realloc can't be taken off its tag's totals.  Like everything else in
+ * the bump heap, it stays live, and the totals count every block handed out
+ * under the tag.
+ */
+void myheap_tag_stats(unsigned tag, heap_tag_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  if (tag < HEAP_MAX_TAGS)
+  {
+    stats->live_bytes = tag_live_bytes[tag];
+    stats->live_blocks = tag_live_blocks[tag];
+  }
+}
+
 /* Function: dump_heap
  * -------------------
  * This function is not called from anywhere, it is just here to
@@ -126,3 +285,20 @@ void dump_heap()
     printf("%02x ", *cur);
   }
 }
+
+/* Function: mydump_heap_binary
+ * -----------------
+ * This function writes a snapshot of the heap to fd. A bump allocator doesn't keep track of
+ * its blocks, so the bytes handed out so far are recorded as one allocated range and the
+ * rest of the segment as unused.
+ */
+bool mydump_heap_binary(int fd)
+{
+  heap_dump_t dump;
+
+  heap_dump_start(&dump, fd, segment_start, segment_size);
+  heap_dump_block(&dump, segment_start, nused, DUMP_ALLOCATED, 0);
+  heap_dump_block(&dump, (char *)segment_start + nused, segment_size - nused, DUMP_UNUSED, 0);
+
+  return heap_dump_finish(&dump);
+}
@@ -0,0 +1,377 @@
+/*
+ * File: compare_allocators.c
+ * --------------------------
+ * Runs every allocator, and glibc's malloc as a baseline, on the same
+ * scripts in one process and prints a table of utilization, throughput and
+ * p99 latency for each script.  The allocators all define the same symbols,
+ * so the Makefile makes every symbol in each allocator's object file local
+ * except for its interface, which it renames with the allocator's name as a
+ * prefix (bump_mymalloc, explicit_myfree, ...).  They are then called through
+ * a table of function pointers.  Text and binary scripts can both be used.
+ *
+ * Usage: compare_allocators <script> ...
+ */
+
+#include <error.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "script.h"
+#include "segment.h"
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+const long HEAP_SIZE = 1L << 32;
+
+// Percentile of request latency reported for each allocator
+const int LATENCY_PERCENTILE = 99;
+
+// The interface of one allocator, with its symbols prefixed by its name
+#define DECLARE_ALLOCATOR(name) \
+    bool name##_myinit(void *heap_start, size_t heap_size); \
+    void *name##_mymalloc(size_t requested_size); \
+    void *name##_myrealloc(void *old_ptr, size_t new_size); \
+    void name##_myfree(void *ptr);
+
+DECLARE_ALLOCATOR(bump)
+DECLARE_ALLOCATOR(implicit)
+DECLARE_ALLOCATOR(explicit)
+DECLARE_ALLOCATOR(buddy)
+
+// struct for one allocator to compare
+typedef struct {
+    const char *name;
+    bool (*init)(void *heap_start, size_t heap_size);
+    void *(*malloc)(size_t requested_size);
+    void *(*realloc)(void *old_ptr, size_t new_size);
+    void (*free)(void *ptr);
+    bool in_segment;    // whether blocks come from the heap segment
+} allocator_t;
+
+#define ALLOCATOR(name) \
+    { #name, name##_myinit, name##_mymalloc, name##_myrealloc, name##_myfree, true }
+
+static bool glibc_init(void *heap_start, size_t heap_size);
+
+const allocator_t ALLOCATORS[] = {
+    ALLOCATOR(bump),
+    ALLOCATOR(implicit),
+    ALLOCATOR(explicit),
+    ALLOCATOR(buddy),
+    { "glibc", glibc_init, malloc, realloc, free, false },
+};
+#define NUM_ALLOCATORS (int)(sizeof(ALLOCATORS) / sizeof(ALLOCATORS[0]))
+
+// struct for the requests of one script
+typedef struct {
+    const char *name;
+    request_t *ops;
+    int num_ops;
+    int num_ids;
+} script_t;
+
+// struct for how one allocator did on one script
+typedef struct {
+    bool success;
+    int utilization;    // peak payload as a percentage of the heap used
+    double ops_per_sec;
+    uint64_t latency;   // LATENCY_PERCENTILE latency in nanoseconds
+} result_t;
+
+
+/* Function: glibc_init
+ * --------------------
+ * glibc's malloc manages its own memory, so all there is to do is hand back
+ * the free memory at the top of its heap, so that a run's footprint isn't
+ * hidden by memory left over from before it.
+ */
+static bool glibc_init(void *heap_start, size_t heap_size) {
+    malloc_trim(0);
+    return true;
+}
+
+/* Function: glibc_footprint
+ * -------------------------
+ * Returns the closest thing glibc has to how far into the segment our
+ * allocators have used: how much further its main arena reaches than it did
+ * at `base`, leaving out the free chunk at its top.  A run that fits in
+ * memory glibc already had doesn't grow the arena at all, so the footprint
+ * is never taken to be less than `live_chunks`, the bytes taken up by the
+ * chunks of the run's live blocks, headers included.
+ */
+static size_t glibc_footprint(struct mallinfo2 *base, size_t live_chunks) {
+    struct mallinfo2 info = mallinfo2();
+    size_t reach = info.arena - info.keepcost + info.hblkhd;
+    size_t base_reach = base->arena - base->keepcost + base->hblkhd;
+    size_t grown = (reach > base_reach) ? reach - base_reach : 0;
+    return (grown > live_chunks) ? grown : live_chunks;
+}
+
+// Returns the bytes of the glibc chunk holding a block, including its header
+static size_t glibc_chunk_size(void *ptr) {
+    return ptr ? malloc_usable_size(ptr) + sizeof(size_t) : 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Function: load_script
+ * ---------------------
+ * Reads every request of a text or binary script into memory, checking each
+ * line of a text script and each record of a binary one the same way the
+ * test harness does.
+ */
+static script_t load_script(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+    script_t script = { .name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path };
+
+    binary_script_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, BINARY_SCRIPT_MAGIC, sizeof(header.magic)) == 0) {
+        if (header.version != BINARY_SCRIPT_VERSION || header.record_size != sizeof(request_t)) {
+            error(1, 0, "Binary script \"%s\" was written for a different version or machine.", path);
+        }
+        if (header.num_ops > INT32_MAX || header.num_ids > INT32_MAX) {
+            error(1, 0, "Binary script \"%s\" is truncated or malformed.", path);
+        }
+        script.ops = malloc(header.num_ops * sizeof(request_t));
+        if (!script.ops) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        if (fread(script.ops, sizeof(request_t), header.num_ops, fp) != header.num_ops) {
+            error(1, 0, "Binary script \"%s\" is truncated or malformed.", path);
+        }
+        size_t bad = find_bad_record(script.ops, header.num_ops, header.num_ids, MAX_REQUEST_SIZE);
+        if (bad < header.num_ops) {
+            error(1, 0, "Binary script \"%s\" has a malformed request (line %d).", path,
+                script.ops[bad].lineno);
+        }
+        script.num_ops = header.num_ops;
+        script.num_ids = header.num_ids;
+        fclose(fp);
+        return script;
+    }
+    rewind(fp);
+
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    int lineno = 0, capacity = 0;
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        lineno++;
+
+        // skip lines that are all-whitespace or comments
+        char ch;
+        if (sscanf(buffer, " %c", &ch) != 1 || ch == '#') {
+            continue;
+        }
+
+        request_t request = { .lineno = lineno, .op = 0, .size = 0 };
+        char request_char;
+        int nscanned = sscanf(buffer, " %c %d %zu", &request_char, &request.id, &request.size);
+        if (request_char == 'a' && nscanned == 3) {
+            request.op = ALLOC;
+        } else if (request_char == 'r' && nscanned == 3) {
+            request.op = REALLOC;
+        } else if (request_char == 'f' && nscanned == 2) {
+            request.op = FREE;
+        } else if (request_char == 'x' && nscanned == 2) {
+            request.op = REMOTE_FREE;
+        }
+        if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
+            error(1, 0, "Line %d of script file '%s' is malformed.", lineno, path);
+        }
+
+        if (script.num_ops == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            script.ops = realloc(script.ops, capacity * sizeof(request_t));
+            if (!script.ops) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        script.ops[script.num_ops++] = request;
+        if (request.id >= script.num_ids) {
+            script.num_ids = request.id + 1;
+        }
+    }
+    fclose(fp);
+    return script;
+}
+
+
+/* Function: run_script
+ * --------------------
+ * Sends every request in the script to the allocator.  If `latencies` isn't
+ * NULL, the time each request takes is stored in it.  If `footprint` isn't
+ * NULL, the peak payload and the most heap the allocator has used are
+ * tracked after every request and stored in it and `peak_payload`.  Any
+ * blocks still allocated at the end are freed, so that glibc starts each run
+ * from the same state.  Returns false if the heap was exhausted.
+ */
+static bool run_script(const allocator_t *allocator, script_t *script, void **ptrs,
+    uint64_t *latencies, size_t *footprint, size_t *peak_payload) {
+    init_heap_segment(HEAP_SIZE);
+    if (!allocator->init(heap_segment_start(), heap_segment_size())) {
+        return false;
+    }
+    memset(ptrs, 0, script->num_ids * sizeof(void *));
+    size_t *sizes = calloc(script->num_ids, sizeof(size_t));
+    size_t *chunk_sizes = calloc(script->num_ids, sizeof(size_t));
+    if (!sizes || !chunk_sizes) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    struct mallinfo2 base = mallinfo2();
+    size_t payload = 0, live_chunks = 0;
+    bool success = true;
+
+    for (int req = 0; req < script->num_ops && success; req++) {
+        request_t *request = &script->ops[req];
+        void **ptr = &ptrs[request->id];
+
+        uint64_t start = latencies ? now_ns() : 0;
+        if (request->op == ALLOC) {
+            *ptr = allocator->malloc(request->size);
+        } else if (request->op == REALLOC) {
+            *ptr = allocator->realloc(*ptr, request->size);
+        } else {
+            allocator->free(*ptr);
+            *ptr = NULL;
+        }
+        if (latencies) {
+            latencies[req] = now_ns() - start;
+        }
+
+        if (*ptr == NULL && request->size != 0 && request->op != FREE && request->op != REMOTE_FREE) {
+            success = false;
+        }
+
+        if (footprint) {
+            payload += (*ptr ? request->size : 0) - sizes[request->id];
+            sizes[request->id] = *ptr ? request->size : 0;
+            if (payload > *peak_payload) {
+                *peak_payload = payload;
+            }
+
+            size_t used;
+            if (!allocator->in_segment) {
+                live_chunks += glibc_chunk_size(*ptr) - chunk_sizes[request->id];
+                chunk_sizes[request->id] = glibc_chunk_size(*ptr);
+                used = glibc_footprint(&base, live_chunks);
+            } else if (*ptr) {
+                used = (char *)*ptr + request->size - (char *)heap_segment_start();
+            } else {
+                used = 0;
+            }
+            if (used > *footprint) {
+                *footprint = used;
+            }
+        }
+    }
+
+    for (int id = 0; id < script->num_ids; id++) {
+        if (ptrs[id] != NULL) {
+            allocator->free(ptrs[id]);
+        }
+    }
+    free(sizes);
+    free(chunk_sizes);
+    return success;
+}
+
+/* Function: compare_on_script
+ * ---------------------------
+ * Measures one allocator on one script in three separate runs, so that each
+ * measurement doesn't disturb the others: one tracking utilization, one
+ * timing the whole script for throughput, and one timing each request.
+ */
+static result_t compare_on_script(const allocator_t *allocator, script_t *script) {
+    result_t result = { .success = false };
+    void **ptrs = malloc(script->num_ids * sizeof(void *));
+    uint64_t *latencies = malloc(script->num_ops * sizeof(uint64_t));
+    if (!ptrs || !latencies) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    size_t footprint = 0, peak_payload = 0;
+    if (run_script(allocator, script, ptrs, NULL, &footprint, &peak_payload)) {
+        result.utilization = footprint ? (100 * peak_payload) / footprint : 100;
+
+        uint64_t start = now_ns();
+        run_script(allocator, script, ptrs, NULL, NULL, NULL);
+        result.ops_per_sec = script->num_ops * 1e9 / (now_ns() - start);
+
+        run_script(allocator, script, ptrs, latencies, NULL, NULL);
+        qsort(latencies, script->num_ops, sizeof(uint64_t), compare_latencies);
+        // nearest-rank percentile
+        int rank = (LATENCY_PERCENTILE * script->num_ops + 99) / 100;
+        result.latency = script->num_ops ? latencies[rank - 1] : 0;
+        result.success = true;
+    }
+
+    free(ptrs);
+    free(latencies);
+    return result;
+}
+
+
+/* Function: main
+ * --------------
+ * Prints a table for each script with a row for every allocator, followed
+ * by each allocator's utilization and throughput averaged over the scripts
+ * that it ran successfully.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        error(1, 0, "Usage: %s <script> ...", argv[0]);
+    }
+
+    int total_util[NUM_ALLOCATORS] = {0};
+    double total_rate[NUM_ALLOCATORS] = {0};
+    int nsuccesses[NUM_ALLOCATORS] = {0};
+
+    for (int i = 1; i < argc; i++) {
+        script_t script = load_script(argv[i]);
+        printf("\n%s (%d requests)\n", script.name, script.num_ops);
+        printf("  %-10s %5s %12s %10s\n", "allocator", "util", "ops/sec", "p99");
+
+        for (int a = 0; a < NUM_ALLOCATORS; a++) {
+            result_t result = compare_on_script(&ALLOCATORS[a], &script);
+            if (!result.success) {
+                printf("  %-10s heap exhausted\n", ALLOCATORS[a].name);
+                continue;
+            }
+            printf("  %-10s %4d%% %12.0f %8luns\n", ALLOCATORS[a].name, result.utilization,
+                result.ops_per_sec, result.latency);
+            total_util[a] += result.utilization;
+            total_rate[a] += result.ops_per_sec;
+            nsuccesses[a]++;
+        }
+        free(script.ops);
+    }
+
+    printf("\nAverage over scripts\n");
+    printf("  %-10s %5s %12s\n", "allocator", "util", "ops/sec");
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        if (nsuccesses[a] > 0) {
+            printf("  %-10s %4d%% %12.0f\n", ALLOCATORS[a].name, total_util[a] / nsuccesses[a],
+                total_rate[a] / nsuccesses[a]);
+        }
+    }
+    return 0;
+}
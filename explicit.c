@@ -9,21 +9,66 @@
 #include <string.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./alloc_trace.h"
+#include "./heap_dump.h"
+#include "./heap_profile.h"
+#include "./probes.h"
+#include "./span.h"
+
+/* the size classes that small blocks are rounded up to, and the size from which blocks are
+ * given whole pages instead, as written by tune_classes (the Makefile's SIZE_CLASSES)
+ */
+#ifndef SIZE_CLASSES_HEADER
+#define SIZE_CLASSES_HEADER "./size_classes.h"
+#endif
+#include SIZE_CLASSES_HEADER
 
 #define HEADER_SIZE 0x8
 #define NODE_POINTER_SIZE 0x8
 #define MASKING_BIT 1L
+#define GROWN_BIT 2L
+#define SLACK_BIT 4L
+#define STATUS_BITS 7L
+
+/* a block's allocation tag is kept in the top bits of its header, well above any size */
+#define TAG_SHIFT (64 - HEAP_TAG_BITS)
+#define TAG_BITS ((size_t)(HEAP_MAX_TAGS - 1) << TAG_SHIFT)
 #define MIN_BLOCK_SIZE 0x18
 
 #define FREE 1
 #define ALLOCATED 0
 
+/* number of pages the permanent zone takes off the end of the page zone at a time */
+#define PERMANENT_PAGES 16
+
+/* number of pages the page heap is asked for when we need a new arena of blocks */
+#define ARENA_PAGES 16
+
+/* no arena is bigger than this, since an arena only grows past ARENA_PAGES to fit a block
+ * smaller than LARGE_BLOCK_SIZE, and so neither is any free block
+ */
+#define MAX_ARENA_SIZE ((LARGE_BLOCK_SIZE + 2 * PAGE_SIZE > ARENA_PAGES * PAGE_SIZE) ? LARGE_BLOCK_SIZE + 2 * PAGE_SIZE : ARENA_PAGES * PAGE_SIZE)
+
+/* number of arenas touched by the latest calls that an incremental check of the heap walks */
+#define TOUCHED_ARENAS 2
+
 static void *segment_start;
 static size_t segment_size;
 static void *segment_end;
 static size_t nused;
 
+/* the segment is laid out as [page zone][permanent zone][page map]. The page heap hands
+ * out runs of pages from the page zone up to pages_end, both to large blocks and to the
+ * arenas that smaller blocks are tiled in, and permanent blocks are bumped down from
+ * permanent_end to permanent_top. The permanent zone starts out empty, and moves pages_end
+ * down by taking free pages off the end of the page zone as it needs them
+ */
+static void *pages_end;
+static void *permanent_top;
+static void *permanent_end;
+
 typedef struct node node_t;
+typedef struct arena arena_t;
 typedef size_t header_t;
 
 struct node
@@ -32,6 +77,56 @@ struct node
   node_t *next;
 };
 
+/* an arena is a span of pages tiled by blocks, and ends with an epilogue header of size 0.
+ * Every arena keeps its own linked list of free blocks.
+ */
+struct arena
+{
+  arena_t *next;
+  size_t size;
+  lifetime_hint_t zone;
+};
+
+/* arenas for long-lived blocks (the main zone) and for short-lived blocks (the churn zone),
+ * each kept in address order
+ */
+static arena_t *main_arenas;
+static arena_t *churn_arenas;
+
+/* totals for myheap_stats, kept up to date whenever a free block appears or goes, an arena
+ * is added or released, or a block is handed out or freed
+ */
+static size_t free_bytes;
+static size_t free_blocks;
+static size_t free_blocks_by_class[HEAP_STATS_CLASSES];
+static size_t narenas;
+
+/* free blocks are also counted by their exact size, so that the largest of them can be
+ * kept up to date when the last block of its size goes
+ */
+static size_t free_blocks_by_size[MAX_ARENA_SIZE / ALIGNMENT];
+static size_t largest_free_bytes;
+
+static size_t mallocs;
+static size_t frees;
+static size_t reallocs;
+
+/* number of times a grown block has been given slack that trim_block could split off since
+ * reclaim_slack last walked the heap, so that the walk is skipped when there is none
+ */
+static size_t slack_blocks;
+
+/* the tag this thread allocates blocks under, and the blocks and bytes live under each tag */
+static __thread unsigned current_tag;
+static size_t tag_live_bytes[HEAP_MAX_TAGS];
+static size_t tag_live_blocks[HEAP_MAX_TAGS];
+
+/* the arenas touched by calls since the last incremental check of the heap, and the arena
+ * that the window the incremental checks roll over the heap with comes to next
+ */
+static arena_t *touched_arenas[TOUCHED_ARENAS];
+static arena_t *window_arena;
+
 /* Function: roundup
  * -----------------
  * This function rounds up the given number to the given multiple, which
@@ -42,6 +137,60 @@ size_t roundup(size_t num, size_t mult)
   return (num + mult - 1) & ~(mult - 1);
 }
 
+/* Function: size_class
+ * -----------------
+ * This function returns the size class a block of the given number of bytes is counted in
+ * by myheap_stats, which is the index of its highest set bit.
+ */
+size_t size_class(size_t bytes)
+{
+  size_t class = 63 - __builtin_clzl(bytes);
+
+  return (class < HEAP_STATS_CLASSES) ? class : HEAP_STATS_CLASSES - 1;
+}
+
+/* Function: class_size
+ * -----------------
+ * This function returns the size of the size class that a block smaller than
+ * LARGE_BLOCK_SIZE is rounded up to, given the multiple of ALIGNMENT it needs. Without a
+ * table of size classes, blocks are only rounded up to ALIGNMENT.
+ */
+size_t class_size(size_t needed)
+{
+#if NUM_SIZE_CLASSES > 0
+  return size_class_bytes[size_class_of[needed / ALIGNMENT]];
+#else
+  return needed;
+#endif
+}
+
+/* Function: count_free
+ * -----------------
+ * This function records in the heap statistics that a free block of the given size has
+ * appeared (a delta of 1) or has gone (a delta of -1). When the last free block of the
+ * largest size goes, the counts by size are searched down from it for the next largest,
+ * which is usually close by since most free blocks go by being split.
+ */
+void count_free(size_t block_size, long delta)
+{
+  size_t bytes = HEADER_SIZE + block_size;
+
+  free_bytes += delta * bytes;
+  free_blocks += delta;
+  free_blocks_by_class[size_class(bytes)] += delta;
+  free_blocks_by_size[bytes / ALIGNMENT] += delta;
+
+  if (delta > 0 && bytes > largest_free_bytes)
+  {
+    largest_free_bytes = bytes;
+  }
+
+  while (largest_free_bytes > 0 && free_blocks_by_size[largest_free_bytes / ALIGNMENT] == 0)
+  {
+    largest_free_bytes -= ALIGNMENT;
+  }
+}
+
 /* Function: is_free
  * -----------------
  * This function returns whether or not a block is free, this is accomplished by
@@ -56,24 +205,46 @@ bool is_free(header_t *header)
 /* Function: set_header
  * -----------------
  * This function sets the properties of a header i.e. its size and status bit. We know that
- * the size passed in should always be a multiple of ALIGNMENT.
+ * the size passed in should always be a multiple of ALIGNMENT. An allocated block keeps
+ * its tag, and a free block has none.
  */
 void set_header(header_t *header, size_t size, char status)
 {
-  *header = size;
+  size_t tag_bits = (status == ALLOCATED) ? (*header & TAG_BITS) : 0;
+
+  *header = size | tag_bits;
   *header |= (size_t)status;
 }
 
 /* Function: get_size
  * -----------------
- * This function returns the size of a block on the heap by zeroing out the LSB
- * i.e. the status bit of the header.
+ * This function returns the size of a block on the heap by zeroing out the three
+ * LSBs i.e. the status bits of the header, and the tag bits at the top.
  */
 size_t get_size(header_t *header)
 {
-  size_t zero_out_lsb = ~(MASKING_BIT);
+  size_t zero_out_status_bits = ~(STATUS_BITS | TAG_BITS);
+
+  return *header & zero_out_status_bits;
+}
+
+/* Function: get_tag
+ * -----------------
+ * This function returns the allocation tag of an allocated block, which is kept in the
+ * top bits of its header.
+ */
+unsigned get_tag(header_t *header)
+{
+  return (*header & TAG_BITS) >> TAG_SHIFT;
+}
 
-  return *header & zero_out_lsb;
+/* Function: set_tag
+ * -----------------
+ * This function sets the allocation tag of an allocated block.
+ */
+void set_tag(header_t *header, unsigned tag)
+{
+  *header = (*header & ~TAG_BITS) | ((size_t)tag << TAG_SHIFT);
 }
 
 /* Function: header2payload
@@ -100,8 +271,8 @@ header_t *payload2header(void *payload)
 
 /* Function: next_block
  * -----------------
- * This function returns a pointer to next header block allocated on the heap or null if
- * the block is out of range.
+ * This function returns a pointer to next header block allocated in the arena or null if
+ * the block is the last one in the arena.
  */
 header_t *next_block(header_t *header)
 {
@@ -110,8 +281,27 @@ header_t *next_block(header_t *header)
 
   header_t *next_header_ptr = (header_t *)((char *)header2payload(header) + payload_size);
 
-  /* return null pointer if the next header comes after the end of the heap segment */
-  return (next_header_ptr < (header_t *)segment_end) ? next_header_ptr : NULL;
+  /* return null pointer if the next header is the epilogue at the end of the arena */
+  return (get_size(next_header_ptr) != 0) ? next_header_ptr : NULL;
+}
+
+/* Function: first_block
+ * -----------------
+ * This function returns a pointer to the header of the first block in an arena.
+ */
+header_t *first_block(arena_t *arena)
+{
+  return (header_t *)(arena + 1);
+}
+
+/* Function: arena_of
+ * -----------------
+ * This function returns the arena that a block lies in, which is the span of pages
+ * containing it.
+ */
+arena_t *arena_of(header_t *header)
+{
+  return span_start(header);
 }
 
 /* Function: find_free_block
@@ -193,12 +383,16 @@ size_t count_free_blocks(header_t *start)
 
 /* Function: add_free_block
  * -----------------
- * This function adds a new free block into the linked list.
+ * This function adds a new free block into the linked list of its arena.
  */
 void add_free_block(struct node *free_block_node)
 {
-  /* if there are no free blocks in the heap then this is the head of the linked list */
-  if (count_free_blocks(segment_start) == 0)
+  count_free(get_size(payload2header(free_block_node)), 1);
+
+  header_t *arena_start = first_block(arena_of(payload2header(free_block_node)));
+
+  /* if there are no free blocks in the arena then this is the head of the linked list */
+  if (count_free_blocks(arena_start) == 0)
   {
     free_block_node->prev = NULL;
     free_block_node->next = NULL;
@@ -212,7 +406,7 @@ void add_free_block(struct node *free_block_node)
     /* this part handles the event that a node is added to the end of the linked list */
     if (next_free_block_header == NULL)
     {
-      header_t *first_free_block_header = find_free_block(segment_start);
+      header_t *first_free_block_header = find_free_block(arena_start);
       node_t *first_free_block_node = header2payload(first_free_block_header);
 
       /* find last free node is linked list */
@@ -255,6 +449,8 @@ void detach_free_block(struct node *free_payload)
   struct node *prev = free_payload->prev;
   struct node *next = free_payload->next;
 
+  count_free(get_size(payload2header(free_payload)), -1);
+
   /* check edge cases where we are at first or last free block on the heap */
   if (prev != NULL)
   {
@@ -290,251 +486,1472 @@ void *split_block(header_t *free_block_header, size_t needed, size_t block_size)
 
   nused += HEADER_SIZE;
 
+  HEAP_PROBE3(block__split, free_block_node, block_size, needed);
+
   return new_free_block_node;
 }
 
-/* Function: myinit
+/* Function: can_coalesce
  * -----------------
- * This function returns true if initialization was successful, or false otherwise.
- * The myinit function can be called to reset the heap to an empty state. When running
- * against a set of of test scripts, our test harness calls myinit before starting each
- * new script.
+ * This function returns whether or not a block can be merged into the block before it,
+ * i.e. it exists (it isn't past the end of the arena) and is free.
  */
-bool myinit(void *heap_start, size_t heap_size)
+bool can_coalesce(header_t *next_header)
 {
-  segment_start = heap_start;
-  segment_size = heap_size;
-  segment_end = (char *)segment_start + segment_size;
+  return next_header != NULL && is_free(next_header);
+}
 
-  /* if we can't store a header and a node on our heap then it is not big enough */
-  if (heap_size < MIN_BLOCK_SIZE)
-  {
-    return false;
-  }
+/* Function: is_grown
+ * -----------------
+ * This function returns whether or not a block has been grown by myrealloc before, which
+ * is stored in the second LSB of the header.
+ */
+bool is_grown(header_t *header)
+{
+  return *header & GROWN_BIT;
+}
 
-  size_t remaining_space = segment_size - HEADER_SIZE;
+/* Function: used_size
+ * -----------------
+ * This function returns the number of bytes of a block that are in use by the client. A
+ * grown block may hold slack past this point, in which case the SLACK_BIT is set and the
+ * last word of the block (which lies inside the slack) records the number of bytes in use.
+ */
+size_t used_size(header_t *header)
+{
+  size_t block_size = get_size(header);
 
-  /* set up header at start of heap */
-  set_header(segment_start, remaining_space, FREE);
+  if (!(*header & SLACK_BIT))
+  {
+    return block_size;
+  }
 
-  void *payload_ptr = header2payload((header_t *)segment_start);
+  return *(size_t *)((char *)header2payload(header) + block_size - HEADER_SIZE);
+}
 
-  /* set up free node block */
-  node_t *free_node = payload_ptr;
+/* Function: can_trim
+ * -----------------
+ * This function returns whether or not trim_block can split the bytes of a block past used
+ * off, which needs them to hold a header and a node.
+ */
+bool can_trim(size_t block_size, size_t used)
+{
+  return block_size - used >= MIN_BLOCK_SIZE;
+}
 
-  free_node->prev = NULL;
-  free_node->next = NULL;
+/* Function: mark_grown
+ * -----------------
+ * This function marks an allocated block as grown by myrealloc and records how many of its
+ * bytes are in use, so that any slack behind them can be told apart and reclaimed later.
+ */
+void mark_grown(header_t *header, size_t used)
+{
+  size_t block_size = get_size(header);
 
-  nused = HEADER_SIZE;
+  set_header(header, block_size, ALLOCATED);
 
-  return true;
-}
+  *header |= GROWN_BIT;
 
-void *mymalloc(size_t requested_size)
-{
-  /* handle the case where malloc is passed a value of 0 */
-  if (requested_size == 0)
+  if (used < block_size)
   {
-    return NULL;
-  }
+    *(size_t *)((char *)header2payload(header) + block_size - HEADER_SIZE) = used;
 
-  size_t needed = roundup(requested_size, ALIGNMENT);
+    *header |= SLACK_BIT;
 
-  /* we need to ensure that for each malloc we can store both the previous and next pointers */
-  if (needed < (2 * NODE_POINTER_SIZE))
-  {
-    needed = 2 * NODE_POINTER_SIZE;
+    if (can_trim(block_size, used))
+    {
+      slack_blocks++;
+    }
   }
+}
 
-  size_t internal_num_bytes = HEADER_SIZE + needed;
+/* Function: trim_block
+ * -----------------
+ * This function shrinks an allocated block down to used bytes, splitting the rest of the
+ * block off and adding it to the linked list (coalesced with the next block if that is
+ * free). Nothing happens if the rest of the block is too small to hold a header and a node. It
+ * returns whether or not the block was split.
+ */
+bool trim_block(header_t *header, size_t used)
+{
+  size_t block_size = get_size(header);
+  size_t remainder = block_size - used;
 
-  /* if we are requesting more memory than we have available to us (including a header and
-   * the size needed), return null
-   */
-  if (nused + internal_num_bytes > segment_size)
+  if (!can_trim(block_size, used))
   {
-    return NULL;
+    return false;
   }
 
-  header_t *free_block_header = find_free_block((header_t *)segment_start);
-  node_t *free_block_node = header2payload(free_block_header);
+  header_t *next_block_header = next_block(header);
 
-  /* traverse through all the blocks on the heap */
-  while (free_block_node != NULL)
-  {
-    free_block_header = payload2header(free_block_node);
+  set_header(header, used, ALLOCATED);
 
-    size_t free_block_size = get_size(free_block_header);
+  tag_live_bytes[get_tag(header)] -= remainder;
 
-    /* if we have a perfect fit, we don't need to create a header and a node */
-    if (needed == free_block_size)
-    {
-      detach_free_block(free_block_node);
+  header_t *tail_header = (header_t *)((char *)header2payload(header) + used);
+  size_t tail_size = remainder - HEADER_SIZE;
 
-      set_header(free_block_header, needed, ALLOCATED);
+  /* the tail keeps its header but no longer holds a payload */
+  nused -= tail_size;
 
-      nused += needed;
-    }
-    /* if we have a fit with enough room for a header and a node then we need to create a new header and node */
-    else if ((needed + MIN_BLOCK_SIZE) <= free_block_size)
-    {
-      detach_free_block(free_block_node);
+  /* coalesce the tail with the next block if it is free */
+  if (can_coalesce(next_block_header))
+  {
+    detach_free_block(header2payload(next_block_header));
 
-      void *new_free_block_node = split_block(free_block_header, needed, free_block_size);
+    tail_size += HEADER_SIZE + get_size(next_block_header);
 
-      header_t *new_free_block_header = payload2header(new_free_block_node);
+    nused -= HEADER_SIZE;
+  }
 
-      add_free_block(new_free_block_node);
+  set_header(tail_header, tail_size, ALLOCATED);
 
-      set_header(new_free_block_header, get_size(new_free_block_header), FREE);
-    }
+  add_free_block(header2payload(tail_header));
 
-    /* otherwise we need to go to the next free block */
-    free_block_node = free_block_node->next;
-  }
+  set_header(tail_header, tail_size, FREE);
 
-  return header2payload(free_block_header);
+  return true;
 }
 
-/* Function: myfree
+/* Function: grow_in_place
  * -----------------
- * This function frees a block on the heap and updates the header accordingly. If the
- * block has already been freed it does nothing. It also handles the coalescing of two
- * free blocks on the heap.
+ * This function attempts to grow an allocated block to at least needed bytes by absorbing
+ * the free block directly after it, keeping up to reserve bytes and splitting off the rest.
+ * It returns true if the block was grown, and false otherwise.
  */
-void myfree(void *ptr)
+bool grow_in_place(header_t *header, size_t needed, size_t reserve)
 {
-  /* if we try to free a null pointer, then do nothing */
-  if (ptr == NULL)
+  header_t *next_block_header = next_block(header);
+
+  if (!can_coalesce(next_block_header))
   {
-    return;
+    return false;
   }
 
-  header_t *block_header = payload2header(ptr);
-  node_t *block_node = ptr;
+  size_t next_block_size = get_size(next_block_header);
+  size_t available = get_size(header) + HEADER_SIZE + next_block_size;
 
-  /* do nothing if pointer is already free */
-  if (!is_free(block_header))
+  if (available < needed)
   {
-    header_t *next_block_header = next_block(block_header);
-    node_t *next_block_node = (node_t *)header2payload(next_block_header);
-
-    size_t block_size = get_size(block_header);
-
-    /* this handles the case where we coalesce */
-    if (is_free(next_block_header))
-    {
-      size_t coalesce_block_size = (block_size + HEADER_SIZE + get_size(next_block_header));
-
-      detach_free_block(next_block_node);
-
-      block_node->prev = next_block_node->next;
-      block_node->next = next_block_node->prev;
-
-      set_header(block_header, coalesce_block_size, ALLOCATED);
+    return false;
+  }
 
-      add_free_block(block_node);
+  detach_free_block(header2payload(next_block_header));
 
-      set_header(block_header, coalesce_block_size, FREE);
+  set_header(header, available, ALLOCATED);
 
-      nused -= (HEADER_SIZE + block_size);
-    }
-    /* this handles the case where we do not coalesce */
-    else
-    {
-      set_header(block_header, block_size, ALLOCATED);
+  tag_live_bytes[get_tag(header)] += HEADER_SIZE + next_block_size;
 
-      add_free_block(block_node);
+  nused += next_block_size;
 
-      set_header(block_header, block_size, FREE);
+  trim_block(header, (reserve < available) ? reserve : available);
 
-      nused -= block_size;
-    }
-  }
+  return true;
 }
 
-/* Function: myrealloc
+/* Function: reclaim_slack
  * -----------------
- * This function reallocates memory and moves it to a new location, freeing the old memory
- * in the meantime. I have used the implicit allocator implementation for realloc as I did
- * not have enough time to do the in-place realloc.
+ * This function hands the slack held behind grown blocks back to the heap, and is only
+ * called when the heap is under memory pressure. The heap is only walked if a block has
+ * been given slack since the last walk, which trimmed all there was, and it returns true
+ * if any slack was split off.
  */
-void *myrealloc(void *old_ptr, size_t new_size)
+bool reclaim_slack()
 {
-  void *new_ptr = mymalloc(new_size);
+  bool reclaimed = false;
 
-  /* if old_ptr is null then it is simply a mymalloc call */
-  if (old_ptr == NULL)
+  if (slack_blocks == 0)
   {
-    return new_ptr;
+    return false;
   }
 
-  /* if the pointer isn't equal to null, we want to either reallocate the memory, or free the
-   * pointer, depending on the new_size parameter
-   */
-  if (new_size != 0)
+  arena_t *zones[] = {main_arenas, churn_arenas};
+
+  for (int i = 0; i < 2; i++)
   {
-    memcpy(new_ptr, old_ptr, new_size);
+    for (arena_t *arena = zones[i]; arena != NULL; arena = arena->next)
+    {
+      header_t *curr_ptr = first_block(arena);
+
+      /* walk the arena trimming every allocated block that has slack behind it */
+      do
+      {
+        if (!is_free(curr_ptr) && (*curr_ptr & SLACK_BIT))
+        {
+          size_t used = used_size(curr_ptr);
+
+          if (trim_block(curr_ptr, used))
+          {
+            reclaimed = true;
+          }
+
+          mark_grown(curr_ptr, used);
+        }
+      } while ((curr_ptr = next_block(curr_ptr)) != NULL);
+    }
   }
 
-  myfree(old_ptr);
+  /* whatever slack is left is too small to split off */
+  slack_blocks = 0;
 
-  return new_ptr;
+  return reclaimed;
 }
 
-/* Function: validate_heap
+/* Function: zone_arenas
  * -----------------
- * This function validates the heap periodically to make sure all is OK. If everything is
- * OK we return true, otherwise we return false.
+ * This function returns the list of arenas for blocks with the given lifetime.
  */
-bool validate_heap()
+arena_t **zone_arenas(lifetime_hint_t zone)
 {
-  /* if we have used more heap than what is available then throw an error */
-  if (nused > segment_size)
-  {
-    printf("You have used more heap than whats available!\n");
+  return (zone == LIFETIME_SHORT) ? &churn_arenas : &main_arenas;
+}
 
-    breakpoint();
+/* Function: add_arena
+ * -----------------
+ * This function asks the page heap for a new arena big enough for a block of size needed,
+ * sets it up as a single free block followed by the epilogue, and links it into the arenas
+ * of the given zone in address order. It returns null if the page heap is exhausted.
+ */
+arena_t *add_arena(lifetime_hint_t zone, size_t needed)
+{
+  size_t overhead = sizeof(arena_t) + (2 * HEADER_SIZE);
+  size_t min_pages = roundup(overhead + needed, PAGE_SIZE) / PAGE_SIZE;
+  size_t npages = (min_pages > ARENA_PAGES) ? min_pages : ARENA_PAGES;
 
-    return false;
+  arena_t *arena = span_alloc(npages);
+
+  /* settle for the smallest arena that fits if the page heap is running low */
+  if (arena == NULL && npages > min_pages)
+  {
+    npages = min_pages;
+    arena = span_alloc(npages);
   }
 
-  size_t num_bytes = 0;
-  size_t num_bytes_used = 0;
+  if (arena == NULL)
+  {
+    return NULL;
+  }
 
-  header_t *curr_ptr = (header_t *)segment_start;
+  arena->size = npages * PAGE_SIZE;
+  arena->zone = zone;
 
-  /* loop over each block and count the number of bytes used and the number of bytes total */
-  do
-  {
-    size_t block_size = get_size(curr_ptr);
+  /* set up the free block and the epilogue header after it */
+  header_t *block_header = first_block(arena);
+  size_t block_size = arena->size - overhead;
 
-    if (!is_free(curr_ptr))
-    {
-      num_bytes_used += block_size;
-    }
+  set_header(block_header, block_size, FREE);
+  set_header((header_t *)((char *)header2payload(block_header) + block_size), 0, ALLOCATED);
 
-    /* update tracking variables */
-    num_bytes += HEADER_SIZE + block_size;
-    num_bytes_used += HEADER_SIZE;
-  } while ((curr_ptr = next_block(curr_ptr)) != NULL);
+  count_free(block_size, 1);
 
-  /* return false if the number of bytes used and nused don't match */
-  if (num_bytes_used != nused)
-  {
-    printf("Your program uses %ld bytes, but nused says %ld bytes are accounted for!\n", num_bytes_used, nused);
+  node_t *free_node = header2payload(block_header);
 
-    breakpoint();
+  free_node->prev = NULL;
+  free_node->next = NULL;
 
-    return false;
-  }
+  nused += HEADER_SIZE;
 
-  /* return false if the number of bytes total and segment size don't match */
-  if (num_bytes != segment_size)
-  {
-    printf("Your program uses %ld bytes on the heap, but the heap segment size is %ld!\n", num_bytes, segment_size);
+  narenas++;
 
-    breakpoint();
+  /* link the arena into its zone in address order */
+  arena_t **link = zone_arenas(zone);
+
+  while (*link != NULL && *link < arena)
+  {
+    link = &(*link)->next;
+  }
+
+  arena->next = *link;
+  *link = arena;
+
+  HEAP_PROBE2(heap__grow, arena, arena->size);
+
+  return arena;
+}
+
+/* Function: release_arena
+ * -----------------
+ * This function hands an arena back to the page heap if it holds nothing but a single
+ * free block, unless it is the only arena left in its zone.
+ */
+void release_arena(arena_t *arena)
+{
+  header_t *block_header = first_block(arena);
+
+  if (!is_free(block_header) || next_block(block_header) != NULL)
+  {
+    return;
+  }
+
+  arena_t **link = zone_arenas(arena->zone);
+
+  if (*link == arena && arena->next == NULL)
+  {
+    return;
+  }
+
+  while (*link != arena)
+  {
+    link = &(*link)->next;
+  }
+
+  *link = arena->next;
+
+  nused -= HEADER_SIZE;
+
+  count_free(get_size(block_header), -1);
+
+  narenas--;
+
+  /* the arena is no longer there to be checked */
+  for (int i = 0; i < TOUCHED_ARENAS; i++)
+  {
+    if (touched_arenas[i] == arena)
+    {
+      touched_arenas[i] = NULL;
+    }
+  }
+
+  if (window_arena == arena)
+  {
+    window_arena = arena->next;
+  }
+
+  span_free(arena);
+}
+
+/* Function: myinit
+ * -----------------
+ * This function returns true if initialization was successful, or false otherwise.
+ * The myinit function can be called to reset the heap to an empty state. When running
+ * against a set of of test scripts, our test harness calls myinit before starting each
+ * new script.
+ */
+bool myinit(void *heap_start, size_t heap_size)
+{
+  segment_start = heap_start;
+  segment_size = heap_size;
+  segment_end = (char *)segment_start + segment_size;
+
+  /* if we can't store a header and a node on our heap then it is not big enough */
+  if (heap_size < MIN_BLOCK_SIZE)
+  {
+    return false;
+  }
+
+  main_arenas = NULL;
+  churn_arenas = NULL;
+
+  nused = 0;
+
+  free_bytes = 0;
+  free_blocks = 0;
+
+  memset(free_blocks_by_class, 0, sizeof(free_blocks_by_class));
+  memset(free_blocks_by_size, 0, sizeof(free_blocks_by_size));
+  largest_free_bytes = 0;
+
+  narenas = 0;
+  mallocs = 0;
+  frees = 0;
+  reallocs = 0;
+  slack_blocks = 0;
+
+  memset(tag_live_bytes, 0, sizeof(tag_live_bytes));
+  memset(tag_live_blocks, 0, sizeof(tag_live_blocks));
+
+  memset(touched_arenas, 0, sizeof(touched_arenas));
+  window_arena = NULL;
+
+  /* arenas are only carved out of the page heap once blocks are requested */
+  if (!span_init(segment_start, segment_size))
+  {
+    return false;
+  }
+
+  /* the permanent zone is empty until the first permanent block is requested */
+  pages_end = span_zone_end();
+  permanent_top = pages_end;
+  permanent_end = pages_end;
+
+  return true;
+}
+
+/* Function: fit_arena
+ * -----------------
+ * This function walks the linked list of free blocks in an arena for the first block that
+ * can hold needed bytes, allocates it (splitting off the rest if it can hold a header and a
+ * node) and returns its payload. It returns null if no free block in the arena is big enough.
+ */
+void *fit_arena(size_t needed, arena_t *arena)
+{
+  header_t *free_block_header = find_free_block(first_block(arena));
+
+  /* if there are no free blocks at all then nothing fits */
+  if (free_block_header == NULL)
+  {
+    HEAP_PROBE3(fit__search, needed, 0, NULL);
+
+    return NULL;
+  }
+
+  size_t steps = 0;
+
+  node_t *free_block_node = header2payload(free_block_header);
+
+  /* traverse through all the free blocks in the arena */
+  while (free_block_node != NULL)
+  {
+    free_block_header = payload2header(free_block_node);
+
+    steps++;
+
+    size_t free_block_size = get_size(free_block_header);
+
+    /* if we have a perfect fit, we don't need to create a header and a node */
+    if (needed == free_block_size)
+    {
+      detach_free_block(free_block_node);
+
+      set_header(free_block_header, needed, ALLOCATED);
+
+      nused += needed;
+
+      HEAP_PROBE3(fit__search, needed, steps, free_block_node);
+
+      return free_block_node;
+    }
+    /* if we have a fit with enough room for a header and a node then we need to create a new header and node */
+    else if ((needed + MIN_BLOCK_SIZE) <= free_block_size)
+    {
+      detach_free_block(free_block_node);
+
+      void *new_free_block_node = split_block(free_block_header, needed, free_block_size);
+
+      header_t *new_free_block_header = payload2header(new_free_block_node);
+
+      add_free_block(new_free_block_node);
+
+      set_header(new_free_block_header, get_size(new_free_block_header), FREE);
+
+      HEAP_PROBE3(fit__search, needed, steps, free_block_node);
+
+      return free_block_node;
+    }
+
+    /* otherwise we need to go to the next free block */
+    free_block_node = free_block_node->next;
+  }
+
+  HEAP_PROBE3(fit__search, needed, steps, NULL);
+
+  return NULL;
+}
+
+/* Function: fit_zone
+ * -----------------
+ * This function tries each arena of a zone in address order for a block of size needed,
+ * and returns its payload, or null if none of them have room.
+ */
+void *fit_zone(size_t needed, lifetime_hint_t zone)
+{
+  for (arena_t *arena = *zone_arenas(zone); arena != NULL; arena = arena->next)
+  {
+    void *payload_ptr = fit_arena(needed, arena);
+
+    if (payload_ptr != NULL)
+    {
+      return payload_ptr;
+    }
+  }
+
+  return NULL;
+}
+
+/* Function: find_fit
+ * -----------------
+ * This function allocates a block of size needed in the zone matching the hint (the churn
+ * zone for short-lived blocks, the main zone otherwise), adding a new arena to the zone if
+ * none of its arenas have room. If the page heap is exhausted it falls back to the arenas
+ * of the other zone. It returns the payload of the block, or null if there is no room.
+ */
+void *find_fit(size_t needed, lifetime_hint_t hint)
+{
+  lifetime_hint_t zone = (hint == LIFETIME_SHORT) ? LIFETIME_SHORT : LIFETIME_LONG;
+  lifetime_hint_t other_zone = (hint == LIFETIME_SHORT) ? LIFETIME_LONG : LIFETIME_SHORT;
+
+  void *payload_ptr = fit_zone(needed, zone);
+
+  if (payload_ptr != NULL)
+  {
+    return payload_ptr;
+  }
+
+  arena_t *arena = add_arena(zone, needed);
+
+  if (arena != NULL)
+  {
+    return fit_arena(needed, arena);
+  }
+
+  return fit_zone(needed, other_zone);
+}
+
+/* Function: reserve_permanent
+ * -----------------
+ * This function makes sure there are at least size bytes between the end of the page zone
+ * and permanent_top, taking pages off the end of the page zone if need be, and returns
+ * false if the page zone can't spare them. Pages are taken PERMANENT_PAGES at a time
+ * where possible, so that a run of small permanent blocks doesn't go back to the page
+ * heap for each one.
+ */
+bool reserve_permanent(size_t size)
+{
+  size_t room = (char *)permanent_top - (char *)pages_end;
+
+  if (size <= room)
+  {
+    return true;
+  }
+
+  size_t npages = roundup(size - room, PAGE_SIZE) / PAGE_SIZE;
+
+  if (npages < PERMANENT_PAGES && span_shrink_zone(PERMANENT_PAGES))
+  {
+    npages = PERMANENT_PAGES;
+  }
+  else if (!span_shrink_zone(npages))
+  {
+    return false;
+  }
+
+  pages_end = (char *)pages_end - npages * PAGE_SIZE;
+
+  return true;
+}
+
+/* Function: permanent_alloc
+ * -----------------
+ * This function bumps a block of size needed down from the top of the permanent zone, and
+ * returns its payload, or null if the page zone can't give the permanent zone the room.
+ * Permanent blocks keep a header so that myrealloc knows their size, but are never freed.
+ */
+void *permanent_alloc(size_t needed)
+{
+  if (!reserve_permanent(HEADER_SIZE + needed))
+  {
+    return NULL;
+  }
+
+  permanent_top = (char *)permanent_top - (HEADER_SIZE + needed);
+
+  set_header(permanent_top, needed, ALLOCATED);
+
+  return header2payload(permanent_top);
+}
+
+/* Function: is_permanent
+ * -----------------
+ * This function returns whether or not a payload lives in the permanent zone.
+ */
+bool is_permanent(void *payload)
+{
+  return payload >= pages_end && payload < permanent_end;
+}
+
+/* Function: is_large
+ * -----------------
+ * This function returns whether or not a payload is a large block, which is a span of its
+ * own and has no header.
+ */
+bool is_large(void *payload)
+{
+  return !is_permanent(payload) && payload == span_start(payload);
+}
+
+/* Function: block_tag
+ * -----------------
+ * This function returns the allocation tag of an allocated block. The page heap keeps the
+ * tag of a large block.
+ */
+unsigned block_tag(void *payload)
+{
+  return is_large(payload) ? span_alloc_tag(payload) : get_tag(payload2header(payload));
+}
+
+/* Function: count_tagged
+ * -----------------
+ * This function records in the totals for a block's tag that the allocated block has
+ * appeared (a delta of 1) or gone (a delta of -1).
+ */
+void count_tagged(void *payload, long delta)
+{
+  size_t bytes = is_large(payload) ? span_pages(payload) * PAGE_SIZE : HEADER_SIZE + get_size(payload2header(payload));
+  unsigned tag = block_tag(payload);
+
+  tag_live_bytes[tag] += delta * bytes;
+  tag_live_blocks[tag] += delta;
+}
+
+/* Function: touch_block
+ * -----------------
+ * This function records that a call has touched the arena a block lies in, so that the next
+ * incremental check of the heap walks it. Permanent and large blocks lie outside of
+ * any arena.
+ */
+void touch_block(void *payload)
+{
+  if (payload == NULL || is_permanent(payload) || payload == span_start(payload))
+  {
+    return;
+  }
+
+  arena_t *arena = arena_of(payload2header(payload));
+
+  if (touched_arenas[0] != arena)
+  {
+    memmove(&touched_arenas[1], &touched_arenas[0], (TOUCHED_ARENAS - 1) * sizeof(arena_t *));
+
+    touched_arenas[0] = arena;
+  }
+}
+
+/* Function: count_malloc
+ * -----------------
+ * This function records in the heap statistics that a block has been handed out for a
+ * request of the given size, unless the payload is null, tags it with this thread's
+ * current tag, marks its arena as touched and
+ * passes it on to the heap profiler and the allocation trace. It returns the payload.
+ */
+void *count_malloc(void *payload, size_t requested_size)
+{
+  if (payload != NULL)
+  {
+    mallocs++;
+
+    if (is_large(payload))
+    {
+      span_set_alloc_tag(payload, current_tag);
+    }
+    else
+    {
+      set_tag(payload2header(payload), current_tag);
+    }
+
+    count_tagged(payload, 1);
+
+    touch_block(payload);
+
+    heap_profile_malloc(payload, requested_size);
+
+    trace_malloc(payload, requested_size);
+  }
+
+  return payload;
+}
+
+/* Function: mymalloc
+ * -----------------
+ * This function allocates the first free block on the linked list that fits the
+ * requested size for a block with the default lifetime, and returns null if the heap
+ * is exhausted.
+ */
+void *mymalloc(size_t requested_size)
+{
+  return mymalloc_hint(requested_size, LIFETIME_LONG);
+}
+
+/* Function: allocate_block
+ * -----------------
+ * This function allocates a block of at least the requested size in the zone matching its
+ * lifetime. Permanent blocks are bumped down from the top of the segment, short-lived blocks
+ * go in the churn zone's arenas so they don't leave holes between long-lived blocks, and
+ * any block falls back to the other zones when its own is full. Blocks of LARGE_BLOCK_SIZE
+ * and up are given whole pages by the page heap instead, and smaller blocks are rounded up
+ * to their size class.
+ */
+void *allocate_block(size_t requested_size, lifetime_hint_t hint)
+{
+  /* handle the case where malloc is passed a value of 0 */
+  if (requested_size == 0)
+  {
+    return NULL;
+  }
+
+  /* if requested_size is greater than max request size we return null */
+  if (requested_size > MAX_REQUEST_SIZE)
+  {
+    return NULL;
+  }
+
+  size_t needed = roundup(requested_size, ALIGNMENT);
+
+  /* we need to ensure that for each malloc we can store both the previous and next pointers */
+  if (needed < (2 * NODE_POINTER_SIZE))
+  {
+    needed = 2 * NODE_POINTER_SIZE;
+  }
+
+  void *payload_ptr = NULL;
+
+  if (hint == LIFETIME_PERMANENT && (payload_ptr = permanent_alloc(needed)) != NULL)
+  {
+    return count_malloc(payload_ptr, requested_size);
+  }
+
+  /* large blocks are given a run of whole pages by the page heap */
+  if (needed >= LARGE_BLOCK_SIZE)
+  {
+    return count_malloc(span_alloc(roundup(needed, PAGE_SIZE) / PAGE_SIZE), requested_size);
+  }
+
+  needed = class_size(needed);
+
+  payload_ptr = find_fit(needed, hint);
+
+  /* under memory pressure, give back the slack held by growing blocks and try again */
+  if (payload_ptr == NULL && reclaim_slack())
+  {
+    payload_ptr = find_fit(needed, hint);
+  }
+
+  return count_malloc(payload_ptr, requested_size);
+}
+
+/* Function: mymalloc_hint
+ * -----------------
+ * This function allocates a block with allocate_block, between the probes that mark the
+ * entry and return of each malloc.
+ */
+void *mymalloc_hint(size_t requested_size, lifetime_hint_t hint)
+{
+  HEAP_PROBE2(malloc__entry, requested_size, hint);
+
+  void *payload_ptr = allocate_block(requested_size, hint);
+
+  HEAP_PROBE2(malloc__return, payload_ptr, requested_size);
+
+  return payload_ptr;
+}
+
+/* Function: mymalloc_tagged
+ * -----------------
+ * This function allocates a block for the requested size with the default lifetime under
+ * the given tag, and returns null if the tag is out of range.
+ */
+void *mymalloc_tagged(size_t requested_size, unsigned tag)
+{
+  if (tag >= HEAP_MAX_TAGS)
+  {
+    return NULL;
+  }
+
+  unsigned old_tag = current_tag;
+
+  current_tag = tag;
+
+  void *payload_ptr = mymalloc(requested_size);
+
+  current_tag = old_tag;
+
+  return payload_ptr;
+}
+
+/* Function: myset_tag
+ * -----------------
+ * This function sets the tag this thread allocates blocks under, unless it is out of
+ * range, and returns the tag it had before.
+ */
+unsigned myset_tag(unsigned tag)
+{
+  unsigned old_tag = current_tag;
+
+  if (tag < HEAP_MAX_TAGS)
+  {
+    current_tag = tag;
+  }
+
+  return old_tag;
+}
+
+/* Function: release_block
+ * -----------------
+ * This function frees a block on the heap and updates the header accordingly. If the
+ * block has already been freed it does nothing. It also handles the coalescing of two
+ * free blocks on the heap, and hands an arena that has emptied back to the page heap.
+ */
+void release_block(void *ptr)
+{
+  /* if we try to free a null pointer, then do nothing */
+  if (ptr == NULL)
+  {
+    return;
+  }
+
+  trace_free(ptr);
+
+  /* permanent blocks are never freed */
+  if (is_permanent(ptr))
+  {
+    return;
+  }
+
+  /* large blocks are a span of their own, and go back to the page heap */
+  if (ptr == span_start(ptr))
+  {
+    count_tagged(ptr, -1);
+
+    span_free(ptr);
+
+    frees++;
+
+    heap_profile_free(ptr);
+
+    return;
+  }
+
+  header_t *block_header = payload2header(ptr);
+  node_t *block_node = ptr;
+
+  /* do nothing if pointer is already free */
+  if (!is_free(block_header))
+  {
+    frees++;
+
+    touch_block(ptr);
+
+    heap_profile_free(ptr);
+
+    count_tagged(ptr, -1);
+
+    header_t *next_block_header = next_block(block_header);
+    node_t *next_block_node = (node_t *)header2payload(next_block_header);
+
+    size_t block_size = get_size(block_header);
+
+    /* this handles the case where we coalesce (only within the same zone) */
+    if (can_coalesce(next_block_header))
+    {
+      size_t coalesce_block_size = (block_size + HEADER_SIZE + get_size(next_block_header));
+
+      detach_free_block(next_block_node);
+
+      block_node->prev = next_block_node->next;
+      block_node->next = next_block_node->prev;
+
+      set_header(block_header, coalesce_block_size, ALLOCATED);
+
+      add_free_block(block_node);
+
+      set_header(block_header, coalesce_block_size, FREE);
+
+      nused -= (HEADER_SIZE + block_size);
+
+      HEAP_PROBE2(block__coalesce, ptr, coalesce_block_size);
+    }
+    /* this handles the case where we do not coalesce */
+    else
+    {
+      set_header(block_header, block_size, ALLOCATED);
+
+      add_free_block(block_node);
+
+      set_header(block_header, block_size, FREE);
+
+      nused -= block_size;
+    }
+
+    release_arena(arena_of(block_header));
+  }
+}
+
+/* Function: myfree
+ * -----------------
+ * This function frees a block with release_block, between the probes that mark the entry
+ * and return of each free.
+ */
+void myfree(void *ptr)
+{
+  HEAP_PROBE1(free__entry, ptr);
+
+  release_block(ptr);
+
+  HEAP_PROBE1(free__return, ptr);
+}
+
+/* Function: resize_block
+ * -----------------
+ * This function resizes a block, in place where possible. Shrinking keeps the block where
+ * it is, and growing first tries to absorb the free block after it. A block that is grown
+ * more than once is given geometric slack behind it, so that a block grown by small steps
+ * is only moved and copied a logarithmic number of times.
+ */
+void *resize_block(void *old_ptr, size_t new_size)
+{
+  reallocs++;
+
+  touch_block(old_ptr);
+
+  /* if old_ptr is null then it is simply a mymalloc call */
+  if (old_ptr == NULL)
+  {
+    return mymalloc(new_size);
+  }
+
+  /* a new_size of 0 is simply a myfree call */
+  if (new_size == 0)
+  {
+    myfree(old_ptr);
+
+    return NULL;
+  }
+
+  if (new_size > MAX_REQUEST_SIZE)
+  {
+    return NULL;
+  }
+
+  /* blocks from the page heap are resized by whole pages, and leave it once they are
+   * smaller than LARGE_BLOCK_SIZE
+   */
+  if (!is_permanent(old_ptr) && old_ptr == span_start(old_ptr))
+  {
+    size_t old_bytes = span_pages(old_ptr) * PAGE_SIZE;
+
+    if (new_size >= LARGE_BLOCK_SIZE && span_resize(old_ptr, roundup(new_size, PAGE_SIZE) / PAGE_SIZE))
+    {
+      tag_live_bytes[span_alloc_tag(old_ptr)] += span_pages(old_ptr) * PAGE_SIZE - old_bytes;
+
+      heap_profile_resize(old_ptr, new_size);
+
+      return old_ptr;
+    }
+
+    void *new_ptr = mymalloc(new_size);
+
+    if (new_ptr == NULL)
+    {
+      return NULL;
+    }
+
+    memcpy(new_ptr, old_ptr, (old_bytes < new_size) ? old_bytes : new_size);
+
+    count_tagged(old_ptr, -1);
+
+    span_free(old_ptr);
+
+    frees++;
+
+    heap_profile_free(old_ptr);
+
+    return new_ptr;
+  }
+
+  header_t *header_ptr = payload2header(old_ptr);
+
+  size_t needed = roundup(new_size, ALIGNMENT);
+  size_t block_size = get_size(header_ptr);
+
+  /* we need to ensure that the block can still store both the previous and next pointers */
+  if (needed < (2 * NODE_POINTER_SIZE))
+  {
+    needed = 2 * NODE_POINTER_SIZE;
+  }
+
+  /* permanent blocks can't be freed. The block at permanent_top grows by moving down into
+   * the permanent zone, but any other permanent block is copied and leaves the old block
+   * behind for good
+   */
+  if (is_permanent(old_ptr))
+  {
+    if (needed <= block_size)
+    {
+      heap_profile_resize(old_ptr, new_size);
+
+      return old_ptr;
+    }
+
+    if ((void *)header_ptr == permanent_top && reserve_permanent(needed - block_size))
+    {
+      unsigned tag = get_tag(header_ptr);
+      header_t *new_header = (header_t *)((char *)permanent_top - (needed - block_size));
+
+      memmove(header2payload(new_header), old_ptr, block_size);
+
+      set_header(new_header, needed, ALLOCATED);
+      set_tag(new_header, tag);
+
+      permanent_top = new_header;
+      tag_live_bytes[tag] += needed - block_size;
+
+      heap_profile_free(old_ptr);
+      heap_profile_malloc(header2payload(new_header), new_size);
+
+      return header2payload(new_header);
+    }
+
+    void *new_ptr = mymalloc_hint(new_size, LIFETIME_PERMANENT);
+
+    if (new_ptr != NULL)
+    {
+      memcpy(new_ptr, old_ptr, block_size);
+    }
+
+    return new_ptr;
+  }
+
+  /* shrinking, or growing into slack reserved by an earlier call, doesn't move the block */
+  if (needed <= block_size)
+  {
+    if (is_grown(header_ptr))
+    {
+      mark_grown(header_ptr, needed);
+    }
+    else
+    {
+      trim_block(header_ptr, needed);
+    }
+
+    heap_profile_resize(old_ptr, new_size);
+
+    return old_ptr;
+  }
+
+  /* a block that keeps growing reserves half as much again as it needs */
+  size_t reserve = needed;
+
+  if (is_grown(header_ptr) && needed + (needed / 2) <= MAX_REQUEST_SIZE)
+  {
+    reserve = roundup(needed + (needed / 2), ALIGNMENT);
+  }
+
+  /* slack alone shouldn't push a small block onto the page heap */
+  if (needed < LARGE_BLOCK_SIZE && reserve >= LARGE_BLOCK_SIZE)
+  {
+    reserve = LARGE_BLOCK_SIZE - ALIGNMENT;
+  }
+
+  if (grow_in_place(header_ptr, needed, reserve))
+  {
+    mark_grown(header_ptr, needed);
+
+    heap_profile_resize(old_ptr, new_size);
+
+    return old_ptr;
+  }
+
+  /* keep the block in the zone it was allocated in */
+  lifetime_hint_t hint = arena_of(header_ptr)->zone;
+
+  void *new_ptr = mymalloc_hint(reserve, hint);
+
+  if (new_ptr == NULL && reserve > needed)
+  {
+    new_ptr = mymalloc_hint(needed, hint);
+  }
+
+  if (new_ptr == NULL)
+  {
+    return NULL;
+  }
+
+  /* only the bytes in use need to be copied (mymalloc may have reclaimed any slack) */
+  memcpy(new_ptr, old_ptr, used_size(header_ptr));
+
+  myfree(old_ptr);
+
+  /* a block that has moved to the page heap has no header to mark */
+  if (new_ptr != span_start(new_ptr))
+  {
+    mark_grown(payload2header(new_ptr), needed);
+  }
+
+  return new_ptr;
+}
+
+/* Function: myrealloc
+ * -----------------
+ * This function resizes a block with resize_block, between the probes that mark the entry
+ * and return of each realloc, and records the call in the allocation trace as a single
+ * resize, hiding the blocks that resize_block allocates and frees on the way. A block
+ * that moves is allocated under the tag it had.
+ */
+void *myrealloc(void *old_ptr, size_t new_size)
+{
+  HEAP_PROBE2(realloc__entry, old_ptr, new_size);
+
+  trace_suspend();
+
+  unsigned tag = current_tag;
+
+  if (old_ptr != NULL)
+  {
+    current_tag = block_tag(old_ptr);
+  }
+
+  void *new_ptr = resize_block(old_ptr, new_size);
+
+  current_tag = tag;
+
+  trace_resume();
+
+  trace_realloc(old_ptr, new_ptr, new_size);
+
+  HEAP_PROBE3(realloc__return, new_ptr, old_ptr, new_size);
+
+  return new_ptr;
+}
+
+/* Function: myheap_stats
+ * -----------------
+ * This function fills in a summary of the heap from the totals kept as blocks come and go.
+ * The committed bytes are the pages held by arenas and large blocks, and the part of
+ * the permanent zone in use. Whatever of them isn't a free block or an arena's own header
+ * and epilogue is live.
+ */
+void myheap_stats(heap_stats_t *stats)
+{
+  stats->committed_bytes = span_pages_in_use() * PAGE_SIZE + ((char *)permanent_end - (char *)permanent_top);
+  stats->live_bytes = stats->committed_bytes - free_bytes - narenas * (sizeof(arena_t) + HEADER_SIZE);
+  stats->live_blocks = mallocs - frees;
+  stats->free_bytes = free_bytes;
+  stats->free_blocks = free_blocks;
+  stats->largest_free_bytes = largest_free_bytes;
+
+  memcpy(stats->free_blocks_by_class, free_blocks_by_class, sizeof(free_blocks_by_class));
+
+  stats->mallocs = mallocs;
+  stats->frees = frees;
+  stats->reallocs = reallocs;
+}
+
+/* Function: myheap_tag_stats
+ * -----------------
+ * This function fills in the blocks and bytes live under a tag from the totals kept as
+ * blocks come and go, and resize in place.
+ */
+void myheap_tag_stats(unsigned tag, heap_tag_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+
+  if (tag < HEAP_MAX_TAGS)
+  {
+    stats->live_bytes = tag_live_bytes[tag];
+    stats->live_blocks = tag_live_blocks[tag];
+  }
+}
+
+/* Function: validate_arena
+ * -----------------
+ * This function walks the blocks of an arena, checking that they tile it up to its epilogue
+ * and that grown blocks hold the bytes they record as in use, and adds the bytes in use and
+ * the free blocks it finds to the given totals. It returns true if all is well.
+ */
+bool validate_arena(arena_t *arena, size_t *num_bytes_used, size_t *num_free_bytes, size_t *num_free_blocks)
+{
+  size_t num_bytes = 0;
+
+  header_t *curr_ptr = first_block(arena);
+
+  /* loop over each block and count the number of bytes used and the number of bytes total */
+  do
+  {
+    size_t block_size = get_size(curr_ptr);
+
+    if (!is_free(curr_ptr))
+    {
+      *num_bytes_used += block_size;
+    }
+    else
+    {
+      *num_free_bytes += HEADER_SIZE + block_size;
+      (*num_free_blocks)++;
+    }
+
+    /* the bytes in use by a grown block can never be more than the block holds */
+    if (!is_free(curr_ptr) && used_size(curr_ptr) > block_size)
+    {
+      printf("Block at %p records %ld bytes in use, but only holds %ld bytes!\n", curr_ptr, used_size(curr_ptr), block_size);
+
+      breakpoint();
+
+      return false;
+    }
+
+    /* update tracking variables */
+    num_bytes += HEADER_SIZE + block_size;
+    *num_bytes_used += HEADER_SIZE;
+  } while ((curr_ptr = next_block(curr_ptr)) != NULL);
+
+  /* return false if the blocks don't tile the arena up to its epilogue */
+  size_t blocks_size = arena->size - sizeof(arena_t) - HEADER_SIZE;
+
+  if (num_bytes != blocks_size)
+  {
+    printf("Arena %p holds %ld bytes of blocks, but the blocks should cover %ld bytes!\n", arena, num_bytes, blocks_size);
+
+    breakpoint();
+
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: validate_totals
+ * -----------------
+ * This function checks the totals the allocator keeps against each other and against the
+ * bounds of the segment, which takes constant time. It returns true if they agree.
+ */
+bool validate_totals()
+{
+  /* if we have used more heap than what is available then throw an error */
+  if (nused > segment_size)
+  {
+    printf("You have used more heap than whats available!\n");
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the permanent zone has grown past its bounds */
+  if (permanent_top < pages_end || permanent_top > permanent_end)
+  {
+    printf("The permanent zone top %p is outside of %p and %p!\n", permanent_top, pages_end, permanent_end);
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t committed = span_pages_in_use() * PAGE_SIZE + ((char *)permanent_end - (char *)permanent_top);
+  size_t overhead = narenas * (sizeof(arena_t) + HEADER_SIZE);
+
+  /* return false if the free blocks and arena overhead come to more than is committed */
+  if (committed > segment_size || free_bytes + overhead > committed)
+  {
+    printf("The heap has %ld bytes of free blocks and %ld bytes of arena overhead, but %ld bytes committed!\n", free_bytes, overhead, committed);
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t num_class_blocks = 0;
+
+  for (int class = 0; class < HEAP_STATS_CLASSES; class++)
+  {
+    num_class_blocks += free_blocks_by_class[class];
+  }
+
+  /* return false if the largest free block isn't a size that a free block has */
+  if ((largest_free_bytes == 0) != (free_blocks == 0) || largest_free_bytes >= MAX_ARENA_SIZE ||
+      (largest_free_bytes > 0 && free_blocks_by_size[largest_free_bytes / ALIGNMENT] == 0))
+  {
+    printf("The largest free block is said to be %ld bytes, which no free block is!\n", largest_free_bytes);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the size classes don't add up to the free blocks */
+  if (num_class_blocks != free_blocks)
+  {
+    printf("The size classes hold %ld free blocks, but the statistics say %ld!\n", num_class_blocks, free_blocks);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if more blocks have been freed than were ever handed out */
+  if (frees > mallocs)
+  {
+    printf("The heap has freed %ld blocks, but only handed out %ld!\n", frees, mallocs);
+
+    breakpoint();
+
+    return false;
+  }
+
+  size_t tagged_bytes = 0;
+  size_t tagged_blocks = 0;
+
+  for (int tag = 0; tag < HEAP_MAX_TAGS; tag++)
+  {
+    tagged_bytes += tag_live_bytes[tag];
+    tagged_blocks += tag_live_blocks[tag];
+  }
+
+  /* return false if the totals by tag don't add up to the blocks that are live */
+  if (tagged_blocks != mallocs - frees || tagged_bytes != committed - free_bytes - overhead)
+  {
+    printf("The tags hold %ld blocks of %ld bytes, but %ld blocks of %ld bytes are live!\n", tagged_blocks, tagged_bytes, mallocs - frees, committed - free_bytes - overhead);
+
+    breakpoint();
+
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: next_window_arena
+ * -----------------
+ * This function returns the arena that the window of incremental checks moves on to after
+ * the given one, going through the arenas of the main zone and then the churn zone. It
+ * returns null if there are no arenas.
+ */
+arena_t *next_window_arena(arena_t *arena)
+{
+  if (arena != NULL && arena->next != NULL)
+  {
+    return arena->next;
+  }
+
+  arena_t *first = main_arenas;
+  arena_t *second = churn_arenas;
+
+  if (arena != NULL && arena->zone != LIFETIME_SHORT)
+  {
+    first = churn_arenas;
+    second = main_arenas;
+  }
+
+  return (first != NULL) ? first : second;
+}
+
+/* Function: validate_heap_level
+ * -----------------
+ * This function validates the heap as thoroughly as the level asks. The cheap level only
+ * checks the totals, and the incremental level also walks the arenas touched since the
+ * last incremental check and the next arena of a window that rolls over the whole heap,
+ * so its cost is bounded by the size of an arena rather than of the heap.
+ */
+bool validate_heap_level(validate_level_t level)
+{
+  if (level == VALIDATE_FULL)
+  {
+    return validate_heap();
+  }
+
+  if (!validate_totals())
+  {
+    return false;
+  }
+
+  if (level == VALIDATE_CHEAP)
+  {
+    return true;
+  }
+
+  size_t num_bytes_used = 0;
+  size_t num_free_bytes = 0;
+  size_t num_free_blocks = 0;
+
+  for (int i = 0; i < TOUCHED_ARENAS; i++)
+  {
+    if (touched_arenas[i] != NULL && !validate_arena(touched_arenas[i], &num_bytes_used, &num_free_bytes, &num_free_blocks))
+    {
+      return false;
+    }
+  }
+
+  memset(touched_arenas, 0, sizeof(touched_arenas));
+
+  arena_t *window = (window_arena != NULL) ? window_arena : next_window_arena(NULL);
+
+  if (window != NULL)
+  {
+    if (!validate_arena(window, &num_bytes_used, &num_free_bytes, &num_free_blocks))
+    {
+      return false;
+    }
+
+    window_arena = next_window_arena(window);
+  }
+
+  return true;
+}
+
+/* Function: validate_heap
+ * -----------------
+ * This function validates the heap periodically to make sure all is OK. If everything is
+ * OK we return true, otherwise we return false.
+ */
+bool validate_heap()
+{
+  if (!validate_totals())
+  {
+    return false;
+  }
+
+  size_t num_bytes_used = 0;
+  size_t num_free_bytes = 0;
+  size_t num_free_blocks = 0;
+  size_t num_arenas = 0;
+
+  arena_t *zones[] = {main_arenas, churn_arenas};
+
+  for (int i = 0; i < 2; i++)
+  {
+    for (arena_t *arena = zones[i]; arena != NULL; arena = arena->next)
+    {
+      /* return false if the arenas of a zone are out of address order */
+      if (arena->next != NULL && arena->next <= arena)
+      {
+        printf("Arena %p comes before arena %p in its zone!\n", arena, arena->next);
+
+        breakpoint();
+
+        return false;
+      }
+
+      num_arenas++;
+
+      if (!validate_arena(arena, &num_bytes_used, &num_free_bytes, &num_free_blocks))
+      {
+        return false;
+      }
+    }
+  }
+
+  /* return false if the number of bytes used and nused don't match */
+  if (num_bytes_used != nused)
+  {
+    printf("Your program uses %ld bytes, but nused says %ld bytes are accounted for!\n", num_bytes_used, nused);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the totals kept for myheap_stats have drifted from the free blocks */
+  if (num_free_blocks != free_blocks || num_free_bytes != free_bytes)
+  {
+    printf("The heap has %ld free blocks of %ld bytes, but the statistics say %ld blocks of %ld bytes!\n", num_free_blocks, num_free_bytes, free_blocks, free_bytes);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the arena count kept for myheap_stats has drifted from the arenas */
+  if (num_arenas != narenas)
+  {
+    printf("The heap has %ld arenas, but the statistics say %ld!\n", num_arenas, narenas);
+
+    breakpoint();
+
+    return false;
+  }
+
+  /* return false if the page heap's spans or free lists are inconsistent */
+  if (!span_validate())
+  {
+    breakpoint();
 
     return false;
   }
@@ -554,39 +1971,131 @@ void dump_heap()
   printf("Segment start: %p\n", segment_start);
   printf("Segment end: %p\n", segment_end);
   printf("Segment size: %ld bytes\n", segment_size);
-  printf("Nused: %ld bytes\n", nused);
-  printf("Num blocks: %ld\n", count_blocks(segment_start));
-  printf("Num free blocks: %ld\n\n", count_free_blocks(segment_start));
+  printf("Page zone: [%p, %p)\n", segment_start, pages_end);
+  printf("Permanent zone: [%p, %p)\n", permanent_top, permanent_end);
+  printf("Nused: %ld bytes\n\n", nused);
+
+  arena_t *zones[] = {main_arenas, churn_arenas};
+
+  for (int i = 0; i < 2; i++)
+  {
+    for (arena_t *arena = zones[i]; arena != NULL; arena = arena->next)
+    {
+      printf("Arena: %p (%ld bytes, %s zone)\n", arena, arena->size, (i == 0) ? "main" : "churn");
+      printf("Num blocks: %ld\n", count_blocks(first_block(arena)));
+      printf("Num free blocks: %ld\n\n", count_free_blocks(first_block(arena)));
 
-  header_t *curr_ptr = (header_t *)segment_start;
+      header_t *curr_ptr = first_block(arena);
 
-  printf("%21s %12s %5s\n", "POINTER", "SIZE", "FREE");
-  printf("----------------------------------------\n");
+      printf("%21s %12s %5s\n", "POINTER", "SIZE", "FREE");
+      printf("----------------------------------------\n");
 
-  /* loop over each header and payload and print them in a table-like format */
-  do
+      /* loop over each header and payload and print them in a table-like format */
+      do
+      {
+        int space = 10;
+        int free = is_free(curr_ptr);
+        void *payload = header2payload(curr_ptr);
+        size_t size = get_size(curr_ptr);
+
+        printf("Header:  [%p   %*d   %2d]\n", curr_ptr, space, HEADER_SIZE, free);
+        printf("Payload: [%p   %10ld   %2d]\n", payload, size, free);
+
+        /* if we have a free block print out its node as well */
+        if (free)
+        {
+          node_t *free_node = payload;
+
+          /* adjusting spacing when printing if either pointer is equal to null */
+          int space_prev = free_node->prev == NULL ? 23 : 17;
+          int space_next = free_node->next == NULL ? 23 : 17;
+
+          printf("Prev:    [%p %*s]\n", free_node->prev, space_prev, "");
+          printf("Next:    [%p %*s]\n", free_node->next, space_next, "");
+        }
+
+        printf("\n");
+      } while ((curr_ptr = next_block(curr_ptr)) != NULL);
+    }
+  }
+}
+
+/* Function: dump_arena
+ * -----------------
+ * This function adds a record for every block in an arena to a heap snapshot, and records
+ * the arena's header and epilogue as overhead.
+ */
+void dump_arena(heap_dump_t *dump, arena_t *arena)
+{
+  header_t *header = first_block(arena);
+
+  heap_dump_block(dump, arena, (char *)header - (char *)arena, DUMP_OVERHEAD, 0);
+
+  for (; header != NULL; header = next_block(header))
   {
-    int space = 10;
-    int free = is_free(curr_ptr);
-    void *payload = header2payload(curr_ptr);
-    size_t size = get_size(curr_ptr);
+    if (is_free(header))
+    {
+      heap_dump_block(dump, header, HEADER_SIZE + get_size(header), DUMP_FREE, 0);
+    }
+    else
+    {
+      heap_dump_block(dump, header, HEADER_SIZE + get_size(header), DUMP_ALLOCATED, get_tag(header));
+    }
+
+    if (next_block(header) == NULL)
+    {
+      char *epilogue = (char *)header2payload(header) + get_size(header);
+
+      heap_dump_block(dump, epilogue, (char *)arena + arena->size - epilogue, DUMP_OVERHEAD, 0);
+    }
+  }
+}
+
+/* Function: mydump_heap_binary
+ * -----------------
+ * This function writes a snapshot of the heap to fd. The page zone is walked span by span:
+ * free spans are unused, spans at the head of the (address ordered) arena lists are
+ * arenas, and any other span is a large block. The gap before the permanent zone is
+ * unused, the permanent zone is walked block by block from permanent_top, and the page
+ * map after it is overhead.
+ */
+bool mydump_heap_binary(int fd)
+{
+  heap_dump_t dump;
+  arena_t *arenas[] = {main_arenas, churn_arenas};
+  size_t npages;
+  bool span_free;
 
-    printf("Header:  [%p   %*d   %2d]\n", curr_ptr, space, HEADER_SIZE, free);
-    printf("Payload: [%p   %10ld   %2d]\n", payload, size, free);
+  heap_dump_start(&dump, fd, segment_start, segment_size);
 
-    /* if we have a free block print out its node as well */
-    if (free)
+  for (char *span = span_next(NULL, &npages, &span_free); span != NULL; span = span_next(span, &npages, &span_free))
+  {
+    if (span_free)
     {
-      node_t *free_node = payload;
+      heap_dump_block(&dump, span, npages * PAGE_SIZE, DUMP_UNUSED, 0);
+      continue;
+    }
 
-      /* adjusting spacing when printing if either pointer is equal to null */
-      int space_prev = free_node->prev == NULL ? 23 : 17;
-      int space_next = free_node->next == NULL ? 23 : 17;
+    int i = ((void *)span == arenas[0]) ? 0 : ((void *)span == arenas[1]) ? 1 : -1;
 
-      printf("Prev:    [%p %*s]\n", free_node->prev, space_prev, "");
-      printf("Next:    [%p %*s]\n", free_node->next, space_next, "");
+    if (i < 0)
+    {
+      heap_dump_block(&dump, span, npages * PAGE_SIZE, DUMP_LARGE, span_alloc_tag(span));
+      continue;
     }
 
-    printf("\n");
-  } while ((curr_ptr = next_block(curr_ptr)) != NULL);
+    dump_arena(&dump, arenas[i]);
+    arenas[i] = arenas[i]->next;
+  }
+
+  heap_dump_block(&dump, pages_end, (char *)permanent_top - (char *)pages_end, DUMP_UNUSED, 0);
+
+  for (char *block = permanent_top; block < (char *)permanent_end; block += HEADER_SIZE + get_size((header_t *)block))
+  {
+    heap_dump_block(&dump, block, HEADER_SIZE + get_size((header_t *)block), DUMP_PERMANENT, get_tag((header_t *)block));
+  }
+
+  heap_dump_block(&dump, permanent_end, (char *)segment_end - (char *)permanent_end, DUMP_OVERHEAD, 0);
+
+  return heap_dump_finish(&dump);
 }
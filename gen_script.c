@@ -0,0 +1,552 @@
+/*
+ * File: gen_script.c
+ * ------------------
+ * Generates synthetic scripts for the test harness from simple parameterized
+ * workload models, so allocators can be tried on workloads shaped like the
+ * hand-written scripts but at any scale.  The same seed and options always
+ * produce the same script.  Scripts are written as text, or in the binary
+ * format described in script.h with -b.
+ *
+ * Usage: gen_script [-m model] [-n count] [-s seed] [-z sizes] [-l lifetimes]
+ *                   [-w width] [-g growth] [-x] [-b] [-o output]
+ *
+ * Models (-m):
+ *   random   blocks of random size are freed after a random lifetime
+ *   queue    producers allocate bursts of blocks that consumers free in
+ *            the order they were allocated, up to -w blocks queued at once;
+ *            with -x the consumers free with remote frees, as if they ran
+ *            on a different thread from the producers
+ *   chain    -w blocks at a time are grown by realloc, each by a factor of
+ *            -g, until they reach the end of their lifetime and are freed
+ *   allfree  every block is allocated, then all are freed in the same order
+ *
+ * For random and queue, -n is the number of blocks allocated; for chain it
+ * is the number of alloc and realloc requests; every block is freed by the
+ * end of the script.  Sizes default to uniform:1:1024 and lifetimes to
+ * exp:100, except that chains default to uniform:1:8 reallocs so their
+ * blocks don't grow without bound.
+ *
+ * Distributions (-z for sizes in bytes, -l for lifetimes in requests):
+ *   uniform:MIN:MAX          equally likely values from MIN to MAX
+ *   power:MIN:MAX:ALPHA      power law from MIN to MAX, mostly small values
+ *   bimodal:SMALL:LARGE:PCT  near SMALL, or near LARGE PCT% of the time
+ *   exp:MEAN                 exponential with the given mean
+ *   hist:FILE                replays a histogram of "value count" lines
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "script.h"
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+// A distribution to draw sizes or lifetimes from
+enum dist_type {
+    UNIFORM,
+    POWER,
+    BIMODAL,
+    EXPONENTIAL,
+    HISTOGRAM
+};
+typedef struct {
+    enum dist_type type;
+    double a, b, c;         // parameters, in the order they are given
+    size_t *values;         // histogram values
+    double *cumulative;     // running total of the histogram counts
+    int num_values;
+} dist_t;
+
+// Where requests are written, and what the header of a binary script needs
+typedef struct {
+    FILE *fp;
+    bool binary;
+    int lineno;
+    binary_script_header_t header;
+} output_t;
+
+// A block waiting to be freed, ordered by when it dies
+typedef struct {
+    uint64_t death;
+    int id;
+} pending_t;
+
+// Min-heap of pending frees, and the ids free to be used again
+typedef struct {
+    pending_t *pending;
+    int num_pending;
+    int *free_ids;
+    int num_free_ids;
+    int next_id;
+} workload_t;
+
+static uint64_t rng_state;
+
+
+/* Function: next_random
+ * ---------------------
+ * Returns the next value from a splitmix64 generator, which gives the same
+ * sequence for a seed on every machine, unlike rand().
+ */
+static uint64_t next_random(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Returns a random double in [0, 1)
+static double random_unit(void) {
+    return (next_random() >> 11) * (1.0 / (1ULL << 53));
+}
+
+// Returns a random integer in [lo, hi]
+static uint64_t random_between(uint64_t lo, uint64_t hi) {
+    return lo + next_random() % (hi - lo + 1);
+}
+
+
+/* Function: load_histogram
+ * ------------------------
+ * Reads a histogram of "value count" lines into dist, skipping blank lines
+ * and comments, so that values can be drawn in proportion to their counts.
+ */
+static void load_histogram(dist_t *dist, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open histogram file \"%s\".", path);
+    }
+
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    int lineno = 0, capacity = 0;
+    double total = 0;
+
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        lineno++;
+        char ch;
+        if (sscanf(buffer, " %c", &ch) != 1 || ch == '#') {
+            continue;
+        }
+
+        size_t value;
+        double count;
+        if (sscanf(buffer, "%zu %lf", &value, &count) != 2 || count < 0) {
+            error(1, 0, "Line %d of histogram file '%s' is malformed.", lineno, path);
+        }
+        if (dist->num_values == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            dist->values = realloc(dist->values, capacity * sizeof(size_t));
+            dist->cumulative = realloc(dist->cumulative, capacity * sizeof(double));
+            if (!dist->values || !dist->cumulative) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        total += count;
+        dist->values[dist->num_values] = value;
+        dist->cumulative[dist->num_values] = total;
+        dist->num_values++;
+    }
+    fclose(fp);
+
+    if (total <= 0) {
+        error(1, 0, "Histogram file '%s' has no counts.", path);
+    }
+}
+
+/* Function: parse_dist
+ * --------------------
+ * Parses a distribution given on the command line as a name followed by its
+ * parameters, all separated by colons.
+ */
+static dist_t parse_dist(const char *spec) {
+    dist_t dist;
+    memset(&dist, 0, sizeof(dist));
+    int n = 0;
+
+    if (strncmp(spec, "hist:", 5) == 0) {
+        dist.type = HISTOGRAM;
+        load_histogram(&dist, spec + 5);
+        return dist;
+    } else if (sscanf(spec, "uniform:%lf:%lf%n", &dist.a, &dist.b, &n) == 2) {
+        dist.type = UNIFORM;
+    } else if (sscanf(spec, "power:%lf:%lf:%lf%n", &dist.a, &dist.b, &dist.c, &n) == 3) {
+        dist.type = POWER;
+    } else if (sscanf(spec, "bimodal:%lf:%lf:%lf%n", &dist.a, &dist.b, &dist.c, &n) == 3) {
+        dist.type = BIMODAL;
+    } else if (sscanf(spec, "exp:%lf%n", &dist.a, &n) == 1) {
+        dist.type = EXPONENTIAL;
+    }
+
+    bool ordered = dist.type == EXPONENTIAL || dist.a <= dist.b;
+    if (n == 0 || spec[n] != '\0' || dist.a < 0 || !ordered ||
+        (dist.type == POWER && dist.a < 1) || (dist.type == BIMODAL && dist.c > 100)) {
+        error(1, 0, "Bad distribution \"%s\".", spec);
+    }
+    return dist;
+}
+
+/* Function: sample_dist
+ * ---------------------
+ * Draws a value from the distribution.  The power law is a bounded Pareto
+ * drawn by inverting its CDF, and the modes of a bimodal distribution are
+ * jittered by up to an eighth so its sizes aren't all identical.
+ */
+static double sample_dist(const dist_t *dist) {
+    double u = random_unit();
+
+    switch (dist->type) {
+        case UNIFORM:
+            return random_between(dist->a, dist->b);
+        case POWER: {
+            double lo = pow(dist->a, -dist->c), hi = pow(dist->b, -dist->c);
+            return pow(lo - u * (lo - hi), -1 / dist->c);
+        }
+        case BIMODAL: {
+            double mode = (random_unit() * 100 < dist->c) ? dist->b : dist->a;
+            return mode * (1 + (u - 0.5) / 4);
+        }
+        case EXPONENTIAL:
+            return -dist->a * log(1 - u);
+        case HISTOGRAM: {
+            // binary search for the first value whose running count passes u
+            double target = u * dist->cumulative[dist->num_values - 1];
+            int lo = 0, hi = dist->num_values - 1;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (dist->cumulative[mid] > target) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            return dist->values[lo];
+        }
+        default:
+            return 0;
+    }
+}
+
+// Draws a request size, keeping it within what scripts allow
+static size_t sample_size(const dist_t *sizes) {
+    double size = sample_dist(sizes);
+    return (size < MAX_REQUEST_SIZE) ? (size_t)size : MAX_REQUEST_SIZE;
+}
+
+// Draws a lifetime, counted in requests
+static uint64_t sample_lifetime(const dist_t *lifetimes) {
+    double lifetime = sample_dist(lifetimes);
+    return (lifetime < UINT32_MAX) ? (uint64_t)lifetime : UINT32_MAX;
+}
+
+
+/* Function: emit
+ * --------------
+ * Writes one request, either as a script line or as a binary record.  The
+ * line number recorded in a binary record is the line the request would be
+ * on in the text script.
+ */
+static void emit(output_t *out, enum request_type op, int id, size_t size) {
+    out->lineno++;
+
+    if (out->binary) {
+        request_t request;
+        memset(&request, 0, sizeof(request));
+        request.op = op;
+        request.id = id;
+        request.size = size;
+        request.lineno = out->lineno;
+        if (fwrite(&request, sizeof(request), 1, out->fp) != 1) {
+            error(1, errno, "Could not write request");
+        }
+        out->header.num_ops++;
+        if ((uint64_t)id >= out->header.num_ids) {
+            out->header.num_ids = id + 1;
+        }
+    } else if (op == FREE || op == REMOTE_FREE) {
+        fprintf(out->fp, "%c %d\n", op == FREE ? 'f' : 'x', id);
+    } else {
+        fprintf(out->fp, "%c %d %zu\n", op == ALLOC ? 'a' : 'r', id, size);
+    }
+}
+
+// Returns an id that no live block is using, reusing freed ids first
+static int take_id(workload_t *w) {
+    return w->num_free_ids > 0 ? w->free_ids[--w->num_free_ids] : w->next_id++;
+}
+
+static void release_id(workload_t *w, int id) {
+    w->free_ids[w->num_free_ids++] = id;
+}
+
+/* Function: push_pending
+ * ----------------------
+ * Adds a block to the heap of pending frees, sifting it up to its place.
+ */
+static void push_pending(workload_t *w, uint64_t death, int id) {
+    int i = w->num_pending++;
+    while (i > 0 && w->pending[(i - 1) / 2].death > death) {
+        w->pending[i] = w->pending[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    w->pending[i] = (pending_t){ .death = death, .id = id };
+}
+
+/* Function: pop_pending
+ * ---------------------
+ * Removes and returns the id of the block that dies first.
+ */
+static int pop_pending(workload_t *w) {
+    int id = w->pending[0].id;
+    pending_t last = w->pending[--w->num_pending];
+    int i = 0;
+
+    while (2 * i + 1 < w->num_pending) {
+        int child = 2 * i + 1;
+        if (child + 1 < w->num_pending && w->pending[child + 1].death < w->pending[child].death) {
+            child++;
+        }
+        if (last.death <= w->pending[child].death) {
+            break;
+        }
+        w->pending[i] = w->pending[child];
+        i = child;
+    }
+    w->pending[i] = last;
+    return id;
+}
+
+
+/* Function: gen_random
+ * --------------------
+ * Allocates count blocks, each with a lifetime measured in allocations.
+ * Before each allocation, every block whose lifetime is up is freed.
+ */
+static void gen_random(output_t *out, workload_t *w, int count, const dist_t *sizes,
+    const dist_t *lifetimes) {
+    for (uint64_t now = 0; now < (uint64_t)count; now++) {
+        while (w->num_pending > 0 && w->pending[0].death <= now) {
+            int id = pop_pending(w);
+            emit(out, FREE, id, 0);
+            release_id(w, id);
+        }
+        int id = take_id(w);
+        emit(out, ALLOC, id, sample_size(sizes));
+        push_pending(w, now + 1 + sample_lifetime(lifetimes), id);
+    }
+    while (w->num_pending > 0) {
+        int id = pop_pending(w);
+        emit(out, FREE, id, 0);
+        release_id(w, id);
+    }
+}
+
+/* Function: gen_queue
+ * -------------------
+ * Alternates between a producer allocating a burst of blocks and a consumer
+ * freeing a burst of the oldest ones, keeping at most depth blocks queued.
+ */
+static void gen_queue(output_t *out, workload_t *w, int count, const dist_t *sizes, int depth,
+    bool remote) {
+    int *queue = malloc(depth * sizeof(int));
+    if (!queue) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    int head = 0, queued = 0, produced = 0;
+
+    while (produced < count || queued > 0) {
+        int room = depth - queued;
+        if (room > count - produced) {
+            room = count - produced;
+        }
+        if (room > 0) {
+            for (int n = random_between(1, room); n > 0; n--, produced++) {
+                int id = take_id(w);
+                emit(out, ALLOC, id, sample_size(sizes));
+                queue[(head + queued++) % depth] = id;
+            }
+        }
+        int n = (produced == count) ? queued : (int)random_between(1, queued);
+        for (; n > 0; n--) {
+            emit(out, remote ? REMOTE_FREE : FREE, queue[head], 0);
+            release_id(w, queue[head]);
+            head = (head + 1) % depth;
+            queued--;
+        }
+    }
+    free(queue);
+}
+
+/* Function: gen_chain
+ * -------------------
+ * Keeps width blocks growing at once.  Each request picks one of them and
+ * either starts it, reallocs it to growth times its size, or frees it once
+ * it has been realloc'ed as many times as its lifetime.
+ */
+static void gen_chain(output_t *out, workload_t *w, int count, const dist_t *sizes,
+    const dist_t *lifetimes, int width, double growth) {
+    int *ids = malloc(width * sizeof(int));
+    uint64_t *remaining = malloc(width * sizeof(uint64_t));
+    double *current = malloc(width * sizeof(double));
+    if (!ids || !remaining || !current) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < width; i++) {
+        ids[i] = -1;
+    }
+
+    for (int n = 0; n < count; n++) {
+        int i = random_between(0, width - 1);
+        if (ids[i] >= 0 && remaining[i] == 0) {
+            emit(out, FREE, ids[i], 0);
+            release_id(w, ids[i]);
+            ids[i] = -1;
+        }
+        if (ids[i] < 0) {
+            ids[i] = take_id(w);
+            current[i] = sample_size(sizes);
+            remaining[i] = sample_lifetime(lifetimes);
+            emit(out, ALLOC, ids[i], current[i]);
+        } else {
+            current[i] = (current[i] * growth < MAX_REQUEST_SIZE) ? current[i] * growth : MAX_REQUEST_SIZE;
+            remaining[i]--;
+            emit(out, REALLOC, ids[i], current[i]);
+        }
+    }
+    for (int i = 0; i < width; i++) {
+        if (ids[i] >= 0) {
+            emit(out, FREE, ids[i], 0);
+        }
+    }
+    free(ids);
+    free(remaining);
+    free(current);
+}
+
+/* Function: gen_allfree
+ * ---------------------
+ * Allocates count blocks and then frees them in the order they were
+ * allocated, which leaves each freed block next to another free block
+ * only on its left.
+ */
+static void gen_allfree(output_t *out, int count, const dist_t *sizes) {
+    for (int id = 0; id < count; id++) {
+        emit(out, ALLOC, id, sample_size(sizes));
+    }
+    for (int id = 0; id < count; id++) {
+        emit(out, FREE, id, 0);
+    }
+}
+
+
+/* Function: main
+ * --------------
+ * Parses the options, writes the requests of the chosen model and, for a
+ * binary script, goes back to fill in the header once the number of requests
+ * and block ids are known.
+ */
+int main(int argc, char *argv[]) {
+    const char *model = "random", *outpath = NULL;
+    const char *size_spec = "uniform:1:1024", *lifetime_spec = NULL;
+    int count = 1000, width = 16;
+    double growth = 1.5;
+    bool binary = false, remote = false;
+    unsigned long long seed = 1;
+
+    int c;
+    while ((c = getopt(argc, argv, "m:n:s:z:l:w:g:xbo:")) != EOF) {
+        switch (c) {
+            case 'm': model = optarg; break;
+            case 'n': count = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'z': size_spec = optarg; break;
+            case 'l': lifetime_spec = optarg; break;
+            case 'w': width = atoi(optarg); break;
+            case 'g': growth = atof(optarg); break;
+            case 'x': remote = true; break;
+            case 'b': binary = true; break;
+            case 'o': outpath = optarg; break;
+            default:
+                error(1, 0, "Usage: %s [-m random|queue|chain|allfree] [-n count] [-s seed] "
+                    "[-z sizes] [-l lifetimes] [-w width] [-g growth] [-x] [-b] [-o output]", argv[0]);
+        }
+    }
+    if (count <= 0 || width <= 0 || growth < 1) {
+        error(1, 0, "The count and width must be positive, and growth at least 1.");
+    }
+    if (binary && outpath == NULL) {
+        error(1, 0, "Binary scripts need an output file (-o), since the header is written last.");
+    }
+
+    if (lifetime_spec == NULL) {
+        lifetime_spec = (strcmp(model, "chain") == 0) ? "uniform:1:8" : "exp:100";
+    }
+
+    rng_state = seed;
+    dist_t sizes = parse_dist(size_spec);
+    dist_t lifetimes = parse_dist(lifetime_spec);
+
+    output_t out = { .fp = stdout, .binary = binary, .lineno = 0 };
+    if (outpath != NULL && (out.fp = fopen(outpath, binary ? "wb" : "w")) == NULL) {
+        error(1, errno, "Could not create \"%s\"", outpath);
+    }
+    memset(&out.header, 0, sizeof(out.header));
+    memcpy(out.header.magic, BINARY_SCRIPT_MAGIC, sizeof(out.header.magic));
+    out.header.version = BINARY_SCRIPT_VERSION;
+    out.header.record_size = sizeof(request_t);
+
+    if (binary) {
+        // leave room for the header, which is written last
+        if (fwrite(&out.header, sizeof(out.header), 1, out.fp) != 1) {
+            error(1, errno, "Could not write to \"%s\"", outpath);
+        }
+    } else {
+        // record how the script was made, so it can be made again
+        fprintf(out.fp, "# gen_script -m %s -n %d -s %llu -z %s -l %s -w %d -g %g%s\n",
+            model, count, seed, size_spec, lifetime_spec, width, growth, remote ? " -x" : "");
+        out.lineno++;
+    }
+
+    // no more than count blocks are ever live at once
+    workload_t w;
+    memset(&w, 0, sizeof(w));
+    w.pending = malloc(count * sizeof(pending_t));
+    w.free_ids = malloc(count * sizeof(int));
+    if (!w.pending || !w.free_ids) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    if (strcmp(model, "random") == 0) {
+        gen_random(&out, &w, count, &sizes, &lifetimes);
+    } else if (strcmp(model, "queue") == 0) {
+        gen_queue(&out, &w, count, &sizes, width, remote);
+    } else if (strcmp(model, "chain") == 0) {
+        gen_chain(&out, &w, count, &sizes, &lifetimes, width, growth);
+    } else if (strcmp(model, "allfree") == 0) {
+        gen_allfree(&out, count, &sizes);
+    } else {
+        error(1, 0, "Unknown model \"%s\".", model);
+    }
+
+    if (binary && (fseek(out.fp, 0, SEEK_SET) != 0 ||
+        fwrite(&out.header, sizeof(out.header), 1, out.fp) != 1)) {
+        error(1, errno, "Could not write to \"%s\"", outpath);
+    }
+    if (fclose(out.fp) != 0) {
+        error(1, errno, "Could not write script");
+    }
+
+    free(w.pending);
+    free(w.free_ids);
+    free(sizes.values);
+    free(sizes.cumulative);
+    free(lifetimes.values);
+    free(lifetimes.cumulative);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide the writer that the custom heap allocators stream their heap
+ * snapshots with. Records are gathered in a buffer inside the snapshot itself, which the
+ * allocator keeps on its stack, and written to the file descriptor with write whenever the
+ * buffer fills, so a snapshot of any size is written without calling back into an
+ * allocator.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "./heap_dump.h"
+
+/* Function: write_all
+ * -----------------
+ * This function writes every one of the given bytes to fd, carrying on after short writes
+ * and interruptions, and returns false if the write fails.
+ */
+static bool write_all(int fd, const void *buffer, size_t size)
+{
+  const char *bytes = buffer;
+
+  while (size > 0)
+  {
+    ssize_t nwritten = write(fd, bytes, size);
+
+    if (nwritten < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (nwritten <= 0)
+    {
+      return false;
+    }
+
+    bytes += nwritten;
+    size -= nwritten;
+  }
+
+  return true;
+}
+
+/* Function: flush_records
+ * -----------------
+ * This function writes out the buffered records and empties the buffer. Once a write has
+ * failed, nothing more is written.
+ */
+static void flush_records(heap_dump_t *dump)
+{
+  if (!dump->failed && !write_all(dump->fd, dump->records, dump->count * sizeof(heap_dump_record_t)))
+  {
+    dump->failed = true;
+  }
+
+  dump->count = 0;
+}
+
+/* Function: heap_dump_start
+ * -----------------
+ * This function writes the snapshot's header and empties its buffer.
+ */
+void heap_dump_start(heap_dump_t *dump, int fd, void *segment_start, size_t segment_size)
+{
+  heap_dump_header_t header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HEAP_DUMP_MAGIC, sizeof(header.magic));
+  header.version = HEAP_DUMP_VERSION;
+  header.record_size = sizeof(heap_dump_record_t);
+  header.segment_start = (uintptr_t)segment_start;
+  header.segment_size = segment_size;
+
+  dump->fd = fd;
+  dump->segment_start = segment_start;
+  dump->count = 0;
+  dump->failed = !write_all(fd, &header, sizeof(header));
+}
+
+/* Function: heap_dump_block
+ * -----------------
+ * This function adds a record to the buffer, writing the buffer out first if it is full.
+ */
+void heap_dump_block(heap_dump_t *dump, void *start, size_t size, enum heap_dump_kind kind, uint32_t tag)
+{
+  if (size == 0)
+  {
+    return;
+  }
+
+  if (dump->count == HEAP_DUMP_BUFFER_RECORDS)
+  {
+    flush_records(dump);
+  }
+
+  heap_dump_record_t *record = &dump->records[dump->count++];
+
+  record->offset = (char *)start - dump->segment_start;
+  record->size = size;
+  record->kind = kind;
+  record->tag = tag;
+}
+
+/* Function: heap_dump_finish
+ * -----------------
+ * This function writes out the last of the records and reports whether every write
+ * succeeded.
+ */
+bool heap_dump_finish(heap_dump_t *dump)
+{
+  flush_records(dump);
+
+  return !dump->failed;
+}
@@ -0,0 +1,81 @@
+/* File: heap_dump.h
+ * -----------------
+ * Format of the heap snapshots that mydump_heap_binary writes, and the
+ * buffered writer the allocators write them with. A snapshot is a header
+ * followed by a record for every block in the segment, in address order,
+ * so that it can be streamed out of a heap of millions of blocks without
+ * allocating and read back by heapmap.
+ */
+#ifndef _HEAP_DUMP_H
+#define _HEAP_DUMP_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t
+
+// Magic bytes at the start of every snapshot, and its format version
+#define HEAP_DUMP_MAGIC "HEAPDUMP"
+#define HEAP_DUMP_VERSION 1
+
+// Header at the start of a snapshot, followed by heap_dump_record_t records
+// until the end of the file
+typedef struct {
+    char magic[8];          // HEAP_DUMP_MAGIC, not NUL-terminated
+    uint32_t version;       // HEAP_DUMP_VERSION
+    uint32_t record_size;   // sizeof(heap_dump_record_t) on the machine that wrote it
+    uint64_t segment_start; // address of the heap segment
+    uint64_t segment_size;  // bytes in the heap segment
+} heap_dump_header_t;
+
+// What a range of the segment holds
+enum heap_dump_kind {
+    DUMP_ALLOCATED = 1,     // a block handed out by malloc or realloc
+    DUMP_FREE,              // a free block that can be handed out again
+    DUMP_LARGE,             // an allocated block of whole pages
+    DUMP_PERMANENT,         // a block allocated with LIFETIME_PERMANENT
+    DUMP_UNUSED,            // space not yet given to any block, such as free pages
+    DUMP_OVERHEAD           // the allocator's own bookkeeping
+};
+
+// A block, with its header, or another range of the segment
+typedef struct {
+    uint64_t offset;        // start of the range, from the start of the segment
+    uint64_t size;          // bytes in the range
+    uint32_t kind;          // a heap_dump_kind
+    uint32_t tag;           // allocation tag of the block, or 0 if unknown
+} heap_dump_record_t;
+
+// Records are written out this many at a time
+#define HEAP_DUMP_BUFFER_RECORDS 256
+
+// A snapshot being written, which is small enough to keep on the stack
+typedef struct {
+    int fd;
+    bool failed;
+    char *segment_start;
+    size_t count;
+    heap_dump_record_t records[HEAP_DUMP_BUFFER_RECORDS];
+} heap_dump_t;
+
+/* Function: heap_dump_start
+ * -------------------------
+ * Starts a snapshot of the given segment, writing its header to fd.
+ */
+void heap_dump_start(heap_dump_t *dump, int fd, void *segment_start, size_t segment_size);
+
+/* Function: heap_dump_block
+ * -------------------------
+ * Adds a record of the size bytes at start to the snapshot. Empty ranges
+ * are left out.
+ */
+void heap_dump_block(heap_dump_t *dump, void *start, size_t size, enum heap_dump_kind kind,
+    uint32_t tag);
+
+/* Function: heap_dump_finish
+ * --------------------------
+ * Writes out the records still buffered. Returns false if any part of the
+ * snapshot couldn't be written.
+ */
+bool heap_dump_finish(heap_dump_t *dump);
+
+#endif
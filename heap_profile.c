@@ -0,0 +1,352 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide a sampling heap profiler (in the style of tcmalloc's) for
+ * the custom heap allocators. Rather than recording every allocation, it counts down the
+ * bytes allocated to the next sample, with the gaps between samples drawn from an
+ * exponential distribution so that the samples form a Poisson process over the bytes
+ * allocated. Only sampled blocks have their call stack taken, so the cost of profiling
+ * is a comparison per call plus a backtrace every sample_period bytes. Sampled blocks are
+ * kept in an open-addressed table by address until they are freed, and their counts are
+ * kept against the call stack that allocated them. Both tables are mapped once from the
+ * operating system, so the profiler never calls back into an allocator.
+ */
+#include <execinfo.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "./heap_profile.h"
+
+/* the deepest call stack recorded, and the sizes of the tables of call stacks and of sampled
+ * blocks, which are powers of two and are never filled past half way
+ */
+#define MAX_DEPTH 32
+#define STACK_SLOTS (1 << 12)
+#define SAMPLE_SLOTS (1 << 16)
+
+typedef struct
+{
+  size_t depth;
+  void *frames[MAX_DEPTH];
+
+  /* the sampled blocks of this call stack that are still live, and all it has had */
+  size_t live_count;
+  size_t live_bytes;
+  size_t total_count;
+  size_t total_bytes;
+} bucket_t;
+
+typedef struct
+{
+  void *ptr;
+  size_t size;
+  bucket_t *bucket;
+} sample_t;
+
+size_t heap_profile_countdown = SIZE_MAX;
+size_t heap_profile_live_samples;
+
+static bool running;
+static size_t sample_period;
+static uint64_t rng_state;
+
+static bucket_t *buckets;
+static size_t num_buckets;
+static sample_t *samples;
+
+/* Function: next_random
+ * -----------------
+ * This function returns the next number from a splitmix64 generator.
+ */
+static uint64_t next_random(void)
+{
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+  return z ^ (z >> 31);
+}
+
+/* Function: next_gap
+ * -----------------
+ * This function returns the number of bytes to allocate before the next sample, drawn
+ * from an exponential distribution with a mean of sample_period bytes.
+ */
+static size_t next_gap(void)
+{
+  /* a uniform number in (0, 1], from the top 53 bits */
+  double uniform = ((next_random() >> 11) + 1) * (1.0 / (1L << 53));
+
+  return (size_t)(-log(uniform) * sample_period) + 1;
+}
+
+/* Function: hash_pointer
+ * -----------------
+ * This function returns a hash of a pointer, mixing in its high bits since blocks are
+ * aligned.
+ */
+static size_t hash_pointer(void *ptr)
+{
+  uint64_t bits = (uintptr_t)ptr;
+
+  return (bits ^ (bits >> 17)) * 0x9e3779b97f4a7c15 >> 32;
+}
+
+/* Function: find_bucket
+ * -----------------
+ * This function returns the bucket for the given call stack, claiming an empty slot for it
+ * if it hasn't been seen before, or null if the table of call stacks is half full.
+ */
+static bucket_t *find_bucket(void **frames, size_t depth)
+{
+  size_t hash = depth;
+
+  for (size_t i = 0; i < depth; i++)
+  {
+    hash = (hash ^ hash_pointer(frames[i])) * 31;
+  }
+
+  for (size_t slot = hash & (STACK_SLOTS - 1);; slot = (slot + 1) & (STACK_SLOTS - 1))
+  {
+    bucket_t *bucket = &buckets[slot];
+
+    if (bucket->depth == depth && memcmp(bucket->frames, frames, depth * sizeof(void *)) == 0)
+    {
+      return bucket;
+    }
+
+    if (bucket->depth == 0)
+    {
+      if (num_buckets >= STACK_SLOTS / 2)
+      {
+        return NULL;
+      }
+
+      bucket->depth = depth;
+      memcpy(bucket->frames, frames, depth * sizeof(void *));
+      num_buckets++;
+
+      return bucket;
+    }
+  }
+}
+
+/* Function: heap_profile_start
+ * -----------------
+ * This function maps the profiler's tables the first time it is started, empties them,
+ * and starts the countdown to the first sample.
+ */
+bool heap_profile_start(size_t period)
+{
+  if (period == 0)
+  {
+    return false;
+  }
+
+  if (buckets == NULL)
+  {
+    size_t bytes = STACK_SLOTS * sizeof(bucket_t) + SAMPLE_SLOTS * sizeof(sample_t);
+    void *tables = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (tables == MAP_FAILED)
+    {
+      return false;
+    }
+
+    buckets = tables;
+    samples = (sample_t *)(buckets + STACK_SLOTS);
+  }
+
+  memset(buckets, 0, STACK_SLOTS * sizeof(bucket_t));
+  memset(samples, 0, SAMPLE_SLOTS * sizeof(sample_t));
+
+  num_buckets = 0;
+  heap_profile_live_samples = 0;
+
+  /* the first backtrace loads the unwinder, which may call malloc, so get it over with */
+  void *frame;
+  backtrace(&frame, 1);
+
+  sample_period = period;
+  rng_state = (uintptr_t)&frame ^ period;
+  running = true;
+  heap_profile_countdown = next_gap();
+
+  return true;
+}
+
+/* Function: heap_profile_stop
+ * -----------------
+ * This function stops the countdown, so that no more blocks are sampled.
+ */
+void heap_profile_stop(void)
+{
+  running = false;
+  heap_profile_countdown = SIZE_MAX;
+}
+
+/* Function: heap_profile_sample
+ * -----------------
+ * This function records a sampled block against the call stack that allocated it, leaving
+ * out the profiler's own frame. A block is dropped if either table is half full.
+ */
+void heap_profile_sample(void *ptr, size_t size)
+{
+  if (!running)
+  {
+    heap_profile_countdown = SIZE_MAX;
+
+    return;
+  }
+
+  heap_profile_countdown = next_gap();
+
+  /* a block can't be sampled twice, so any record left at this address is stale */
+  heap_profile_free(ptr);
+
+  void *frames[MAX_DEPTH + 1];
+  int depth = backtrace(frames, MAX_DEPTH + 1) - 1;
+
+  if (depth <= 0 || heap_profile_live_samples >= SAMPLE_SLOTS / 2)
+  {
+    return;
+  }
+
+  bucket_t *bucket = find_bucket(frames + 1, depth);
+
+  if (bucket == NULL)
+  {
+    return;
+  }
+
+  size_t slot = hash_pointer(ptr) & (SAMPLE_SLOTS - 1);
+
+  while (samples[slot].ptr != NULL)
+  {
+    slot = (slot + 1) & (SAMPLE_SLOTS - 1);
+  }
+
+  samples[slot].ptr = ptr;
+  samples[slot].size = size;
+  samples[slot].bucket = bucket;
+
+  heap_profile_live_samples++;
+
+  bucket->live_count++;
+  bucket->live_bytes += size;
+  bucket->total_count++;
+  bucket->total_bytes += size;
+}
+
+/* Function: heap_profile_forget
+ * -----------------
+ * This function drops the record of a sampled block, if there is one at this address, and
+ * shifts back the records after it that it was in the way of, so that no record is left
+ * behind an empty slot that a lookup would stop at.
+ */
+void heap_profile_forget(void *ptr)
+{
+  size_t slot = hash_pointer(ptr) & (SAMPLE_SLOTS - 1);
+
+  while (samples[slot].ptr != ptr)
+  {
+    if (samples[slot].ptr == NULL)
+    {
+      return;
+    }
+
+    slot = (slot + 1) & (SAMPLE_SLOTS - 1);
+  }
+
+  samples[slot].bucket->live_count--;
+  samples[slot].bucket->live_bytes -= samples[slot].size;
+
+  heap_profile_live_samples--;
+
+  size_t hole = slot;
+
+  for (slot = (hole + 1) & (SAMPLE_SLOTS - 1); samples[slot].ptr != NULL; slot = (slot + 1) & (SAMPLE_SLOTS - 1))
+  {
+    size_t home = hash_pointer(samples[slot].ptr) & (SAMPLE_SLOTS - 1);
+
+    /* a record can fill the hole if the hole lies between its home slot and its slot */
+    if (((slot - home) & (SAMPLE_SLOTS - 1)) >= ((slot - hole) & (SAMPLE_SLOTS - 1)))
+    {
+      samples[hole] = samples[slot];
+      hole = slot;
+    }
+  }
+
+  samples[hole].ptr = NULL;
+}
+
+/* Function: heap_profile_dump
+ * -----------------
+ * This function writes the profile in the legacy heap profile format. The heap_v2 tag
+ * tells pprof the sample period, which it needs to scale the samples of each call stack
+ * back up to an estimate of all the blocks they were drawn from.
+ */
+bool heap_profile_dump(FILE *out)
+{
+  if (buckets == NULL)
+  {
+    return false;
+  }
+
+  size_t live_count = 0;
+  size_t live_bytes = 0;
+  size_t total_count = 0;
+  size_t total_bytes = 0;
+
+  for (size_t slot = 0; slot < STACK_SLOTS; slot++)
+  {
+    live_count += buckets[slot].live_count;
+    live_bytes += buckets[slot].live_bytes;
+    total_count += buckets[slot].total_count;
+    total_bytes += buckets[slot].total_bytes;
+  }
+
+  fprintf(out, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n", live_count, live_bytes, total_count, total_bytes, sample_period);
+
+  for (size_t slot = 0; slot < STACK_SLOTS; slot++)
+  {
+    bucket_t *bucket = &buckets[slot];
+
+    if (bucket->total_count == 0)
+    {
+      continue;
+    }
+
+    fprintf(out, "%6zu: %8zu [%6zu: %8zu] @", bucket->live_count, bucket->live_bytes, bucket->total_count, bucket->total_bytes);
+
+    for (size_t i = 0; i < bucket->depth; i++)
+    {
+      fprintf(out, " 0x%016" PRIxPTR, (uintptr_t)bucket->frames[i]);
+    }
+
+    fprintf(out, "\n");
+  }
+
+  /* pprof maps the addresses in the stacks back to the binary and libraries with these */
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+
+  FILE *maps = fopen("/proc/self/maps", "r");
+
+  if (maps != NULL)
+  {
+    char buffer[4096];
+    size_t nread;
+
+    while ((nread = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+    {
+      fwrite(buffer, 1, nread, out);
+    }
+
+    fclose(maps);
+  }
+
+  return fflush(out) == 0 && !ferror(out);
+}
@@ -0,0 +1,106 @@
+/* File: heap_profile.h
+ * --------------------
+ * Interface for the sampling heap profiler that the custom heap allocators
+ * report their blocks to. While the profiler is running, about one
+ * allocation in every sample_period bytes is sampled, and the call stack of
+ * each sampled block is kept until the block is freed. A dump gives the
+ * sampled blocks that are still live and every block sampled since the
+ * profiler started, by call stack, in the legacy heap profile format that
+ * pprof reads and scales back up.
+ */
+#ifndef _HEAP_PROFILE_H
+#define _HEAP_PROFILE_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdio.h>   // for FILE
+
+// Bytes left to allocate before the next sample, and the number of sampled
+// blocks still live. They are only here so that the calls the allocators
+// make can be inlined, and cost a single comparison while nothing is sampled.
+extern size_t heap_profile_countdown;
+extern size_t heap_profile_live_samples;
+
+/* Function: heap_profile_start
+ * ----------------------------
+ * Starts the profiler afresh, sampling about one allocation in every
+ * sample_period bytes. The gaps between samples are drawn from an
+ * exponential distribution, so that every byte allocated is as likely to
+ * be sampled as any other. Returns false if the period is 0 or there is no
+ * memory for the profiler's tables.
+ */
+bool heap_profile_start(size_t sample_period);
+
+/* Function: heap_profile_stop
+ * ---------------------------
+ * Stops sampling new blocks. Sampled blocks are still forgotten as they are
+ * freed, so a later dump still shows which of them are live.
+ */
+void heap_profile_stop(void);
+
+/* Function: heap_profile_dump
+ * ---------------------------
+ * Writes the profile to out: a heap profile header with the totals and the
+ * sample period, a line with the live and cumulative samples of each call
+ * stack, and the process's memory mappings for pprof to symbolize the stacks
+ * with. Returns false if the profiler has never been started or the profile
+ * couldn't be written.
+ */
+bool heap_profile_dump(FILE *out);
+
+/* Function: heap_profile_sample
+ * -----------------------------
+ * Records the call stack of a block that the countdown has picked, and
+ * starts the countdown to the next sample. Allocators call
+ * heap_profile_malloc rather than this.
+ */
+void heap_profile_sample(void *ptr, size_t size);
+
+/* Function: heap_profile_forget
+ * -----------------------------
+ * Drops the record of a block if it was sampled. Allocators call
+ * heap_profile_free rather than this.
+ */
+void heap_profile_forget(void *ptr);
+
+/* Function: heap_profile_malloc
+ * -----------------------------
+ * Called by an allocator with each block it hands out and the number of
+ * bytes asked for.
+ */
+static inline void heap_profile_malloc(void *ptr, size_t size)
+{
+  if (size < heap_profile_countdown)
+  {
+    heap_profile_countdown -= size;
+  }
+  else
+  {
+    heap_profile_sample(ptr, size);
+  }
+}
+
+/* Function: heap_profile_free
+ * ---------------------------
+ * Called by an allocator with each block it frees.
+ */
+static inline void heap_profile_free(void *ptr)
+{
+  if (heap_profile_live_samples > 0)
+  {
+    heap_profile_forget(ptr);
+  }
+}
+
+/* Function: heap_profile_resize
+ * -----------------------------
+ * Called by an allocator with each block it resizes in place and the number
+ * of bytes now asked for. The block counts as freed and allocated again.
+ */
+static inline void heap_profile_resize(void *ptr, size_t size)
+{
+  heap_profile_free(ptr);
+  heap_profile_malloc(ptr, size);
+}
+
+#endif
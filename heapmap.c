@@ -0,0 +1,371 @@
+/*
+ * File: heapmap.c
+ * ---------------
+ * Draws a heap snapshot written by mydump_heap_binary (or by the test
+ * harness with -d) as a fragmentation map, and prints a summary of it.
+ *
+ * The map is a binary PPM image that reads like a page of text: the segment
+ * runs left to right and top to bottom, and each pixel covers -b bytes of
+ * it, coloured by what those bytes hold, blended where a pixel covers more
+ * than one kind of block.  Runs of unused space or overhead longer than
+ * two rows are drawn as a single row, so that a small heap in a large
+ * segment, or a large page map, doesn't crowd out the blocks; -a draws
+ * every row.
+ *
+ *   allocated blocks        blue          free blocks under -s bytes  red
+ *   large blocks            cyan          larger free blocks          green
+ *   permanent blocks        purple        the allocator's overhead    grey
+ *   unused space            dark grey     not in the snapshot         black
+ *
+ * The summary counts the blocks and bytes of each kind, the external
+ * fragmentation of the free blocks (the share of free bytes outside the
+ * largest free block), a histogram of free block sizes and, if the blocks
+ * were tagged, the bytes allocated under each tag.
+ *
+ * Usage: heapmap [-w width] [-b bytes] [-s small] [-a] [-o output.ppm]
+ *                <input.heapdump>
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap_dump.h"
+
+// What a byte of the map is coloured as: a heap_dump_kind, or one of these
+enum {
+    UNCOVERED = 0,          // between the records of the snapshot
+    SMALL_FREE = DUMP_OVERHEAD + 1,  // a free block under the -s threshold
+    NUM_CATEGORIES
+};
+
+static const unsigned char COLOURS[NUM_CATEGORIES][3] = {
+    [UNCOVERED] = {0, 0, 0},
+    [DUMP_ALLOCATED] = {40, 90, 220},
+    [DUMP_FREE] = {60, 200, 80},
+    [DUMP_LARGE] = {60, 190, 220},
+    [DUMP_PERMANENT] = {150, 70, 190},
+    [DUMP_UNUSED] = {45, 45, 45},
+    [DUMP_OVERHEAD] = {160, 160, 160},
+    [SMALL_FREE] = {230, 50, 40},
+};
+
+static const char *const KIND_NAMES[] = {
+    [DUMP_ALLOCATED] = "allocated",
+    [DUMP_FREE] = "free",
+    [DUMP_LARGE] = "large",
+    [DUMP_PERMANENT] = "permanent",
+    [DUMP_UNUSED] = "unused",
+    [DUMP_OVERHEAD] = "overhead",
+};
+
+#define NUM_KINDS (DUMP_OVERHEAD + 1)
+#define NUM_SIZE_BUCKETS 64
+
+// Tags at or above this are counted together
+#define MAX_TAGS 65536
+
+// The map being drawn, one row at a time
+typedef struct {
+    int width;              // pixels in a row
+    uint64_t bytes_per_pixel;
+    uint64_t row_bytes;     // width * bytes_per_pixel
+    uint64_t pos;           // bytes drawn so far, with unused runs collapsed
+    uint64_t (*row)[NUM_CATEGORIES]; // bytes of each category under each pixel of this row
+    unsigned char *pixels;  // the rows drawn so far
+    size_t num_rows;
+    size_t capacity;        // rows there is room for in pixels
+} map_t;
+
+// Totals for the summary
+typedef struct {
+    uint64_t count[NUM_KINDS];
+    uint64_t bytes[NUM_KINDS];
+    uint64_t largest_free;
+    uint64_t free_by_size[NUM_SIZE_BUCKETS]; // free blocks of [2^k, 2^(k+1)) bytes
+    uint64_t small_free;    // free blocks under the -s threshold
+    uint64_t small_free_bytes;
+    uint64_t *tag_bytes;    // allocated bytes by tag, the last entry for every tag past it
+    uint64_t *tag_count;
+    bool tagged;
+} summary_t;
+
+
+/* Function: flush_row
+ * -------------------
+ * Colours each pixel of the row just finished by blending the colours of
+ * what its bytes hold, adds it to the image and clears the row.
+ */
+static void flush_row(map_t *m) {
+    if (m->num_rows == m->capacity) {
+        m->capacity = m->capacity ? 2 * m->capacity : 256;
+        m->pixels = realloc(m->pixels, m->capacity * m->width * 3);
+        if (m->pixels == NULL) {
+            error(1, 0, "Out of memory drawing the map.");
+        }
+    }
+
+    unsigned char *out = m->pixels + m->num_rows * m->width * 3;
+    for (int x = 0; x < m->width; x++) {
+        uint64_t total = 0;
+        double rgb[3] = {0, 0, 0};
+        for (int cat = 0; cat < NUM_CATEGORIES; cat++) {
+            total += m->row[x][cat];
+            for (int c = 0; c < 3; c++) {
+                rgb[c] += (double)m->row[x][cat] * COLOURS[cat][c];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            out[3 * x + c] = total > 0 ? (unsigned char)(rgb[c] / total + 0.5) : 0;
+        }
+    }
+    m->num_rows++;
+    memset(m->row, 0, m->width * sizeof(*m->row));
+}
+
+/* Function: paint
+ * ---------------
+ * Draws the next `size` bytes of the map in the given category.
+ */
+static void paint(map_t *m, uint64_t size, int category) {
+    while (size > 0) {
+        uint64_t in_pixel = m->bytes_per_pixel - m->pos % m->bytes_per_pixel;
+        uint64_t n = size < in_pixel ? size : in_pixel;
+        m->row[(m->pos % m->row_bytes) / m->bytes_per_pixel][category] += n;
+        m->pos += n;
+        size -= n;
+        if (m->pos % m->row_bytes == 0) {
+            flush_row(m);
+        }
+    }
+}
+
+/* Function: paint_run
+ * -------------------
+ * Draws a run of unused, overhead or uncovered bytes, collapsing it to the
+ * end of the current row and one row more if it is longer than two rows,
+ * unless every row is to be drawn.
+ */
+static void paint_run(map_t *m, uint64_t size, int category, bool all_rows) {
+    if (!all_rows && size > 2 * m->row_bytes) {
+        size = m->row_bytes - m->pos % m->row_bytes + m->row_bytes;
+    }
+    paint(m, size, category);
+}
+
+static int size_bucket(uint64_t size) {
+    int bucket = 0;
+    while (size >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Function: add_record
+ * --------------------
+ * Counts a record in the summary.
+ */
+static void add_record(summary_t *s, const heap_dump_record_t *r, uint64_t small) {
+    s->count[r->kind]++;
+    s->bytes[r->kind] += r->size;
+    if (r->kind == DUMP_FREE) {
+        if (r->size > s->largest_free) {
+            s->largest_free = r->size;
+        }
+        s->free_by_size[size_bucket(r->size)]++;
+        if (r->size < small) {
+            s->small_free++;
+            s->small_free_bytes += r->size;
+        }
+    }
+    if (r->tag != 0) {
+        uint32_t tag = r->tag < MAX_TAGS ? r->tag : MAX_TAGS;
+        s->tag_bytes[tag] += r->size;
+        s->tag_count[tag]++;
+        s->tagged = true;
+    }
+}
+
+/* Function: read_snapshot
+ * -----------------------
+ * Reads a snapshot record by record, drawing each on the map and counting it
+ * in the summary.  Returns the size of the segment.
+ */
+static uint64_t read_snapshot(const char *path, map_t *m, summary_t *s, uint64_t small,
+    bool all_rows) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        error(1, errno, "Could not open heap snapshot \"%s\"", path);
+    }
+
+    heap_dump_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, HEAP_DUMP_MAGIC, sizeof(header.magic)) != 0) {
+        error(1, 0, "\"%s\" is not a heap snapshot.", path);
+    }
+    if (header.version != HEAP_DUMP_VERSION || header.record_size != sizeof(heap_dump_record_t)) {
+        error(1, 0, "\"%s\" was written in a different format (version %u, %u-byte records).",
+            path, header.version, header.record_size);
+    }
+
+    uint64_t end = 0;
+    size_t n = 0;
+    heap_dump_record_t r;
+    while (fread(&r, sizeof(r), 1, fp) == 1) {
+        if (r.kind < DUMP_ALLOCATED || r.kind > DUMP_OVERHEAD) {
+            error(1, 0, "Record %zu of \"%s\" has an unknown kind %u.", n, path, r.kind);
+        }
+        if (r.offset < end || r.offset + r.size > header.segment_size) {
+            error(1, 0, "Record %zu of \"%s\" overlaps another or runs past the segment.", n,
+                path);
+        }
+
+        paint_run(m, r.offset - end, UNCOVERED, all_rows);
+        if (r.kind == DUMP_UNUSED || r.kind == DUMP_OVERHEAD) {
+            paint_run(m, r.size, r.kind, all_rows);
+        } else {
+            paint(m, r.size, (r.kind == DUMP_FREE && r.size < small) ? SMALL_FREE : r.kind);
+        }
+        add_record(s, &r, small);
+        end = r.offset + r.size;
+        n++;
+    }
+    if (ferror(fp)) {
+        error(1, errno, "Could not read \"%s\"", path);
+    }
+    fclose(fp);
+
+    paint_run(m, header.segment_size - end, UNCOVERED, all_rows);
+    if (m->pos % m->row_bytes != 0) {
+        flush_row(m);
+    }
+    return header.segment_size;
+}
+
+static void write_map(const char *path, map_t *m) {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        error(1, errno, "Could not create \"%s\"", path);
+    }
+    fprintf(out, "P6\n%d %zu\n255\n", m->width, m->num_rows);
+    fwrite(m->pixels, 3, m->num_rows * m->width, out);
+    if (fclose(out) != 0) {
+        error(1, errno, "Could not write \"%s\"", path);
+    }
+}
+
+static void print_summary(summary_t *s, uint64_t segment_size, uint64_t small) {
+    printf("Segment: %lu bytes\n\n", segment_size);
+    printf("%-10s %12s %16s\n", "KIND", "RANGES", "BYTES");
+    for (int kind = DUMP_ALLOCATED; kind < NUM_KINDS; kind++) {
+        printf("%-10s %12lu %16lu\n", KIND_NAMES[kind], s->count[kind], s->bytes[kind]);
+    }
+
+    uint64_t in_use = s->bytes[DUMP_ALLOCATED] + s->bytes[DUMP_LARGE] + s->bytes[DUMP_PERMANENT];
+    uint64_t in_blocks = in_use + s->bytes[DUMP_FREE];
+    printf("\nBlocks in use: %lu bytes of the %lu in blocks (%.1f%%)\n", in_use, in_blocks,
+        in_blocks ? 100.0 * in_use / in_blocks : 0.0);
+
+    uint64_t free_bytes = s->bytes[DUMP_FREE];
+    printf("Free blocks: %lu bytes, largest %lu, external fragmentation %.1f%%\n", free_bytes,
+        s->largest_free, free_bytes ? 100.0 * (1.0 - (double)s->largest_free / free_bytes) : 0.0);
+    printf("Free blocks under %lu bytes: %lu, holding %lu bytes\n", small, s->small_free,
+        s->small_free_bytes);
+
+    if (s->count[DUMP_FREE] > 0) {
+        printf("\n%-24s %12s\n", "FREE BLOCK SIZE", "BLOCKS");
+        for (int k = 0; k < NUM_SIZE_BUCKETS; k++) {
+            if (s->free_by_size[k] > 0) {
+                char range[32];
+                snprintf(range, sizeof(range), "[%lu, %lu)", 1UL << k, 2UL << k);
+                printf("%-24s %12lu\n", range, s->free_by_size[k]);
+            }
+        }
+    }
+
+    if (s->tagged) {
+        printf("\n%-10s %12s %16s\n", "TAG", "BLOCKS", "BYTES");
+        for (uint32_t tag = 1; tag <= MAX_TAGS; tag++) {
+            if (s->tag_count[tag] > 0) {
+                char name[16] = "other";
+                if (tag < MAX_TAGS) {
+                    snprintf(name, sizeof(name), "%u", tag);
+                }
+                printf("%-10s %12lu %16lu\n", name, s->tag_count[tag], s->tag_bytes[tag]);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int width = 512;
+    uint64_t bytes_per_pixel = 64;
+    uint64_t small = 128;
+    bool all_rows = false;
+    const char *output = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "w:b:s:ao:")) != -1) {
+        if (c == 'w') {
+            width = atoi(optarg);
+            if (width <= 0) {
+                error(1, 0, "The width must be positive.");
+            }
+        } else if (c == 'b') {
+            bytes_per_pixel = strtoull(optarg, NULL, 10);
+            if (bytes_per_pixel == 0) {
+                error(1, 0, "The bytes per pixel must be positive.");
+            }
+        } else if (c == 's') {
+            small = strtoull(optarg, NULL, 10);
+        } else if (c == 'a') {
+            all_rows = true;
+        } else if (c == 'o') {
+            output = optarg;
+        } else {
+            error(1, 0, "Usage: %s [-w width] [-b bytes] [-s small] [-a] [-o output.ppm] "
+                "<input.heapdump>", argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        error(1, 0, "Usage: %s [-w width] [-b bytes] [-s small] [-a] [-o output.ppm] "
+            "<input.heapdump>", argv[0]);
+    }
+
+    const char *input = argv[optind];
+    char *default_output = NULL;
+    if (output == NULL) {
+        default_output = malloc(strlen(input) + sizeof(".ppm"));
+        if (default_output == NULL) {
+            error(1, 0, "Out of memory.");
+        }
+        sprintf(default_output, "%s.ppm", input);
+        output = default_output;
+    }
+
+    map_t m = { .width = width, .bytes_per_pixel = bytes_per_pixel,
+        .row_bytes = width * bytes_per_pixel };
+    m.row = calloc(width, sizeof(*m.row));
+    summary_t s = { .tag_bytes = calloc(MAX_TAGS + 1, sizeof(uint64_t)),
+        .tag_count = calloc(MAX_TAGS + 1, sizeof(uint64_t)) };
+    if (m.row == NULL || s.tag_bytes == NULL || s.tag_count == NULL) {
+        error(1, 0, "Out of memory.");
+    }
+
+    uint64_t segment_size = read_snapshot(input, &m, &s, small, all_rows);
+    write_map(output, &m);
+    print_summary(&s, segment_size, small);
+    printf("\nMap written to %s (%d x %zu, %lu bytes per pixel)\n", output, m.width, m.num_rows,
+        m.bytes_per_pixel);
+
+    free(m.row);
+    free(m.pixels);
+    free(s.tag_bytes);
+    free(s.tag_count);
+    free(default_output);
+    return 0;
+}
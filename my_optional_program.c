@@ -16,17 +16,334 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "allocator.h"
+#include "pool.h"
 #include "segment.h"
 
 #define HEAP_SIZE 1L << 32
 
+// Objects churned through the pool, enough to fill dozens of its chunks
+#define POOL_OBJECTS 20000
+#define POOL_OBJECT_SIZE 48
+
+// Tags the tag test allocates under, which nothing else uses, and a request
+// well past the size from which blocks are given whole pages
+#define TAG_FIRST 1
+#define TAG_OTHER 2
+#define TAG_REALLOC 3
+#define TAG_PERMANENT 4
+#define LARGE_REQUEST 20000
+
 bool initialize_heap_allocator()
 {
   init_heap_segment(HEAP_SIZE);
   return myinit(heap_segment_start(), heap_segment_size());
 }
 
+/* Function: fill_object, object_intact
+ * -------------------------------------
+ * fill_object writes a pattern derived from its index into a pool object,
+ * and object_intact checks that the pattern is still there.
+ */
+void fill_object(unsigned char *object, size_t index)
+{
+  for (size_t i = 0; i < POOL_OBJECT_SIZE; i++)
+  {
+    object[i] = (unsigned char)(index * 31 + i);
+  }
+}
+
+bool object_intact(unsigned char *object, size_t index)
+{
+  for (size_t i = 0; i < POOL_OBJECT_SIZE; i++)
+  {
+    if (object[i] != (unsigned char)(index * 31 + i))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Function: churn_pool
+ * --------------------
+ * Fills an object pool across many chunks, frees and reallocates objects
+ * in a scrambled order, checking that no object is overwritten, and then
+ * frees everything.  Once every object is gone, the pool must have handed
+ * its empty chunks back to myfree, keeping no more than one of them, and
+ * destroying it must leave the heap as it was.  Returns true if all is well.
+ */
+bool churn_pool()
+{
+  static unsigned char *objects[POOL_OBJECTS];
+  heap_stats_t before, after;
+
+  myheap_stats(&before);
+
+  mypool_t *pool = mypool_create(POOL_OBJECT_SIZE, 0);
+
+  if (pool == NULL)
+  {
+    fprintf(stderr, "pool: mypool_create failed\n");
+    return false;
+  }
+
+  for (size_t i = 0; i < POOL_OBJECTS; i++)
+  {
+    objects[i] = mypool_alloc(pool);
+
+    if (objects[i] == NULL)
+    {
+      fprintf(stderr, "pool: mypool_alloc failed\n");
+      return false;
+    }
+
+    fill_object(objects[i], i);
+  }
+
+  // each round frees a scrambled half of the objects and allocates them again
+  unsigned seed = 107;
+
+  for (size_t round = 0; round < 4; round++)
+  {
+    for (size_t i = 0; i < POOL_OBJECTS; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      size_t index = (seed >> 8) % POOL_OBJECTS;
+
+      if (objects[index] != NULL)
+      {
+        if (!object_intact(objects[index], index))
+        {
+          fprintf(stderr, "pool: object %zu was overwritten\n", index);
+          return false;
+        }
+
+        mypool_free(pool, objects[index]);
+        objects[index] = NULL;
+      }
+    }
+
+    for (size_t i = 0; i < POOL_OBJECTS; i++)
+    {
+      if (objects[i] == NULL)
+      {
+        objects[i] = mypool_alloc(pool);
+
+        if (objects[i] == NULL)
+        {
+          fprintf(stderr, "pool: mypool_alloc failed\n");
+          return false;
+        }
+
+        fill_object(objects[i], i);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < POOL_OBJECTS; i++)
+  {
+    if (!object_intact(objects[i], i))
+    {
+      fprintf(stderr, "pool: object %zu was overwritten\n", i);
+      return false;
+    }
+
+    mypool_free(pool, objects[i]);
+  }
+
+  // what is left is the pool, its frame table and at most one empty chunk
+  myheap_stats(&after);
+
+  if (after.frees == before.frees || after.mallocs - after.frees > before.mallocs - before.frees + 3)
+  {
+    fprintf(stderr, "pool: empty chunks were not handed back to myfree\n");
+    return false;
+  }
+
+  if (!validate_heap())
+  {
+    fprintf(stderr, "pool: validate_heap failed\n");
+    return false;
+  }
+
+  mypool_destroy(pool);
+  myheap_stats(&after);
+
+  if (after.mallocs - after.frees != before.mallocs - before.frees)
+  {
+    fprintf(stderr, "pool: mypool_destroy left blocks behind\n");
+    return false;
+  }
+
+  printf("pool: %d objects churned, %zu blocks allocated and freed\n", POOL_OBJECTS,
+         after.mallocs - before.mallocs);
+
+  return true;
+}
+
+/* Function: tag_holds
+ * -------------------
+ * Returns true if the given tag holds the given number of blocks, and at
+ * least the given number of bytes, printing what it holds otherwise.
+ */
+bool tag_holds(unsigned tag, size_t blocks, size_t min_bytes, const char *when)
+{
+  heap_tag_stats_t stats;
+
+  myheap_tag_stats(tag, &stats);
+
+  if (stats.live_blocks != blocks || stats.live_bytes < min_bytes || (blocks == 0 && stats.live_bytes != 0))
+  {
+    fprintf(stderr, "tags: tag %u holds %zu blocks of %zu bytes %s, not %zu blocks\n", tag,
+            stats.live_blocks, stats.live_bytes, when, blocks);
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: tags_add_up
+ * ---------------------
+ * Returns true if the bytes live under every tag add up to the live bytes
+ * of myheap_stats, printing both otherwise.
+ */
+bool tags_add_up(const char *when)
+{
+  heap_stats_t stats;
+  size_t tagged_bytes = 0;
+
+  myheap_stats(&stats);
+
+  for (unsigned tag = 0; tag < HEAP_MAX_TAGS; tag++)
+  {
+    heap_tag_stats_t tag_stats;
+
+    myheap_tag_stats(tag, &tag_stats);
+    tagged_bytes += tag_stats.live_bytes;
+  }
+
+  if (tagged_bytes != stats.live_bytes)
+  {
+    fprintf(stderr, "tags: the tags hold %zu bytes %s, but %zu are live\n", tagged_bytes, when,
+            stats.live_bytes);
+    return false;
+  }
+
+  return true;
+}
+
+/* Function: track_tags
+ * --------------------
+ * Allocates small, large and permanent blocks under tags, by myset_tag and
+ * by mymalloc_tagged, then reallocates each of them across the size from
+ * which blocks are given whole pages under yet another tag, and frees them,
+ * checking the totals of every tag along the way.  Blocks must keep their
+ * tags when they move, unless freed blocks stay live, in which case the
+ * allocator can't tell a block's tag and the copies are counted under the
+ * current tag.  Returns true if all is well.
+ */
+bool track_tags()
+{
+  heap_stats_t before, after;
+  void *probe = mymalloc(64);
+
+  myheap_stats(&before);
+  myfree(probe);
+  myheap_stats(&after);
+
+  bool reclaims = after.live_bytes < before.live_bytes;
+  unsigned old_tag = myset_tag(TAG_FIRST);
+
+  char *small = mymalloc(100);
+  char *large = mymalloc(LARGE_REQUEST);
+  char *other = mymalloc_tagged(200, TAG_OTHER);
+
+  if (small == NULL || large == NULL || other == NULL)
+  {
+    fprintf(stderr, "tags: mymalloc failed\n");
+    return false;
+  }
+
+  if (myset_tag(HEAP_MAX_TAGS) != TAG_FIRST || mymalloc_tagged(8, HEAP_MAX_TAGS) != NULL)
+  {
+    fprintf(stderr, "tags: a tag out of range was taken\n");
+    return false;
+  }
+
+  if (!tag_holds(TAG_FIRST, 2, 100 + LARGE_REQUEST, "once allocated") ||
+      !tag_holds(TAG_OTHER, 1, 200, "once allocated") || !tags_add_up("once allocated"))
+  {
+    return false;
+  }
+
+  myset_tag(TAG_PERMANENT);
+
+  char *permanent = mymalloc_hint(64, LIFETIME_PERMANENT);
+
+  char pattern[100];
+
+  myset_tag(TAG_REALLOC);
+  memset(pattern, 't', sizeof(pattern));
+  memcpy(small, pattern, 100);
+  memcpy(permanent, pattern, 64);
+
+  small = myrealloc(small, 2 * LARGE_REQUEST);
+  large = myrealloc(large, 50);
+  permanent = myrealloc(permanent, 4096);
+
+  if (small == NULL || large == NULL || permanent == NULL)
+  {
+    fprintf(stderr, "tags: myrealloc failed\n");
+    return false;
+  }
+
+  if (memcmp(small, pattern, 100) != 0 || memcmp(permanent, pattern, 64) != 0)
+  {
+    fprintf(stderr, "tags: myrealloc lost the contents of a block\n");
+    return false;
+  }
+
+  size_t first_bytes = reclaims ? 2 * LARGE_REQUEST + 50 : 100 + LARGE_REQUEST;
+
+  if (!tag_holds(TAG_FIRST, 2, first_bytes, "once reallocated") ||
+      !tag_holds(TAG_REALLOC, reclaims ? 0 : 3, 0, "once reallocated") ||
+      !tag_holds(TAG_PERMANENT, 1, reclaims ? 4096 : 64, "once reallocated") ||
+      !tags_add_up("once reallocated"))
+  {
+    return false;
+  }
+
+  myfree(small);
+  myfree(large);
+  myfree(other);
+
+  if (!tag_holds(TAG_FIRST, reclaims ? 0 : 2, 0, "once freed") ||
+      !tag_holds(TAG_OTHER, reclaims ? 0 : 1, 0, "once freed") ||
+      !tag_holds(TAG_REALLOC, reclaims ? 0 : 3, 0, "once freed") || !tags_add_up("once freed"))
+  {
+    return false;
+  }
+
+  if (myset_tag(old_tag) != TAG_REALLOC)
+  {
+    fprintf(stderr, "tags: myset_tag lost the current tag\n");
+    return false;
+  }
+
+  if (!validate_heap())
+  {
+    fprintf(stderr, "tags: validate_heap failed\n");
+    return false;
+  }
+
+  printf("tags: blocks kept their tags through %s\n", reclaims ? "realloc and free" : "free");
+
+  return true;
+}
+
 int main(int argc, char *argv[])
 {
   if (!initialize_heap_allocator())
@@ -34,7 +351,15 @@ int main(int argc, char *argv[])
     return 1;
   }
 
-  // todo: your code here
+  if (!churn_pool())
+  {
+    return 1;
+  }
+
+  if (!track_tags())
+  {
+    return 1;
+  }
 
   return 0;
 }
@@ -0,0 +1,586 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide fixed-size object pools on top of the custom
+ * heap allocator. Each pool owns a list of chunks carved out of the heap with
+ * mymalloc. Free objects are kept on an intrusive linked list threaded through
+ * the objects themselves, so objects carry no header and allocating or freeing
+ * one is a pointer pop or push.
+ *
+ * Since objects have no header, each pool finds the chunk an object belongs to
+ * through a small hash table keyed by frame, a power-of-two sized and aligned
+ * stretch of addresses no bigger than a chunk. The table maps every frame whose
+ * start lies in a chunk to that chunk, so an object's chunk is always the one
+ * mapped from its own frame or from the frame after it.
+ */
+#include <stdint.h>
+#include "./allocator.h"
+#include "./pool.h"
+
+#define POOL_CHUNK_BYTES 0x4000
+#define MIN_OBJECTS_PER_CHUNK 8
+#define MIN_FRAME_SLOTS 16
+
+typedef struct chunk chunk_t;
+typedef struct free_object free_object_t;
+typedef struct frame_slot frame_slot_t;
+
+struct free_object
+{
+  free_object_t *next;
+};
+
+struct frame_slot
+{
+  uintptr_t frame;
+  chunk_t *chunk;
+};
+
+struct chunk
+{
+  /* every chunk owned by the pool */
+  chunk_t *prev;
+  chunk_t *next;
+
+  /* chunks that still have room for at least one object */
+  chunk_t *prev_partial;
+  chunk_t *next_partial;
+
+  free_object_t *free_list;
+  char *objects;
+  char *bump;
+  char *end;
+  size_t nlive;
+};
+
+struct pool
+{
+  size_t object_size;
+  size_t alignment;
+  size_t objects_per_chunk;
+  chunk_t *chunks;
+  chunk_t *partial;
+
+  /* open addressed table from frame number to the chunk holding the frame's start */
+  size_t frame_shift;
+  frame_slot_t *frames;
+  size_t frame_capacity;
+  size_t frame_count;
+};
+
+/* Function: pool_roundup
+ * -----------------
+ * This function rounds up the given number to the given multiple, which
+ * must be a power of 2, and returns the result.
+ */
+static size_t pool_roundup(size_t num, size_t mult)
+{
+  return (num + mult - 1) & ~(mult - 1);
+}
+
+/* Function: chunk_has_room
+ * -----------------
+ * This function returns whether or not a chunk can hand out another object, either
+ * from its free list or from the part of the chunk that has never been used.
+ */
+static bool chunk_has_room(chunk_t *chunk)
+{
+  return chunk->free_list != NULL || chunk->bump < chunk->end;
+}
+
+/* Function: attach_partial
+ * -----------------
+ * This function adds a chunk to the front of the pool's list of chunks with room.
+ */
+static void attach_partial(mypool_t *pool, chunk_t *chunk)
+{
+  chunk->prev_partial = NULL;
+  chunk->next_partial = pool->partial;
+
+  if (pool->partial != NULL)
+  {
+    pool->partial->prev_partial = chunk;
+  }
+
+  pool->partial = chunk;
+}
+
+/* Function: detach_partial
+ * -----------------
+ * This function removes a chunk from the pool's list of chunks with room.
+ */
+static void detach_partial(mypool_t *pool, chunk_t *chunk)
+{
+  if (chunk->prev_partial != NULL)
+  {
+    chunk->prev_partial->next_partial = chunk->next_partial;
+  }
+  else
+  {
+    pool->partial = chunk->next_partial;
+  }
+
+  if (chunk->next_partial != NULL)
+  {
+    chunk->next_partial->prev_partial = chunk->prev_partial;
+  }
+}
+
+/* Function: frame_home
+ * -----------------
+ * This function returns the slot of the frame table that a frame hashes to.
+ */
+static size_t frame_home(mypool_t *pool, uintptr_t frame)
+{
+  return frame & (pool->frame_capacity - 1);
+}
+
+/* Function: frame_chunk
+ * -----------------
+ * This function returns the chunk that holds the start of the given frame, or null if no
+ * chunk of the pool does.
+ */
+static chunk_t *frame_chunk(mypool_t *pool, uintptr_t frame)
+{
+  if (pool->frame_count == 0)
+  {
+    return NULL;
+  }
+
+  size_t mask = pool->frame_capacity - 1;
+
+  for (size_t i = frame_home(pool, frame); pool->frames[i].chunk != NULL; i = (i + 1) & mask)
+  {
+    if (pool->frames[i].frame == frame)
+    {
+      return pool->frames[i].chunk;
+    }
+  }
+
+  return NULL;
+}
+
+/* Function: insert_frame
+ * -----------------
+ * This function maps a frame to a chunk in the first empty slot from the frame's home
+ * slot. The table must have an empty slot.
+ */
+static void insert_frame(mypool_t *pool, uintptr_t frame, chunk_t *chunk)
+{
+  size_t mask = pool->frame_capacity - 1;
+  size_t i = frame_home(pool, frame);
+
+  while (pool->frames[i].chunk != NULL)
+  {
+    i = (i + 1) & mask;
+  }
+
+  pool->frames[i].frame = frame;
+  pool->frames[i].chunk = chunk;
+  pool->frame_count++;
+}
+
+/* Function: remove_frame
+ * -----------------
+ * This function unmaps a frame, shifting later slots of the same run back into the hole
+ * so that no lookup stops short of its frame.
+ */
+static void remove_frame(mypool_t *pool, uintptr_t frame)
+{
+  size_t mask = pool->frame_capacity - 1;
+  size_t hole = frame_home(pool, frame);
+
+  while (pool->frames[hole].frame != frame)
+  {
+    hole = (hole + 1) & mask;
+  }
+
+  for (size_t i = (hole + 1) & mask; pool->frames[i].chunk != NULL; i = (i + 1) & mask)
+  {
+    size_t home = frame_home(pool, pool->frames[i].frame);
+
+    /* a slot whose home lies cyclically in (hole, i] is still reachable where it is */
+    bool reachable = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+
+    if (!reachable)
+    {
+      pool->frames[hole] = pool->frames[i];
+      hole = i;
+    }
+  }
+
+  pool->frames[hole].chunk = NULL;
+  pool->frame_count--;
+}
+
+/* Function: reserve_frames
+ * -----------------
+ * This function grows the frame table, if need be, so that it can take another nframes
+ * frames while staying at most half full. Returns false if the heap is exhausted.
+ */
+static bool reserve_frames(mypool_t *pool, size_t nframes)
+{
+  size_t capacity = pool->frame_capacity;
+
+  if (capacity == 0)
+  {
+    capacity = MIN_FRAME_SLOTS;
+  }
+
+  while ((pool->frame_count + nframes) * 2 > capacity)
+  {
+    capacity *= 2;
+  }
+
+  if (capacity == pool->frame_capacity)
+  {
+    return true;
+  }
+
+  frame_slot_t *frames = mymalloc(capacity * sizeof(frame_slot_t));
+
+  if (frames == NULL)
+  {
+    return false;
+  }
+
+  frame_slot_t *old_frames = pool->frames;
+  size_t old_capacity = pool->frame_capacity;
+
+  for (size_t i = 0; i < capacity; i++)
+  {
+    frames[i].chunk = NULL;
+  }
+
+  pool->frames = frames;
+  pool->frame_capacity = capacity;
+  pool->frame_count = 0;
+
+  for (size_t i = 0; i < old_capacity; i++)
+  {
+    if (old_frames[i].chunk != NULL)
+    {
+      insert_frame(pool, old_frames[i].frame, old_frames[i].chunk);
+    }
+  }
+
+  myfree(old_frames);
+
+  return true;
+}
+
+/* Function: first_frame
+ * -----------------
+ * This function returns the first frame whose start lies in a chunk.
+ */
+static uintptr_t first_frame(mypool_t *pool, chunk_t *chunk)
+{
+  return ((uintptr_t)chunk + ((uintptr_t)1 << pool->frame_shift) - 1) >> pool->frame_shift;
+}
+
+/* Function: last_frame
+ * -----------------
+ * This function returns the frame after the last frame whose start lies in a chunk.
+ */
+static uintptr_t last_frame(mypool_t *pool, chunk_t *chunk)
+{
+  return (((uintptr_t)chunk->end - 1) >> pool->frame_shift) + 1;
+}
+
+/* Function: add_chunk
+ * -----------------
+ * This function carves a new chunk out of the heap, links it into the pool and returns
+ * it, or returns null if the heap is exhausted. Objects are not threaded onto the free
+ * list up front, instead they are bumped out of the unused part of the chunk on demand.
+ */
+static chunk_t *add_chunk(mypool_t *pool)
+{
+  /* mymalloc only guarantees ALIGNMENT, so leave room to align the first object */
+  size_t padding = pool->alignment - ALIGNMENT;
+  size_t chunk_size = sizeof(chunk_t) + padding + pool->objects_per_chunk * pool->object_size;
+
+  chunk_t *chunk = mymalloc(chunk_size);
+
+  if (chunk == NULL)
+  {
+    return NULL;
+  }
+
+  chunk->free_list = NULL;
+  chunk->objects = (char *)pool_roundup((uintptr_t)(chunk + 1), pool->alignment);
+  chunk->bump = chunk->objects;
+  chunk->end = chunk->objects + pool->objects_per_chunk * pool->object_size;
+  chunk->nlive = 0;
+
+  uintptr_t first = first_frame(pool, chunk);
+  uintptr_t last = last_frame(pool, chunk);
+
+  if (!reserve_frames(pool, last - first))
+  {
+    myfree(chunk);
+    return NULL;
+  }
+
+  for (uintptr_t frame = first; frame < last; frame++)
+  {
+    insert_frame(pool, frame, chunk);
+  }
+
+  chunk->prev = NULL;
+  chunk->next = pool->chunks;
+
+  if (pool->chunks != NULL)
+  {
+    pool->chunks->prev = chunk;
+  }
+
+  pool->chunks = chunk;
+
+  attach_partial(pool, chunk);
+
+  return chunk;
+}
+
+/* Function: release_chunk
+ * -----------------
+ * This function unlinks an empty chunk from the pool and hands it back to the heap.
+ */
+static void release_chunk(mypool_t *pool, chunk_t *chunk)
+{
+  detach_partial(pool, chunk);
+
+  if (chunk->prev != NULL)
+  {
+    chunk->prev->next = chunk->next;
+  }
+  else
+  {
+    pool->chunks = chunk->next;
+  }
+
+  if (chunk->next != NULL)
+  {
+    chunk->next->prev = chunk->prev;
+  }
+
+  uintptr_t last = last_frame(pool, chunk);
+
+  for (uintptr_t frame = first_frame(pool, chunk); frame < last; frame++)
+  {
+    remove_frame(pool, frame);
+  }
+
+  myfree(chunk);
+}
+
+/* Function: find_chunk
+ * -----------------
+ * This function returns the chunk that an object belongs to, or null if the object was
+ * not handed out by this pool. A chunk is at least a frame long, so if it doesn't hold
+ * the start of the object's frame then it holds the start of the next frame.
+ */
+static chunk_t *find_chunk(mypool_t *pool, void *ptr)
+{
+  char *object = ptr;
+  uintptr_t frame = (uintptr_t)ptr >> pool->frame_shift;
+
+  for (uintptr_t candidate = frame; candidate <= frame + 1; candidate++)
+  {
+    chunk_t *chunk = frame_chunk(pool, candidate);
+
+    if (chunk != NULL && object >= chunk->objects && object < chunk->end)
+    {
+      return chunk;
+    }
+  }
+
+  return NULL;
+}
+
+/* Function: mypool_create
+ * -----------------
+ * This function creates a pool for objects of the given size and alignment. The pool
+ * itself lives on the heap, and no chunk is carved out until the first allocation.
+ */
+mypool_t *mypool_create(size_t object_size, size_t alignment)
+{
+  if (alignment == 0)
+  {
+    alignment = ALIGNMENT;
+  }
+
+  /* the alignment must be a power of 2, and objects must fit within a single request */
+  if ((alignment & (alignment - 1)) != 0 || object_size == 0 || object_size > MAX_REQUEST_SIZE)
+  {
+    return NULL;
+  }
+
+  if (alignment < ALIGNMENT)
+  {
+    alignment = ALIGNMENT;
+  }
+
+  /* every free object must be able to hold the free list pointer */
+  if (object_size < sizeof(free_object_t))
+  {
+    object_size = sizeof(free_object_t);
+  }
+
+  object_size = pool_roundup(object_size, alignment);
+
+  size_t objects_per_chunk = POOL_CHUNK_BYTES / object_size;
+
+  if (objects_per_chunk < MIN_OBJECTS_PER_CHUNK)
+  {
+    objects_per_chunk = MIN_OBJECTS_PER_CHUNK;
+  }
+
+  /* very large objects get a chunk each so that a chunk stays a valid request */
+  if (objects_per_chunk * object_size + alignment + sizeof(chunk_t) > MAX_REQUEST_SIZE)
+  {
+    objects_per_chunk = 1;
+  }
+
+  /* frames are the largest power of 2 that fits in every chunk */
+  size_t frame_shift = 0;
+
+  while (((size_t)2 << frame_shift) <= sizeof(chunk_t) + objects_per_chunk * object_size)
+  {
+    frame_shift++;
+  }
+
+  mypool_t *pool = mymalloc(sizeof(mypool_t));
+
+  if (pool == NULL)
+  {
+    return NULL;
+  }
+
+  pool->object_size = object_size;
+  pool->alignment = alignment;
+  pool->objects_per_chunk = objects_per_chunk;
+  pool->chunks = NULL;
+  pool->partial = NULL;
+  pool->frame_shift = frame_shift;
+  pool->frames = NULL;
+  pool->frame_capacity = 0;
+  pool->frame_count = 0;
+
+  return pool;
+}
+
+/* Function: mypool_alloc
+ * -----------------
+ * This function pops an object off the free list of the first chunk with room, carving
+ * a new chunk out of the heap only when every chunk is full.
+ */
+void *mypool_alloc(mypool_t *pool)
+{
+  chunk_t *chunk = pool->partial;
+
+  if (chunk == NULL && (chunk = add_chunk(pool)) == NULL)
+  {
+    return NULL;
+  }
+
+  void *object;
+
+  /* prefer recycled objects, otherwise bump out a fresh one */
+  if (chunk->free_list != NULL)
+  {
+    object = chunk->free_list;
+    chunk->free_list = chunk->free_list->next;
+  }
+  else
+  {
+    object = chunk->bump;
+    chunk->bump += pool->object_size;
+  }
+
+  chunk->nlive++;
+
+  if (!chunk_has_room(chunk))
+  {
+    detach_partial(pool, chunk);
+  }
+
+  return object;
+}
+
+/* Function: mypool_free
+ * -----------------
+ * This function pushes an object back onto its chunk's free list. A chunk that becomes
+ * empty is handed back to myfree, unless it is the only chunk left with room, in which
+ * case it is kept so that alternating alloc/free calls don't churn the heap.
+ */
+void mypool_free(mypool_t *pool, void *ptr)
+{
+  /* if we try to free a null pointer, then do nothing */
+  if (ptr == NULL)
+  {
+    return;
+  }
+
+  chunk_t *chunk = find_chunk(pool, ptr);
+
+  /* the object wasn't handed out by this pool */
+  if (chunk == NULL)
+  {
+    return;
+  }
+
+  bool was_full = !chunk_has_room(chunk);
+
+  free_object_t *object = ptr;
+
+  object->next = chunk->free_list;
+  chunk->free_list = object;
+  chunk->nlive--;
+
+  if (was_full)
+  {
+    attach_partial(pool, chunk);
+  }
+
+  if (chunk->nlive == 0)
+  {
+    bool only_partial = (pool->partial == chunk && chunk->next_partial == NULL);
+
+    if (!only_partial)
+    {
+      release_chunk(pool, chunk);
+    }
+    else
+    {
+      /* start carving from the front again to keep the live objects together */
+      chunk->free_list = NULL;
+      chunk->bump = chunk->objects;
+    }
+  }
+}
+
+/* Function: mypool_destroy
+ * -----------------
+ * This function hands every chunk, and then the pool itself, back to the heap.
+ */
+void mypool_destroy(mypool_t *pool)
+{
+  if (pool == NULL)
+  {
+    return;
+  }
+
+  chunk_t *chunk = pool->chunks;
+
+  while (chunk != NULL)
+  {
+    chunk_t *next = chunk->next;
+
+    myfree(chunk);
+
+    chunk = next;
+  }
+
+  myfree(pool->frames);
+  myfree(pool);
+}
@@ -0,0 +1,44 @@
+/* File: pool.h
+ * ------------
+ * Interface for fixed-size object pools layered on top of the custom heap
+ * allocator. A pool carves large chunks out of the heap with mymalloc and
+ * hands out same-sized objects from them, so repeated allocation and
+ * freeing of one struct type avoids the block search and splitting done
+ * by mymalloc.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h> // for size_t
+
+typedef struct pool mypool_t;
+
+/* Function: mypool_create
+ * -----------------------
+ * Creates a pool handing out objects of object_size bytes, each aligned to
+ * alignment bytes (a power of 2, or 0 for the default ALIGNMENT). Returns
+ * NULL if the arguments are invalid or the heap is exhausted.
+ */
+mypool_t *mypool_create(size_t object_size, size_t alignment);
+
+/* Function: mypool_alloc
+ * ----------------------
+ * Returns one object from the pool, or NULL if the heap is exhausted.
+ */
+void *mypool_alloc(mypool_t *pool);
+
+/* Function: mypool_free
+ * ---------------------
+ * Returns an object previously handed out by mypool_alloc on the same pool.
+ * Freeing NULL does nothing.
+ */
+void mypool_free(mypool_t *pool, void *ptr);
+
+/* Function: mypool_destroy
+ * ------------------------
+ * Returns every chunk owned by the pool, and the pool itself, to the heap.
+ * Any objects still handed out become invalid.
+ */
+void mypool_destroy(mypool_t *pool);
+
+#endif
@@ -0,0 +1,54 @@
+/* File: probes.h
+ * --------------
+ * Static tracepoints in the custom heap allocators, for perf, bpftrace or
+ * SystemTap to attach to in a running process. Where <sys/sdt.h> is
+ * installed (systemtap-sdt-dev), each probe compiles to a single nop and a
+ * note in the binary saying where to find its arguments, so it costs
+ * nothing until a tracer attaches to it; elsewhere, or when built with
+ * -DNO_HEAP_PROBES, the probes compile to nothing at all.
+ *
+ * Every allocator has these probes in the "heap" provider:
+ *
+ *   malloc__entry(size, hint)           malloc__return(ptr, size)
+ *   realloc__entry(ptr, size)           realloc__return(new_ptr, ptr, size)
+ *   free__entry(ptr)                    free__return(ptr)
+ *
+ * A realloc that moves its block also fires the probes of the malloc and
+ * free it is made of. The implicit and explicit allocators also have these:
+ *
+ *   fit__search(needed, steps, ptr)     a search of one arena looked at
+ *                                       steps blocks (free blocks only, in
+ *                                       explicit), and found ptr or null
+ *   block__split(ptr, size, needed)     a free block of size bytes was split
+ *                                       to hand out needed bytes at ptr
+ *   block__coalesce(ptr, size)          the block freed at ptr was merged
+ *                                       with the free block after it
+ *   heap__grow(arena, bytes)            an arena was taken from the page heap
+ *
+ * For example, to see how many blocks each search looks at:
+ *
+ *   bpftrace -e 'usdt:./test_explicit:heap:fit__search { @steps = hist(arg1); }'
+ */
+#ifndef _PROBES_H
+#define _PROBES_H
+
+#if !defined(NO_HEAP_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HEAP_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef HEAP_PROBES_ENABLED
+#define HEAP_PROBE1(name, a) DTRACE_PROBE1(heap, name, a)
+#define HEAP_PROBE2(name, a, b) DTRACE_PROBE2(heap, name, a, b)
+#define HEAP_PROBE3(name, a, b, c) DTRACE_PROBE3(heap, name, a, b, c)
+#else
+// the arguments are still used, so that values kept only for a probe don't
+// draw warnings
+#define HEAP_PROBE1(name, a) ((void)(a))
+#define HEAP_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define HEAP_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif
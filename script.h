@@ -0,0 +1,60 @@
+/* File: script.h
+ * --------------
+ * Definitions shared by the test harness and the script tools: the request
+ * read from each line of a text script, and the binary script format. A
+ * binary script is a header followed directly by an array of request_t
+ * records, so the harness can mmap the file and use the records in place
+ * instead of parsing text.
+ */
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
+
+// enum and struct for a single allocator request.  A remote free ("x <id>"
+// in a text script) frees a block from a thread other than the one that owns
+// it when a script is run on several threads, and is a plain free otherwise.
+enum request_type {
+    ALLOC = 1,
+    FREE,
+    REALLOC,
+    REMOTE_FREE
+};
+typedef struct {
+    enum request_type op;   // type of request
+    int id;                 // id for free() to use later
+    size_t size;            // num bytes for alloc/realloc request
+    int lineno;             // which line in file
+} request_t;
+
+// Magic bytes at the start of every binary script, and its format version
+#define BINARY_SCRIPT_MAGIC "ALLOCBIN"
+#define BINARY_SCRIPT_VERSION 1
+
+// Header at the start of a binary script, followed by num_ops records
+typedef struct {
+    char magic[8];          // BINARY_SCRIPT_MAGIC, not NUL-terminated
+    uint32_t version;       // BINARY_SCRIPT_VERSION
+    uint32_t record_size;   // sizeof(request_t) on the machine that wrote it
+    uint64_t num_ops;       // number of request_t records after the header
+    uint64_t num_ids;       // one more than the largest block id used
+} binary_script_header_t;
+
+// Returns the index of the first of a binary script's records that isn't a
+// request a text script could hold, with an id below num_ids and a size of
+// at most max_size, or num_ops if they all are.  Records are checked before
+// a script is run, since the replay loops index their block tables by id.
+static inline size_t find_bad_record(const request_t ops[], size_t num_ops, uint64_t num_ids,
+    size_t max_size) {
+    for (size_t i = 0; i < num_ops; i++) {
+        if (ops[i].op < ALLOC || ops[i].op > REMOTE_FREE || ops[i].id < 0 ||
+            (uint64_t)ops[i].id >= num_ids || ops[i].size > max_size) {
+            return i;
+        }
+    }
+    return num_ops;
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * File: script2bin.c
+ * ------------------
+ * Converts a text script file into the binary script format described in
+ * script.h, which the test harness can mmap instead of parsing.  Each line
+ * is checked the same way the test harness checks it, and the original line
+ * numbers are kept so errors still point into the text script.
+ *
+ * Usage: script2bin <input.script> <output.bscript>
+ */
+
+#include <error.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "allocator.h"
+#include "script.h"
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+
+/* Function: main
+ * --------------
+ * Reads the text script one line at a time, writing each request out as a
+ * record, then goes back and fills in the header once the number of
+ * requests and block ids are known.
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        error(1, 0, "Usage: %s <input.script> <output.bscript>", argv[0]);
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", argv[1]);
+    }
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        error(1, 0, "Could not create binary script \"%s\".", argv[2]);
+    }
+
+    binary_script_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_SCRIPT_MAGIC, sizeof(header.magic));
+    header.version = BINARY_SCRIPT_VERSION;
+    header.record_size = sizeof(request_t);
+
+    // leave room for the header, which is written last
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        error(1, 0, "Could not write to \"%s\".", argv[2]);
+    }
+
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    int lineno = 0;
+    int maxid = 0;
+
+    while (fgets(buffer, sizeof(buffer), in) != NULL) {
+        lineno++;
+
+        // skip lines that are all-whitespace or comments
+        char ch;
+        if (sscanf(buffer, " %c", &ch) != 1 || ch == '#') {
+            continue;
+        }
+
+        request_t request;
+        memset(&request, 0, sizeof(request));
+        request.lineno = lineno;
+
+        char request_char;
+        int nscanned = sscanf(buffer, " %c %d %zu", &request_char,
+            &request.id, &request.size);
+        if (request_char == 'a' && nscanned == 3) {
+            request.op = ALLOC;
+        } else if (request_char == 'r' && nscanned == 3) {
+            request.op = REALLOC;
+        } else if (request_char == 'f' && nscanned == 2) {
+            request.op = FREE;
+        } else if (request_char == 'x' && nscanned == 2) {
+            request.op = REMOTE_FREE;
+        }
+
+        if (!request.op || request.id < 0 || request.id == INT_MAX ||
+            request.size > MAX_REQUEST_SIZE) {
+            error(1, 0, "Line %d of script file '%s' is malformed.", lineno, argv[1]);
+        }
+
+        if (request.id > maxid) {
+            maxid = request.id;
+        }
+
+        if (fwrite(&request, sizeof(request), 1, out) != 1) {
+            error(1, 0, "Could not write to \"%s\".", argv[2]);
+        }
+        header.num_ops++;
+    }
+
+    header.num_ids = maxid + 1;
+
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fclose(out) != 0) {
+        error(1, 0, "Could not write to \"%s\".", argv[2]);
+    }
+    fclose(in);
+
+    printf("Converted %lu requests (%lu block ids) from %s to %s\n",
+        header.num_ops, header.num_ids, argv[1], argv[2]);
+    return 0;
+}
@@ -0,0 +1,21 @@
+/* File: size_classes.h
+ * --------------------
+ * Size classes for the implicit and explicit allocators, written by
+ *
+ *     tune_classes -t 4096 -o size_classes.h
+ *
+ * Don't edit it; run tune_classes again instead.
+ */
+#ifndef _SIZE_CLASSES_H
+#define _SIZE_CLASSES_H
+
+#include <stdint.h> // for uint8_t, uint32_t
+
+// Blocks of at least this many bytes are given whole pages by the page heap
+#define LARGE_BLOCK_SIZE 4096
+
+// Number of classes smaller blocks are rounded up to, or 0 if they are
+// only rounded up to ALIGNMENT
+#define NUM_SIZE_CLASSES 0
+
+#endif
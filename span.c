@@ -0,0 +1,547 @@
+/* CS107 Assignment 7
+ * Code by Adam Barry
+ *
+ * In this program we provide a page heap (in the style of tcmalloc's spans)
+ * underneath the custom heap allocators. The zone it is given is managed as runs
+ * of whole pages. Every page has an entry in a page map kept at the end of the
+ * zone, and the first and last page of each span carry its length and status as
+ * boundary tags, so that neighbouring free spans can be found and coalesced in
+ * constant time. Every page of an allocated span also records where the span
+ * starts. Free spans are kept on lists by length, with one shared list for long
+ * spans. The page map lives outside of the spans themselves, so a free span's
+ * pages are never written to.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include "./span.h"
+
+/* spans of at least this many pages share the last free list */
+#define LARGE_SPAN_PAGES 128
+
+#define NO_SPAN UINT32_MAX
+
+typedef struct
+{
+  uint32_t npages;
+  uint16_t is_free;
+
+  /* allocation tag of an allocated span, only kept in the entry of its first page */
+  uint16_t alloc_tag;
+
+  /* free list links, only kept in the entry of a free span's first page */
+  uint32_t prev;
+  uint32_t next;
+
+  /* first page of the allocated span this page belongs to */
+  uint32_t first;
+} page_entry_t;
+
+static char *zone_start;
+static size_t zone_npages;
+static page_entry_t *pagemap;
+static uint32_t free_lists[LARGE_SPAN_PAGES + 1];
+static size_t pages_in_use;
+
+/* Function: list_index
+ * -----------------
+ * This function returns which free list a span of the given length belongs on.
+ */
+static size_t list_index(size_t npages)
+{
+  return (npages < LARGE_SPAN_PAGES) ? npages : LARGE_SPAN_PAGES;
+}
+
+/* Function: page_index
+ * -----------------
+ * This function returns the index of the page that a pointer into the zone lies in.
+ */
+static uint32_t page_index(void *ptr)
+{
+  return ((char *)ptr - zone_start) / PAGE_SIZE;
+}
+
+/* Function: set_span
+ * -----------------
+ * This function writes the boundary tags for a span of npages pages starting at page first.
+ */
+static void set_span(uint32_t first, size_t npages, bool is_free)
+{
+  uint32_t last = first + npages - 1;
+
+  pagemap[first].npages = npages;
+  pagemap[first].is_free = is_free;
+  pagemap[last].npages = npages;
+  pagemap[last].is_free = is_free;
+}
+
+/* Function: set_owner
+ * -----------------
+ * This function records on the pages [from, to) of an allocated span that the span starts
+ * at page first.
+ */
+static void set_owner(uint32_t first, uint32_t from, uint32_t to)
+{
+  for (uint32_t page = from; page < to; page++)
+  {
+    pagemap[page].first = first;
+  }
+}
+
+/* Function: push_free
+ * -----------------
+ * This function adds a free span to the front of the free list for its length.
+ */
+static void push_free(uint32_t first)
+{
+  uint32_t *head = &free_lists[list_index(pagemap[first].npages)];
+
+  pagemap[first].prev = NO_SPAN;
+  pagemap[first].next = *head;
+
+  if (*head != NO_SPAN)
+  {
+    pagemap[*head].prev = first;
+  }
+
+  *head = first;
+}
+
+/* Function: remove_free
+ * -----------------
+ * This function detaches a free span from the free list for its length.
+ */
+static void remove_free(uint32_t first)
+{
+  uint32_t prev = pagemap[first].prev;
+  uint32_t next = pagemap[first].next;
+
+  if (prev != NO_SPAN)
+  {
+    pagemap[prev].next = next;
+  }
+  else
+  {
+    free_lists[list_index(pagemap[first].npages)] = next;
+  }
+
+  if (next != NO_SPAN)
+  {
+    pagemap[next].prev = prev;
+  }
+}
+
+/* Function: release_tail
+ * -----------------
+ * This function frees the pages [first, first + npages), which directly follow a span that
+ * is still allocated, coalescing them with the span after them if that one is free.
+ */
+static void release_tail(uint32_t first, size_t npages)
+{
+  uint32_t next = first + npages;
+
+  if (next < zone_npages && pagemap[next].is_free)
+  {
+    remove_free(next);
+
+    npages += pagemap[next].npages;
+  }
+
+  set_span(first, npages, true);
+  push_free(first);
+}
+
+/* Function: span_init
+ * -----------------
+ * This function sets up the page map at the end of the zone and makes every other page of
+ * the zone one free span.
+ */
+bool span_init(void *start, size_t size)
+{
+  /* only whole, aligned pages can be handed out */
+  uintptr_t first_page = ((uintptr_t)start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+  uintptr_t end_page = ((uintptr_t)start + size) & ~(uintptr_t)(PAGE_SIZE - 1);
+
+  zone_start = (char *)first_page;
+  zone_npages = 0;
+  pages_in_use = 0;
+
+  if (end_page <= first_page)
+  {
+    return false;
+  }
+
+  size_t total_pages = (end_page - first_page) / PAGE_SIZE;
+
+  /* every page handed out needs a page map entry, and the page map takes whole pages */
+  size_t npages = (total_pages * PAGE_SIZE) / (PAGE_SIZE + sizeof(page_entry_t));
+  size_t map_pages = (npages * sizeof(page_entry_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  while (npages > 0 && npages + map_pages > total_pages)
+  {
+    npages--;
+    map_pages = (npages * sizeof(page_entry_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+  }
+
+  if (npages == 0 || npages >= NO_SPAN)
+  {
+    return false;
+  }
+
+  zone_npages = npages;
+  pagemap = (page_entry_t *)(zone_start + npages * PAGE_SIZE);
+
+  for (size_t i = 0; i <= LARGE_SPAN_PAGES; i++)
+  {
+    free_lists[i] = NO_SPAN;
+  }
+
+  set_span(0, zone_npages, true);
+  push_free(0);
+
+  return true;
+}
+
+/* Function: span_alloc
+ * -----------------
+ * This function takes the first free span on the shortest list that fits npages pages
+ * (best fit among the long spans), splits off any pages it doesn't need and returns the
+ * start of the span.
+ */
+void *span_alloc(size_t npages)
+{
+  if (npages == 0 || npages > zone_npages)
+  {
+    return NULL;
+  }
+
+  uint32_t first = NO_SPAN;
+
+  /* every span on the lists below the long span list has exactly as many pages as its index */
+  for (size_t i = list_index(npages); i < LARGE_SPAN_PAGES && first == NO_SPAN; i++)
+  {
+    first = free_lists[i];
+  }
+
+  /* otherwise take the shortest long span that fits */
+  if (first == NO_SPAN)
+  {
+    for (uint32_t curr = free_lists[LARGE_SPAN_PAGES]; curr != NO_SPAN; curr = pagemap[curr].next)
+    {
+      size_t curr_npages = pagemap[curr].npages;
+
+      if (curr_npages >= npages && (first == NO_SPAN || curr_npages < pagemap[first].npages))
+      {
+        first = curr;
+      }
+    }
+  }
+
+  if (first == NO_SPAN)
+  {
+    return NULL;
+  }
+
+  size_t span_npages = pagemap[first].npages;
+
+  remove_free(first);
+
+  set_span(first, npages, false);
+  set_owner(first, first, first + npages);
+  pagemap[first].alloc_tag = 0;
+
+  pages_in_use += npages;
+
+  /* hand back the pages we don't need */
+  if (span_npages > npages)
+  {
+    set_span(first + npages, span_npages - npages, true);
+    push_free(first + npages);
+  }
+
+  return zone_start + (size_t)first * PAGE_SIZE;
+}
+
+/* Function: span_resize
+ * -----------------
+ * This function shrinks a span by freeing pages off its end, or grows it by absorbing
+ * the free span directly after it. It returns false if the span can't grow in place.
+ */
+bool span_resize(void *ptr, size_t npages)
+{
+  uint32_t first = page_index(ptr);
+  size_t span_npages = pagemap[first].npages;
+
+  if (npages == 0)
+  {
+    return false;
+  }
+
+  if (npages <= span_npages)
+  {
+    if (npages < span_npages)
+    {
+      set_span(first, npages, false);
+      release_tail(first + npages, span_npages - npages);
+
+      pages_in_use -= span_npages - npages;
+    }
+
+    return true;
+  }
+
+  uint32_t next = first + span_npages;
+
+  if (next >= zone_npages || !pagemap[next].is_free || span_npages + pagemap[next].npages < npages)
+  {
+    return false;
+  }
+
+  size_t available = span_npages + pagemap[next].npages;
+
+  remove_free(next);
+
+  set_span(first, npages, false);
+  set_owner(first, first + span_npages, first + npages);
+
+  pages_in_use += npages - span_npages;
+
+  if (available > npages)
+  {
+    set_span(first + npages, available - npages, true);
+    push_free(first + npages);
+  }
+
+  return true;
+}
+
+/* Function: span_free
+ * -----------------
+ * This function frees a span, coalescing it with the free spans on either side of it. The
+ * boundary tag on the page before the span tells us the length of the span before it.
+ */
+void span_free(void *ptr)
+{
+  uint32_t first = page_index(ptr);
+  size_t npages = pagemap[first].npages;
+
+  /* do nothing if the span is already free */
+  if (pagemap[first].is_free)
+  {
+    return;
+  }
+
+  pages_in_use -= npages;
+
+  /* coalesce with the span before this one */
+  if (first > 0 && pagemap[first - 1].is_free)
+  {
+    size_t prev_npages = pagemap[first - 1].npages;
+
+    first -= prev_npages;
+
+    remove_free(first);
+
+    npages += prev_npages;
+  }
+
+  release_tail(first, npages);
+}
+
+/* Function: span_shrink_zone
+ * -----------------
+ * This function gives up the last npages pages of the zone, which must lie in the free
+ * span at the end of the zone, shortening that span. The page map stays where it is.
+ * It returns false if there is no such span or it is too short.
+ */
+bool span_shrink_zone(size_t npages)
+{
+  if (npages == 0 || npages > zone_npages || !pagemap[zone_npages - 1].is_free)
+  {
+    return false;
+  }
+
+  size_t span_npages = pagemap[zone_npages - 1].npages;
+  uint32_t first = zone_npages - span_npages;
+
+  if (span_npages < npages)
+  {
+    return false;
+  }
+
+  remove_free(first);
+
+  zone_npages -= npages;
+
+  if (span_npages > npages)
+  {
+    set_span(first, span_npages - npages, true);
+    push_free(first);
+  }
+
+  return true;
+}
+
+/* Function: span_zone_end
+ * -----------------
+ * This function returns the end of the last page of the zone.
+ */
+void *span_zone_end(void)
+{
+  return zone_start + zone_npages * PAGE_SIZE;
+}
+
+/* Function: span_contains
+ * -----------------
+ * This function returns whether or not a pointer lies in the pages of the zone.
+ */
+bool span_contains(void *ptr)
+{
+  return (char *)ptr >= zone_start && (char *)ptr < zone_start + zone_npages * PAGE_SIZE;
+}
+
+/* Function: span_start
+ * -----------------
+ * This function returns the start of the allocated span that a pointer lies in.
+ */
+void *span_start(void *ptr)
+{
+  return zone_start + (size_t)pagemap[page_index(ptr)].first * PAGE_SIZE;
+}
+
+/* Function: span_pages
+ * -----------------
+ * This function returns the number of pages in the span starting at ptr.
+ */
+size_t span_pages(void *ptr)
+{
+  return pagemap[page_index(ptr)].npages;
+}
+
+/* Function: span_alloc_tag
+ * -----------------
+ * This function returns the allocation tag of the span starting at ptr.
+ */
+unsigned span_alloc_tag(void *ptr)
+{
+  return pagemap[page_index(ptr)].alloc_tag;
+}
+
+/* Function: span_set_alloc_tag
+ * -----------------
+ * This function sets the allocation tag of the span starting at ptr.
+ */
+void span_set_alloc_tag(void *ptr, unsigned tag)
+{
+  pagemap[page_index(ptr)].alloc_tag = tag;
+}
+
+/* Function: span_next
+ * -----------------
+ * This function returns the span after the one starting at ptr (or the first span if ptr
+ * is null) with its length and status, read from its first page's boundary tag.
+ */
+void *span_next(void *ptr, size_t *npages, bool *is_free)
+{
+  size_t first = (ptr == NULL) ? 0 : page_index(ptr) + pagemap[page_index(ptr)].npages;
+
+  if (first >= zone_npages)
+  {
+    return NULL;
+  }
+
+  *npages = pagemap[first].npages;
+  *is_free = pagemap[first].is_free;
+
+  return zone_start + first * PAGE_SIZE;
+}
+
+/* Function: span_pages_in_use
+ * -----------------
+ * This function returns the number of pages in allocated spans.
+ */
+size_t span_pages_in_use(void)
+{
+  return pages_in_use;
+}
+
+/* Function: span_validate
+ * -----------------
+ * This function walks the zone span by span checking that the boundary tags agree and
+ * that no two free spans are left next to each other, then walks the free lists checking
+ * that they hold exactly the free pages. It returns true if all is well.
+ */
+bool span_validate(void)
+{
+  size_t free_pages = 0;
+  bool prev_free = false;
+
+  for (size_t first = 0; first < zone_npages; first += pagemap[first].npages)
+  {
+    size_t npages = pagemap[first].npages;
+
+    if (npages == 0 || first + npages > zone_npages)
+    {
+      printf("Span at page %ld has a bad length of %ld pages!\n", first, npages);
+
+      return false;
+    }
+
+    page_entry_t *last = &pagemap[first + npages - 1];
+
+    if (last->npages != npages || last->is_free != pagemap[first].is_free)
+    {
+      printf("Span at page %ld has boundary tags that don't match!\n", first);
+
+      return false;
+    }
+
+    if (pagemap[first].is_free && prev_free)
+    {
+      printf("Free span at page %ld was not coalesced with the span before it!\n", first);
+
+      return false;
+    }
+
+    if (pagemap[first].is_free)
+    {
+      free_pages += npages;
+    }
+    else if (pagemap[first].first != first || last->first != first)
+    {
+      printf("Allocated span at page %ld doesn't record where it starts!\n", first);
+
+      return false;
+    }
+
+    prev_free = pagemap[first].is_free;
+  }
+
+  size_t listed_pages = 0;
+
+  for (size_t i = 1; i <= LARGE_SPAN_PAGES; i++)
+  {
+    uint32_t prev = NO_SPAN;
+
+    for (uint32_t curr = free_lists[i]; curr != NO_SPAN; curr = pagemap[curr].next)
+    {
+      if (!pagemap[curr].is_free || list_index(pagemap[curr].npages) != i || pagemap[curr].prev != prev)
+      {
+        printf("Span at page %u is on the wrong free list!\n", curr);
+
+        return false;
+      }
+
+      listed_pages += pagemap[curr].npages;
+      prev = curr;
+    }
+  }
+
+  if (listed_pages != free_pages)
+  {
+    printf("The free lists hold %ld pages, but %ld pages are free!\n", listed_pages, free_pages);
+
+    return false;
+  }
+
+  return true;
+}
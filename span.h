@@ -0,0 +1,103 @@
+/* File: span.h
+ * ------------
+ * Interface for the page heap underneath the custom heap allocators. The
+ * page heap manages a page-aligned zone of the heap segment as runs of
+ * whole pages (spans), so that page-sized and larger requests come back
+ * page-aligned and don't share the byte-granular block lists with small
+ * objects. The block allocators themselves draw their arenas of blocks
+ * from the page heap.
+ */
+#ifndef _SPAN_H
+#define _SPAN_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// Size of a page, and so the granularity of every span
+#define PAGE_SIZE 4096
+
+/* Function: span_init
+ * -------------------
+ * Resets the page heap to manage the zone [zone_start, zone_start + zone_size)
+ * as one free span. Part of the zone is kept for the page heap's own
+ * bookkeeping. Returns false if the zone can't hold a single page.
+ */
+bool span_init(void *zone_start, size_t zone_size);
+
+/* Function: span_alloc
+ * --------------------
+ * Returns the page-aligned start of a run of npages free pages, or NULL if
+ * no free span is big enough.
+ */
+void *span_alloc(size_t npages);
+
+/* Function: span_resize
+ * ---------------------
+ * Resizes the span starting at ptr to npages pages in place, giving pages
+ * back from its end or absorbing the free span after it. Returns false if
+ * the span can't grow in place.
+ */
+bool span_resize(void *ptr, size_t npages);
+
+/* Function: span_free
+ * -------------------
+ * Returns the span starting at ptr to the page heap, coalescing it with
+ * any free spans on either side.
+ */
+void span_free(void *ptr);
+
+/* Functions: span_shrink_zone, span_zone_end
+ * -------------------------------------------
+ * span_shrink_zone gives up the last npages pages of the zone for the
+ * caller to use, taking them from the free span at the end of the zone, and
+ * returns false if there isn't a free span there of at least npages pages.
+ * The page map stays where it is. span_zone_end returns the end of the
+ * zone's last page, which span_shrink_zone moves down.
+ */
+bool span_shrink_zone(size_t npages);
+void *span_zone_end(void);
+
+/* Functions: span_contains, span_start, span_pages
+ * -------------------------------------------------
+ * span_contains returns whether ptr lies in the page heap's zone.
+ * span_start returns the start of the allocated span that ptr lies in.
+ * span_pages returns the number of pages in the allocated span starting
+ * at ptr.
+ */
+bool span_contains(void *ptr);
+void *span_start(void *ptr);
+size_t span_pages(void *ptr);
+
+/* Functions: span_alloc_tag, span_set_alloc_tag
+ * ----------------------------------------------
+ * Read and set the allocation tag of the allocated span starting at ptr,
+ * which is kept in its page map entry since a large block has no header.
+ * span_alloc gives every span the tag 0, and span_resize keeps it.
+ */
+unsigned span_alloc_tag(void *ptr);
+void span_set_alloc_tag(void *ptr, unsigned tag);
+
+/* Function: span_next
+ * --------------------
+ * Walks the zone span by span in address order: returns the start of the
+ * span after the one starting at ptr, or of the first span if ptr is NULL,
+ * filling in its number of pages and whether it is free. Returns NULL after
+ * the last span.
+ */
+void *span_next(void *ptr, size_t *npages, bool *is_free);
+
+/* Function: span_pages_in_use
+ * ---------------------------
+ * Returns the number of pages in allocated spans, which is kept as spans
+ * are allocated, resized and freed.
+ */
+size_t span_pages_in_use(void);
+
+/* Function: span_validate
+ * -----------------------
+ * Walks every span checking the boundary tags and free lists, returning
+ * false on any problem.
+ */
+bool span_validate(void);
+
+#endif
@@ -12,33 +12,56 @@
  * Written by jzelenski, updated by Nick Troccoli Winter 18-19
  */
 
+#include <errno.h>
 #include <error.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "allocator.h"
+#include "alloc_trace.h"
+#include "heap_profile.h"
+#include "script.h"
 #include "segment.h"
 
 
 /* TYPE DECLARATIONS */
 
 
-// enum and struct for a single allocator request
-enum request_type {
-    ALLOC = 1,
-    FREE,
-    REALLOC
-};
+// struct for the latency of every timed request in a script, by request type
+typedef struct {
+    uint64_t *ns[REALLOC + 1];  // latencies in nanoseconds, indexed by request type
+    int count[REALLOC + 1];     // number of latencies recorded for each type
+} timing_t;
+
+// struct for the fragmentation metrics of a script, taken from myheap_stats
+// after every request and averaged over them
 typedef struct {
-    enum request_type op;   // type of request
-    int id;                 // id for free() to use later
-    size_t size;            // num bytes for alloc/realloc request
-    int lineno;             // which line in file
-} request_t;
+    uint64_t samples;           // number of requests the sums are over
+    double utilization_sum;     // payload as a fraction of the committed bytes
+    double internal_sum;        // fraction of the bytes allocated that isn't payload
+    double external_sum;        // fraction of the free bytes outside the largest free block
+    double free_blocks_sum;
+    size_t max_free_blocks;
+    size_t peak_committed;
+} heap_metrics_t;
 
 // struct for facts about a single malloc'ed block
 typedef struct {
@@ -46,37 +69,213 @@ typedef struct {
     size_t size;
 } block_t;
 
+// Bytes checked at each end of a payload, and number of interior cache lines
+// checked at random, when payloads are verified by sampling
+#define SAMPLE_EDGE_BYTES 64
+#define SAMPLE_INTERIOR_LINES 8
+#define CACHE_LINE_SIZE 64
+
+// Maximum number of levels in the skip list of live blocks
+#define INDEX_MAX_LEVEL 32
+
+// struct for one live block in the address-ordered index
+typedef struct index_node {
+    void *start;
+    void *end;
+    struct index_node *next[];  // next node at each level this node is on
+} index_node_t;
+
+// struct for a skip list of the live blocks, ordered by address
+typedef struct {
+    index_node_t *head;         // sentinel that is on every level
+    int level;                  // number of levels currently in use
+} block_index_t;
+
 // struct for info for one script file
 typedef struct {
     char name[128];     // short name of script
     request_t *ops;     // array of requests read from script
-    int num_ops;        // number of requests
-    int num_ids;        // number of distinct block ids
+    void *mapping;      // mmap'ed binary script that ops points into, or NULL
+    size_t mapping_size;
+    int num_ops;        // number of requests (in the current chunk, if streamed)
+    int num_ids;        // number of distinct block ids (so far, if streamed)
+    FILE *stream;       // file requests are read from in chunks, or NULL if all are in ops
+    bool stream_binary; // whether the stream holds binary records rather than text
+    uint64_t stream_ids; // ids a binary stream's header allows, so every record's id is below it
+    uint64_t stream_ops_left; // records a binary stream's header says are still to be read
+    int stream_lineno;  // last line read from a text stream
+    uint64_t num_serviced; // number of requests run so far
     block_t *blocks;    // array of memory blocks malloc returns when executing
+    block_index_t index; // live blocks ordered by address, for overlap checks
     size_t peak_size;   // total payload bytes at peak in-use
+    timing_t *timing;   // latencies of allocator calls, or NULL if not timing
+    heap_metrics_t *metrics; // fragmentation metrics, or NULL if not gathering them
 } script_t;
 
+// struct for the outcome of running one script, which may be in a worker process
+typedef struct {
+    bool success;
+    int utilization;    // percentage, if the script succeeded
+} script_result_t;
+
 // Amount by which we resize ops when needed when reading in from file
 const int OPS_RESIZE_AMOUNT = 500;
 
 const int MAX_SCRIPT_LINE_LEN = 1024;
 
+// Number of requests read and run at a time when streaming a script
+const int STREAM_CHUNK_OPS = 4096;
+
 const long HEAP_SIZE = 1L << 32;
 
+// Percentiles of request latency reported in timing mode
+const int LATENCY_PERCENTILES[] = {50, 90, 99};
+
+// struct for a hardware performance counter read around the benchmark loop
+typedef struct {
+    const char *name;
+    uint32_t type;      // perf_event_attr type and config of the counter
+    uint64_t config;
+} counter_t;
+
+// struct for one read of a counter, as laid out by the kernel
+typedef struct {
+    uint64_t value;
+    uint64_t enabled;   // nanoseconds the counter was enabled
+    uint64_t running;   // nanoseconds the counter was actually counting
+} counter_reading_t;
+
+#define CACHE_READ_MISSES(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// Counters reported by -p, the first of which is also reported by plain -b
+const counter_t COUNTERS[] = {
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"L1d misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#define NUM_COUNTERS (int)(sizeof(COUNTERS) / sizeof(COUNTERS[0]))
+#define INSTRUCTIONS_COUNTER 0
+
+// struct for the requests one thread replays when running on several threads
+typedef struct {
+    script_t *script;
+    int *reqs;          // indexes into script->ops of this thread's requests
+    int num_reqs;
+    int *seq;           // for each request, the number before it on the same id
+    void **ptrs;        // block pointers by id, shared by threads replaying the same script
+    int *done;          // number of requests finished on each id
+    pthread_barrier_t *start;
+    uint64_t start_ns;  // when this thread started and finished its requests
+    uint64_t end_ns;
+    bool success;
+} worker_t;
+
+// None of the allocators here are thread-safe, so threads take turns calling
+// them unless the allocator is built with ALLOCATOR_THREAD_SAFE defined
+#ifdef ALLOCATOR_THREAD_SAFE
+#define LOCK_ALLOCATOR()
+#define UNLOCK_ALLOCATOR()
+#else
+static pthread_mutex_t allocator_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_ALLOCATOR() pthread_mutex_lock(&allocator_lock)
+#define UNLOCK_ALLOCATOR() pthread_mutex_unlock(&allocator_lock)
+#endif
+
 
 /* FUNCTION PROTOTYPES */
 
 
-static int test_scripts(char *script_names[], int num_script_names, bool quiet);
+static int test_scripts(char *script_names[], int num_script_names, bool quiet, bool timing,
+    bool streaming, int jobs);
+static script_result_t test_script(const char *script_name, bool quiet, bool timing,
+    bool streaming);
+static void test_scripts_parallel(char *script_names[], int num_script_names, bool quiet,
+    bool timing, bool streaming, int jobs, script_result_t results[]);
 static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
 static script_t parse_script(const char *filename);
+static bool map_binary_script(const char *path, FILE *fp, script_t *script);
+static void check_binary_records(const char *path, const request_t ops[], size_t num_ops,
+    uint64_t num_ids);
+static void free_script(script_t *script);
+static script_t open_script_stream(const char *path);
+static bool next_chunk(script_t *script);
+static void grow_blocks(script_t *script, int id);
 static request_t parse_script_line(char *buffer, int lineno, char *script_name);
 static size_t eval_correctness(script_t *script, bool quiet, bool *success);
+static bool check_heap(script_t *script);
 static void *eval_malloc(int req, size_t requested_size, script_t *script, bool *failptr);
 static void *eval_realloc(int req, size_t requested_size, script_t *script, bool *failptr);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
+static void select_payload_checker(void);
+static bool range_intact(unsigned char *payload, size_t offset, size_t size, unsigned char byte,
+    size_t *bad_offset);
+static bool bytes_match_words(const unsigned char *ptr, size_t size, unsigned char byte);
+#if defined(__x86_64__)
+static bool bytes_match_sse2(const unsigned char *ptr, size_t size, unsigned char byte);
+static bool bytes_match_avx2(const unsigned char *ptr, size_t size, unsigned char byte);
+#endif
+static void track_block(script_t *script, int id, void *ptr, size_t size);
+static void untrack_block(script_t *script, int id);
+static void index_init(block_index_t *index);
+static void index_free(block_index_t *index);
+static index_node_t *index_search(block_index_t *index, void *ptr, index_node_t *update[]);
+static void index_insert(block_index_t *index, void *start, void *end);
+static void index_remove(block_index_t *index, void *start);
+static uint64_t now_ns(void);
+static void calibrate_timer(void);
+static void record_latency(script_t *script, enum request_type op, uint64_t start);
+static void report_timing(script_t *script);
+static int compare_latencies(const void *a, const void *b);
+static void record_metrics(script_t *script, size_t payload);
+static void report_metrics(script_t *script);
+static void write_profile(script_t *script);
+static void write_snapshot(script_t *script);
+static int bench_scripts(char *script_names[], int num_script_names, int nruns,
+    bool all_counters);
+static bool replay_script(script_t *script, void **ptrs);
+static void report_counters(int fds[], double counts[], uint64_t nops);
+static int open_counter(const counter_t *counter);
+static void read_counter(int fd, counter_reading_t *reading);
+static double counter_delta(counter_reading_t *before, counter_reading_t *after);
+static int thread_scripts(char *script_names[], int num_script_names, int max_threads,
+    bool concurrent);
+static int next_thread_count(int nthreads, int max_threads);
+static int *request_seqs(script_t *script);
+static bool run_threads(script_t *scripts, int **seqs, int nscripts, int nthreads,
+    bool concurrent, worker_t *workers, uint64_t *wall_ns);
+static void *replay_worker(void *arg);
+
+// Cost of reading the clock, subtracted from every latency measured
+static uint64_t timer_overhead = 0;
+
+// Whether payloads are verified by sampling rather than byte for byte
+static bool sample_payloads = false;
+
+// Whether fragmentation metrics are gathered and reported for each script
+static bool gather_metrics = false;
+
+// How many requests go by between full walks of the heap by validate_heap, with
+// incremental checks after the requests in between, or 0 for incremental checks only
+static int full_validate_every = 1;
+
+// Mean number of bytes between the allocations the heap profiler samples, or 0
+// if each script isn't profiled
+static size_t profile_period = 0;
+
+// How many requests go by between snapshots of the heap, or 0 if none are taken
+static uint64_t snapshot_every = 0;
+
+// Set when a thread fails, so that the others stop waiting on it
+static bool threads_failed = false;
+
+// Fastest way this machine has to check that a range holds a single byte value
+static bool (*bytes_match)(const unsigned char *ptr, size_t size, unsigned char byte) = bytes_match_words;
 
 
 /* CORRECTNESS EVALUATION IMPLEMENTATION */
@@ -84,64 +283,176 @@ static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 /* Function: main
  * --------------
- * The main function parses command-line arguments (currently only -q for quiet)
- * and any script files that follow and runs the heap allocator on the specified
- * script files.  It outputs statistics about the run of each script, such as
- * the number of successful runs, number of failures, and average utilization.
+ * The main function parses command-line arguments (-q for quiet, -t to time
+ * each allocator call, -s to verify payloads by sampling, -c to stream each
+ * script in chunks rather than loading it, -b K to benchmark, -p to read
+ * hardware counters while benchmarking, -T N to replay on up to N threads,
+ * -M to replay the scripts concurrently rather than splitting each one across
+ * the threads, -j N to run up to N scripts at once in separate processes,
+ * -f to report fragmentation metrics, -v K to check the heap incrementally
+ * after each request and walk all of it only every K requests, or never if K
+ * is 0, -H N to profile the heap, sampling an allocation every N bytes on
+ * average, and write each script's profile to <script>.heap, -R FILE to
+ * record every allocator call to a trace file for trace2script, -d N to
+ * write a snapshot of the heap for heapmap to <script>.<request>.heapdump
+ * every N requests) and any script files that follow and
+ * runs the heap allocator on the specified script files.  It
+ * outputs statistics about the run of each script, such as the number of
+ * successful runs, number of failures, and average utilization, and in timing
+ * mode the latency percentiles of each type of request and the throughput of
+ * each script.  Benchmark mode instead replays each script K times with no
+ * checking at all (-p on its own benchmarks with a single run), and threaded
+ * mode reports the throughput of the replay as the number of threads grows.
  */
 int main(int argc, char *argv[]) {
     // Parse command line arguments
     char c;
     bool quiet = false;
-    while ((c = getopt(argc, argv, "q")) != EOF) {
+    bool timing = false;
+    int bench_runs = 0;
+    bool all_counters = false;
+    bool streaming = false;
+    int max_threads = 0;
+    bool concurrent = false;
+    int jobs = 1;
+    const char *trace_path = NULL;
+    while ((c = getopt(argc, argv, "qtscb:pT:Mj:fv:H:R:d:")) != EOF) {
         if (c == 'q') {
             quiet = true;
+        } else if (c == 't') {
+            timing = true;
+        } else if (c == 's') {
+            sample_payloads = true;
+        } else if (c == 'c') {
+            streaming = true;
+        } else if (c == 'b') {
+            bench_runs = atoi(optarg);
+            if (bench_runs <= 0) {
+                error(1, 0, "The number of benchmark runs must be positive.");
+            }
+        } else if (c == 'p') {
+            all_counters = true;
+        } else if (c == 'T') {
+            max_threads = atoi(optarg);
+            if (max_threads <= 0) {
+                error(1, 0, "The number of threads must be positive.");
+            }
+        } else if (c == 'M') {
+            concurrent = true;
+        } else if (c == 'f') {
+            gather_metrics = true;
+        } else if (c == 'v') {
+            full_validate_every = atoi(optarg);
+            if (full_validate_every < 0) {
+                error(1, 0, "The number of requests between full heap checks can't be negative.");
+            }
+        } else if (c == 'H') {
+            profile_period = strtoul(optarg, NULL, 10);
+            if (profile_period == 0) {
+                error(1, 0, "The heap profile's sample period must be positive.");
+            }
+        } else if (c == 'R') {
+            trace_path = optarg;
+        } else if (c == 'd') {
+            snapshot_every = strtoull(optarg, NULL, 10);
+            if (snapshot_every == 0) {
+                error(1, 0, "The number of requests between heap snapshots must be positive.");
+            }
+        } else if (c == 'j') {
+            jobs = atoi(optarg);
+            if (jobs <= 0) {
+                error(1, 0, "The number of jobs must be positive.");
+            }
         }
     }
     if (optind >= argc) {
         error(1, 0, "Missing argument. Please supply one or more script files.");
     }
+    if (streaming && timing) {
+        error(1, 0, "Timing needs every request in memory, so it can't be used with -c.");
+    }
 
     // disable stdout buffering, all printfs display to terminal immediately
     setvbuf(stdout, NULL, _IONBF, 0);
     
-    return test_scripts(argv + optind, argc - optind, quiet);
+    if (all_counters && bench_runs == 0) {
+        bench_runs = 1;
+    }
+
+    if (concurrent && max_threads == 0) {
+        error(1, 0, "-M runs the scripts on threads, so it needs -T.");
+    }
+
+    // the trace is recorded by a thread of this process, which workers don't have
+    if (trace_path != NULL && jobs > 1) {
+        error(1, 0, "-R records the calls of a single process, so it can't be used with -j.");
+    }
+    if (trace_path != NULL && !trace_start(trace_path)) {
+        error(1, errno, "Could not start recording a trace to \"%s\"", trace_path);
+    }
+
+    int nfailures;
+    if (max_threads > 0) {
+        nfailures = thread_scripts(argv + optind, argc - optind, max_threads, concurrent);
+    } else if (bench_runs > 0) {
+        nfailures = bench_scripts(argv + optind, argc - optind, bench_runs, all_counters);
+    } else {
+        if (timing) {
+            calibrate_timer();
+        }
+        select_payload_checker();
+        nfailures = test_scripts(argv + optind, argc - optind, quiet, timing, streaming, jobs);
+    }
+
+    if (trace_path != NULL && !trace_stop()) {
+        error(1, 0, "Could not record the whole trace to \"%s\".", trace_path);
+    }
+    return nfailures;
 }
 
 /* Function: test_scripts
  * ----------------------
  * Runs the scripts with names in the specified array, with more or less output
- * depending on the value of `quiet`.  Returns the number of failures during all
- * the tests.
+ * depending on the value of `quiet`, timing each allocator call if `timing` is
+ * set and reading each script a chunk at a time if `streaming` is set.  If
+ * `jobs` is more than 1, up to that many scripts are run at once in separate
+ * processes, and their output is printed in the same order as it would be
+ * otherwise.  Returns the number of failures during all the tests.
  */
-static int test_scripts(char *script_names[], int num_script_names, bool quiet) {
+static int test_scripts(char *script_names[], int num_script_names, bool quiet, bool timing,
+    bool streaming, int jobs) {
     int nsuccesses = 0;
     int nfailures = 0;
 
     // Utilization summed across all successful script runs (each is % out of 100)
     int total_util = 0;
 
-    for (int i = 0; i < num_script_names; i++) {
-        script_t script = parse_script(script_names[i]);
+    // worker processes write their results where the parent can see them
+    size_t results_size = num_script_names * sizeof(script_result_t);
+    script_result_t *results = mmap(NULL, results_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        error(1, 0, "Could not map memory for the results of the scripts.");
+    }
 
-        // Evaluate this script and record the results
-        printf("\nEvaluating allocator on %s...", script.name);
-        bool success;
-        size_t used_segment = eval_correctness(&script, quiet, &success);
-        if (success) {
-            printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
-                script.num_ops, script.peak_size, used_segment);
-            if (used_segment > 0) {
-                total_util += (100 * script.peak_size) / used_segment;
-            }
+    if (jobs > 1) {
+        test_scripts_parallel(script_names, num_script_names, quiet, timing, streaming, jobs,
+            results);
+    } else {
+        for (int i = 0; i < num_script_names; i++) {
+            results[i] = test_script(script_names[i], quiet, timing, streaming);
+        }
+    }
+
+    for (int i = 0; i < num_script_names; i++) {
+        if (results[i].success) {
+            total_util += results[i].utilization;
             nsuccesses++;
         } else {
             nfailures++;
         }
-
-        free(script.ops);
-        free(script.blocks);
     }
+    munmap(results, results_size);
 
     if (nsuccesses) {
         printf("\nUtilization averaged %d%%\n", total_util / nsuccesses);
@@ -149,12 +460,145 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
     return nfailures;
 }
 
+/* Function: test_script
+ * ---------------------
+ * Runs the script at the specified path, as described for test_scripts, and
+ * returns whether it succeeded and, if so, the utilization it achieved.
+ */
+static script_result_t test_script(const char *script_name, bool quiet, bool timing,
+    bool streaming) {
+    script_result_t result = { .success = false, .utilization = 0 };
+    script_t script = streaming ? open_script_stream(script_name) :
+        parse_script(script_name);
+
+    timing_t timing_data;
+    if (timing) {
+        for (int op = ALLOC; op <= REALLOC; op++) {
+            timing_data.ns[op] = malloc(script.num_ops * sizeof(uint64_t));
+            timing_data.count[op] = 0;
+            if (!timing_data.ns[op]) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        script.timing = &timing_data;
+    }
+
+    heap_metrics_t metrics = { .samples = 0 };
+    if (gather_metrics) {
+        script.metrics = &metrics;
+    }
+
+    if (profile_period > 0 && !heap_profile_start(profile_period)) {
+        error(1, 0, "Could not start the heap profiler.");
+    }
+
+    // Evaluate this script and record the results
+    printf("\nEvaluating allocator on %s...", script.name);
+    size_t used_segment = eval_correctness(&script, quiet, &result.success);
+    if (result.success) {
+        printf("successfully serviced %lu requests. (payload/segment = %zu/%zu)", 
+            script.num_serviced, script.peak_size, used_segment);
+        if (used_segment > 0) {
+            result.utilization = (100 * script.peak_size) / used_segment;
+        }
+        if (timing) {
+            report_timing(&script);
+        }
+        if (gather_metrics) {
+            report_metrics(&script);
+        }
+    }
+    if (profile_period > 0) {
+        write_profile(&script);
+    }
+
+    if (timing) {
+        for (int op = ALLOC; op <= REALLOC; op++) {
+            free(timing_data.ns[op]);
+        }
+    }
+    free_script(&script);
+    return result;
+}
+
+/* Function: test_scripts_parallel
+ * -------------------------------
+ * Runs each script in a worker process of its own, with up to `jobs` of them
+ * at a time.  Each worker has its own heap segment, since segment.c keeps it
+ * in a global, and writes its output to a temporary file and its result to
+ * `results`, which is shared with the workers.  Output is printed in script
+ * order as soon as every script before it has finished.  A worker that
+ * crashes is counted as a failure.
+ */
+static void test_scripts_parallel(char *script_names[], int num_script_names, bool quiet,
+    bool timing, bool streaming, int jobs, script_result_t results[]) {
+    FILE **outputs = malloc(num_script_names * sizeof(FILE *));
+    pid_t *pids = malloc(num_script_names * sizeof(pid_t));
+    bool *finished = calloc(num_script_names, sizeof(bool));
+    if (!outputs || !pids || !finished) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    int nstarted = 0, nprinted = 0, nrunning = 0;
+    while (nprinted < num_script_names) {
+        for (; nrunning < jobs && nstarted < num_script_names; nstarted++, nrunning++) {
+            int i = nstarted;
+            results[i] = (script_result_t){ .success = false, .utilization = 0 };
+            outputs[i] = tmpfile();
+            if (outputs[i] == NULL) {
+                error(1, 0, "Could not create a file for the output of %s.", script_names[i]);
+            }
+
+            pids[i] = fork();
+            if (pids[i] < 0) {
+                error(1, 0, "Could not start a worker process.");
+            } else if (pids[i] == 0) {
+                dup2(fileno(outputs[i]), STDOUT_FILENO);
+                results[i] = test_script(script_names[i], quiet, timing, streaming);
+                _exit(0);
+            }
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            error(1, 0, "Lost track of the worker processes.");
+        }
+        nrunning--;
+        for (int i = 0; i < nstarted; i++) {
+            if (pids[i] == pid) {
+                finished[i] = true;
+                if (WIFSIGNALED(status)) {
+                    results[i].success = false;
+                    fprintf(outputs[i], "\nWorker for %s was killed by signal %d (%s).",
+                        script_names[i], WTERMSIG(status), strsignal(WTERMSIG(status)));
+                }
+            }
+        }
+
+        for (; nprinted < nstarted && finished[nprinted]; nprinted++) {
+            char buffer[BUFSIZ];
+            size_t nread;
+            rewind(outputs[nprinted]);
+            while ((nread = fread(buffer, 1, sizeof(buffer), outputs[nprinted])) > 0) {
+                fwrite(buffer, 1, nread, stdout);
+            }
+            fclose(outputs[nprinted]);
+        }
+    }
+
+    free(outputs);
+    free(pids);
+    free(finished);
+}
+
 /* Function: eval_correctness
  * --------------------------
  * Check the allocator for correctness on given script. Interprets the
  * script operation-by-operation and reports if it detects any "obvious"
  * errors (returning blocks outside the heap, unaligned, 
- * overlapping blocks, etc.)
+ * overlapping blocks, etc.)  A streamed script is run a chunk at a time, and
+ * the peak payload and topmost address are tracked as it goes.
  */
 static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     *success = false;
@@ -177,56 +621,66 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     size_t cur_size = 0;
 
     // Send each request to the heap allocator and check the resulting behavior
-    for (int req = 0; req < script->num_ops; req++) {
-        int id = script->ops[req].id;
-        size_t requested_size = script->ops[req].size;
-
-        if (script->ops[req].op == ALLOC) {
-            bool fail = false;
-            void *p = eval_malloc(req, requested_size, script, &fail);
-            if (fail) {
-                return -1;
+    while (next_chunk(script)) {
+        for (int req = 0; req < script->num_ops; req++) {
+            int id = script->ops[req].id;
+            size_t requested_size = script->ops[req].size;
+            grow_blocks(script, id);
+            script->num_serviced++;
+
+            if (script->ops[req].op == ALLOC) {
+                bool fail = false;
+                void *p = eval_malloc(req, requested_size, script, &fail);
+                if (fail) {
+                    return -1;
+                }
+
+                cur_size += requested_size;
+                if ((char *)p + requested_size > (char *)heap_end) {
+                    heap_end = (char *)p + requested_size;
+                }
+            } else if (script->ops[req].op == REALLOC) {
+                size_t old_size = script->blocks[id].size;
+                bool fail = false;
+                void *p = eval_realloc(req, requested_size, script, &fail);
+                if (fail) {
+                    return -1;
+                }
+
+                cur_size += (requested_size - old_size);
+                if ((char *)p + requested_size > (char *)heap_end) {
+                    heap_end = (char *)p + requested_size;
+                }
+            } else if (script->ops[req].op == FREE || script->ops[req].op == REMOTE_FREE) {
+                size_t old_size = script->blocks[id].size;
+                void *p = script->blocks[id].ptr;
+
+                // verify payload intact before free
+                if (!verify_payload(p, old_size, id, script, 
+                    script->ops[req].lineno, "freeing")) {
+                    return -1;
+                }
+                untrack_block(script, id);
+                uint64_t start = now_ns();
+                myfree(p);
+                record_latency(script, FREE, start);
+                cur_size -= old_size;
             }
 
-            cur_size += requested_size;
-            if ((char *)p + requested_size > (char *)heap_end) {
-                heap_end = (char *)p + requested_size;
-            }
-        } else if (script->ops[req].op == REALLOC) {
-            size_t old_size = script->blocks[id].size;
-            bool fail = false;
-            void *p = eval_realloc(req, requested_size, script, &fail);
-            if (fail) {
+            // check heap consistency after each request and stop if any error
+            if (!quiet && !check_heap(script)) {
+                allocator_error(script, script->ops[req].lineno, 
+                    "validate_heap() returned false, called in-between requests");
                 return -1;
             }
 
-            cur_size += (requested_size - old_size);
-            if ((char *)p + requested_size > (char *)heap_end) {
-                heap_end = (char *)p + requested_size;
+            if (cur_size > script->peak_size) {
+                script->peak_size = cur_size;
             }
-        } else if (script->ops[req].op == FREE) {
-            size_t old_size = script->blocks[id].size;
-            void *p = script->blocks[id].ptr;
-
-            // verify payload intact before free
-            if (!verify_payload(p, old_size, id, script, 
-                script->ops[req].lineno, "freeing")) {
-                return -1;
+            record_metrics(script, cur_size);
+            if (snapshot_every > 0 && script->num_serviced % snapshot_every == 0) {
+                write_snapshot(script);
             }
-            script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
-            myfree(p);
-            cur_size -= old_size;
-        }
-
-        // check heap consistency after each request and stop if any error
-        if (!quiet && !validate_heap()) {
-            allocator_error(script, script->ops[req].lineno, 
-                "validate_heap() returned false, called in-between requests");
-            return -1;
-        }
-
-        if (cur_size > script->peak_size) {
-            script->peak_size = cur_size;
         }
     }
 
@@ -242,6 +696,21 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     return (char *)heap_end - (char *)heap_segment_start();
 }
 
+/* Function: check_heap
+ * ---------------------
+ * Checks the heap's consistency after a request.  This is a full walk by
+ * validate_heap, unless -v asked for those only every so many requests, in
+ * which case the requests in between get the allocator's incremental check,
+ * which costs about the same however big the heap has grown.
+ */
+static bool check_heap(script_t *script) {
+    if (full_validate_every == 1 ||
+        (full_validate_every > 1 && script->num_serviced % full_validate_every == 0)) {
+        return validate_heap();
+    }
+    return validate_heap_level(VALIDATE_INCREMENTAL);
+}
+
 /* Function: eval_malloc
  * ---------------------
  * Performs a test of a call to mymalloc of the given size.  The req number
@@ -257,8 +726,10 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
 
     int id = script->ops[req].id;
 
-    void *p;
-    if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
+    uint64_t start = now_ns();
+    void *p = mymalloc(requested_size);
+    record_latency(script, ALLOC, start);
+    if (p == NULL && requested_size != 0) {
         allocator_error(script, script->ops[req].lineno, 
             "heap exhausted, malloc returned NULL");
         *failptr = true;
@@ -277,7 +748,7 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
      * can be used later to verify data copied when realloc'ing.
      */
     memset(p, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+    track_block(script, id, p, requested_size);
     *failptr = false;
     return p;
 }
@@ -305,15 +776,17 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
         return NULL;
     }
 
-    void *newp;
-    if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
+    uint64_t start = now_ns();
+    void *newp = myrealloc(oldp, requested_size);
+    record_latency(script, REALLOC, start);
+    if (newp == NULL && requested_size != 0) {
         allocator_error(script, script->ops[req].lineno, 
             "heap exhausted, realloc returned NULL");
         *failptr = true;
         return NULL;
     }
 
-    script->blocks[id].size = 0;
+    untrack_block(script, id);
     if (!verify_block(newp, requested_size, script, script->ops[req].lineno)) {
         *failptr = true;
         return NULL;
@@ -328,7 +801,7 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
 
     // Fill new block with the low-order byte of new id
     memset(newp, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = newp, .size = requested_size};
+    track_block(script, id, newp, requested_size);
 
     *failptr = false;
     return newp;
@@ -343,6 +816,8 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
  *  -- verify block address is correctly aligned
  *  -- verify block address is within heap segment
  *  -- verify block address + size doesn't overlap any existing allocated block
+ * Live blocks never overlap each other, so only the blocks just before and
+ * just after the new block in address order need to be checked.
  */
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
     // address must be ALIGNMENT-byte aligned
@@ -365,20 +840,26 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
         return false;
     }
 
-    // block must not overlap any other blocks
-    for (int i = 0; i < script->num_ids; i++) {
-        if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) {
-            continue;
-        }
+    if (size == 0) {
+        return true;
+    }
 
-        void *other_start = script->blocks[i].ptr;
-        void *other_end = (char *)other_start + script->blocks[i].size;
-        if ((ptr >= other_start && ptr < other_end) || (end > other_start && end < other_end) ||
-            (ptr < other_start && end >= other_end)) {
-            allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
-                            ptr, end, other_start, other_end);
-            return false;
-        }
+    // block must not overlap the blocks on either side of it
+    index_node_t *update[INDEX_MAX_LEVEL];
+    index_node_t *before = index_search(&script->index, ptr, update);
+    index_node_t *after = before->next[0];
+
+    index_node_t *other = NULL;
+    if (before != script->index.head && before->end > ptr) {
+        other = before;
+    } else if (after != NULL && after->start < end) {
+        other = after;
+    }
+
+    if (other != NULL) {
+        allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
+                        ptr, end, other->start, other->end);
+        return false;
     }
 
     return true;
@@ -388,21 +869,143 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
  * ------------------------
  * When a block is allocated, the payload is filled with a simple repeating
  * pattern based on its id.  Check the payload to verify those contents are
- * still intact, otherwise raise allocator error.
+ * still intact, otherwise raise allocator error.  In sampled mode only the
+ * head, the tail and a few random cache lines in between are checked.
  */
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, 
     int lineno, char *op) {
 
-    for (size_t i = 0; i < size; i++) {
-        if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
-            allocator_error(script, lineno, 
-                "invalid payload data detected when %s address %p", op, ptr);
+    unsigned char *payload = ptr;
+    unsigned char byte = id & 0xFF;
+    size_t bad_offset;
+    bool intact;
+
+    if (!sample_payloads || size <= 2 * SAMPLE_EDGE_BYTES + SAMPLE_INTERIOR_LINES * CACHE_LINE_SIZE) {
+        intact = range_intact(payload, 0, size, byte, &bad_offset);
+    } else {
+        intact = range_intact(payload, 0, SAMPLE_EDGE_BYTES, byte, &bad_offset) &&
+            range_intact(payload, size - SAMPLE_EDGE_BYTES, SAMPLE_EDGE_BYTES, byte, &bad_offset);
+
+        // pick interior lines at random, so repeated checks cover different lines
+        size_t interior_lines = (size - 2 * SAMPLE_EDGE_BYTES) / CACHE_LINE_SIZE;
+        for (int i = 0; i < SAMPLE_INTERIOR_LINES && intact; i++) {
+            size_t offset = SAMPLE_EDGE_BYTES + (rand() % interior_lines) * CACHE_LINE_SIZE;
+            intact = range_intact(payload, offset, CACHE_LINE_SIZE, byte, &bad_offset);
+        }
+    }
+
+    if (!intact) {
+        allocator_error(script, lineno,
+            "invalid payload data detected when %s address %p (first bad byte at offset %zu)",
+            op, ptr, bad_offset);
+        return false;
+    }
+    return true;
+}
+
+/* Function: range_intact
+ * ----------------------
+ * Returns whether every byte of the payload in [offset, offset + size) holds
+ * the given value.  The range is checked with the fastest checker available,
+ * and only if that fails is it scanned byte by byte to find the offset of the
+ * first bad byte within the payload.
+ */
+static bool range_intact(unsigned char *payload, size_t offset, size_t size, unsigned char byte,
+    size_t *bad_offset) {
+    if (bytes_match(payload + offset, size, byte)) {
+        return true;
+    }
+
+    for (*bad_offset = offset; *bad_offset < offset + size && payload[*bad_offset] == byte;
+        (*bad_offset)++);
+    return false;
+}
+
+/* Function: select_payload_checker
+ * --------------------------------
+ * Picks the widest comparison this CPU supports for checking payloads,
+ * AVX2 or SSE2 on x86-64 and whole words everywhere else.
+ */
+static void select_payload_checker(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    bytes_match = __builtin_cpu_supports("avx2") ? bytes_match_avx2 : bytes_match_sse2;
+#endif
+}
+
+/* Function: bytes_match_words
+ * ---------------------------
+ * Returns whether every byte of the range holds the given value, comparing
+ * a word at a time once the range is word-aligned.
+ */
+static bool bytes_match_words(const unsigned char *ptr, size_t size, unsigned char byte) {
+    size_t i = 0;
+    for (; i < size && ((uintptr_t)(ptr + i) % sizeof(uint64_t)) != 0; i++) {
+        if (ptr[i] != byte) {
+            return false;
+        }
+    }
+
+    uint64_t pattern = 0x0101010101010101ULL * byte;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        if (*(const uint64_t *)(ptr + i) != pattern) {
+            return false;
+        }
+    }
+
+    for (; i < size; i++) {
+        if (ptr[i] != byte) {
             return false;
         }
     }
     return true;
 }
 
+#if defined(__x86_64__)
+/* Function: bytes_match_sse2
+ * --------------------------
+ * Returns whether every byte of the range holds the given value, comparing
+ * 64 bytes per iteration with SSE2 and finishing off the tail by words.
+ */
+static bool bytes_match_sse2(const unsigned char *ptr, size_t size, unsigned char byte) {
+    __m128i pattern = _mm_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i)), pattern);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i + 16)), pattern);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i + 32)), pattern);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(ptr + i + 48)), pattern);
+        __m128i all = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+        if (_mm_movemask_epi8(all) != 0xFFFF) {
+            return false;
+        }
+    }
+    return bytes_match_words(ptr + i, size - i, byte);
+}
+
+/* Function: bytes_match_avx2
+ * --------------------------
+ * Returns whether every byte of the range holds the given value, comparing
+ * 128 bytes per iteration with AVX2 and finishing off the tail by words.
+ */
+__attribute__((target("avx2")))
+static bool bytes_match_avx2(const unsigned char *ptr, size_t size, unsigned char byte) {
+    __m256i pattern = _mm256_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + i)), pattern);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + i + 32)), pattern);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + i + 64)), pattern);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(ptr + i + 96)), pattern);
+        __m256i all = _mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d));
+        if (_mm256_movemask_epi8(all) != -1) {
+            return false;
+        }
+    }
+    return bytes_match_words(ptr + i, size - i, byte);
+}
+#endif
+
 /* Function: allocator_error
  * ------------------------
  * Report an error while running an allocator script.  Prints out the script
@@ -420,6 +1023,800 @@ static void allocator_error(script_t *script, int lineno, char* format, ...) {
 }
 
 
+/* BLOCK INDEX IMPLEMENTATION */
+
+
+/* Function: track_block
+ * ---------------------
+ * Records that block `id` now lives at ptr with the given size, adding it to
+ * the address-ordered index unless it is empty.
+ */
+static void track_block(script_t *script, int id, void *ptr, size_t size) {
+    script->blocks[id] = (block_t){.ptr = ptr, .size = size};
+    if (ptr != NULL && size > 0) {
+        index_insert(&script->index, ptr, (char *)ptr + size);
+    }
+}
+
+/* Function: untrack_block
+ * -----------------------
+ * Removes block `id` from the address-ordered index, and records it as
+ * having no size.  Its old address is kept for the caller.
+ */
+static void untrack_block(script_t *script, int id) {
+    if (script->blocks[id].ptr != NULL && script->blocks[id].size > 0) {
+        index_remove(&script->index, script->blocks[id].ptr);
+    }
+    script->blocks[id].size = 0;
+}
+
+/* Function: index_init
+ * --------------------
+ * Sets up an empty index, whose sentinel head node is on every level.
+ */
+static void index_init(block_index_t *index) {
+    index->head = calloc(1, sizeof(index_node_t) + INDEX_MAX_LEVEL * sizeof(index_node_t *));
+    if (!index->head) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    index->level = 1;
+}
+
+/* Function: index_free
+ * --------------------
+ * Frees every node of the index, including its head.
+ */
+static void index_free(block_index_t *index) {
+    index_node_t *curr = index->head;
+    while (curr != NULL) {
+        index_node_t *next = curr->next[0];
+        free(curr);
+        curr = next;
+    }
+    index->head = NULL;
+}
+
+/* Function: index_search
+ * ----------------------
+ * Returns the last node that starts at or before ptr (the head if there is
+ * none), and fills in update with the last node before ptr on each level.
+ */
+static index_node_t *index_search(block_index_t *index, void *ptr, index_node_t *update[]) {
+    index_node_t *curr = index->head;
+    for (int level = index->level - 1; level >= 0; level--) {
+        while (curr->next[level] != NULL && curr->next[level]->start < ptr) {
+            curr = curr->next[level];
+        }
+        update[level] = curr;
+    }
+
+    // step onto a node that starts exactly at ptr
+    if (curr->next[0] != NULL && curr->next[0]->start == ptr) {
+        curr = curr->next[0];
+    }
+    return curr;
+}
+
+/* Function: index_insert
+ * ----------------------
+ * Adds the block [start, end) to the index, on a random number of levels
+ * where each level is half as likely as the one below it.
+ */
+static void index_insert(block_index_t *index, void *start, void *end) {
+    index_node_t *update[INDEX_MAX_LEVEL];
+    index_search(index, start, update);
+
+    int level = 1;
+    while (level < INDEX_MAX_LEVEL && (rand() & 1)) {
+        level++;
+    }
+    for (int i = index->level; i < level; i++) {
+        update[i] = index->head;
+    }
+    if (level > index->level) {
+        index->level = level;
+    }
+
+    index_node_t *node = malloc(sizeof(index_node_t) + level * sizeof(index_node_t *));
+    if (!node) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    node->start = start;
+    node->end = end;
+    for (int i = 0; i < level; i++) {
+        node->next[i] = update[i]->next[i];
+        update[i]->next[i] = node;
+    }
+}
+
+/* Function: index_remove
+ * ----------------------
+ * Removes the block starting at start from the index, if there is one.
+ */
+static void index_remove(block_index_t *index, void *start) {
+    index_node_t *update[INDEX_MAX_LEVEL];
+    index_node_t *node = index_search(index, start, update);
+    if (node == index->head || node->start != start) {
+        return;
+    }
+
+    for (int i = 0; i < index->level && update[i]->next[i] == node; i++) {
+        update[i]->next[i] = node->next[i];
+    }
+    while (index->level > 1 && index->head->next[index->level - 1] == NULL) {
+        index->level--;
+    }
+    free(node);
+}
+
+
+/* TIMING IMPLEMENTATION */
+
+
+/* Function: now_ns
+ * ----------------
+ * Returns the current time of the monotonic clock in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Function: calibrate_timer
+ * -------------------------
+ * Measures the cost of reading the clock twice in a row, taking the fastest
+ * of many tries, so that it can be taken off every latency we record.
+ */
+static void calibrate_timer(void) {
+    timer_overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = now_ns();
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed < timer_overhead) {
+            timer_overhead = elapsed;
+        }
+    }
+}
+
+/* Function: record_latency
+ * ------------------------
+ * Records the time since `start` as the latency of a request of the given
+ * type, if the script is being timed.
+ */
+static void record_latency(script_t *script, enum request_type op, uint64_t start) {
+    if (script->timing == NULL) {
+        return;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    elapsed = (elapsed > timer_overhead) ? elapsed - timer_overhead : 0;
+    script->timing->ns[op][script->timing->count[op]++] = elapsed;
+}
+
+/* Function: report_timing
+ * -----------------------
+ * Prints the latency percentiles and worst case for each type of request in
+ * the script, and the number of requests serviced per second of time spent
+ * in the allocator.
+ */
+static void report_timing(script_t *script) {
+    static const char *op_names[] = {
+        [ALLOC] = "mymalloc", [FREE] = "myfree", [REALLOC] = "myrealloc"
+    };
+
+    uint64_t total_ns = 0;
+    int total_ops = 0;
+
+    for (int op = ALLOC; op <= REALLOC; op++) {
+        uint64_t *ns = script->timing->ns[op];
+        int count = script->timing->count[op];
+        if (count == 0) {
+            continue;
+        }
+
+        qsort(ns, count, sizeof(uint64_t), compare_latencies);
+
+        printf("\n  %-10s %7d calls:", op_names[op], count);
+        for (int i = 0; i < sizeof(LATENCY_PERCENTILES) / sizeof(LATENCY_PERCENTILES[0]); i++) {
+            // nearest-rank percentile
+            int rank = (LATENCY_PERCENTILES[i] * count + 99) / 100;
+            printf(" p%d %6luns", LATENCY_PERCENTILES[i], ns[rank - 1]);
+        }
+        printf(" max %6luns", ns[count - 1]);
+
+        for (int i = 0; i < count; i++) {
+            total_ns += ns[i];
+        }
+        total_ops += count;
+    }
+
+    if (total_ns > 0) {
+        printf("\n  %.0f ops/sec in the allocator", total_ops * 1e9 / total_ns);
+    }
+}
+
+/* Function: compare_latencies
+ * ---------------------------
+ * qsort comparison function for sorting latencies in increasing order.
+ */
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* FRAGMENTATION METRICS IMPLEMENTATION */
+
+
+/* Function: record_metrics
+ * ------------------------
+ * Reads the allocator's statistics after a request and adds this moment's
+ * utilization and fragmentation to the script's running sums, if metrics
+ * are being gathered.  The statistics are kept by the allocator as it goes,
+ * so this is cheap enough to do after every request.  Allocators may only
+ * know the largest free block to within a factor of two, in which case
+ * external fragmentation errs on the high side.
+ */
+static void record_metrics(script_t *script, size_t payload) {
+    heap_metrics_t *metrics = script->metrics;
+    if (metrics == NULL) {
+        return;
+    }
+
+    heap_stats_t stats;
+    myheap_stats(&stats);
+
+    size_t allocated = stats.live_bytes;
+    size_t largest_free = stats.largest_free_bytes;
+    if (largest_free > stats.free_bytes) {
+        largest_free = stats.free_bytes;
+    }
+
+    if (stats.committed_bytes > 0) {
+        metrics->utilization_sum += (double)payload / stats.committed_bytes;
+    }
+    if (allocated > payload) {
+        metrics->internal_sum += (double)(allocated - payload) / allocated;
+    }
+    if (stats.free_bytes > 0) {
+        metrics->external_sum += 1 - (double)largest_free / stats.free_bytes;
+    }
+    metrics->free_blocks_sum += stats.free_blocks;
+    if (stats.free_blocks > metrics->max_free_blocks) {
+        metrics->max_free_blocks = stats.free_blocks;
+    }
+    if (stats.committed_bytes > metrics->peak_committed) {
+        metrics->peak_committed = stats.committed_bytes;
+    }
+    metrics->samples++;
+}
+
+/* Function: report_metrics
+ * ------------------------
+ * Prints the fragmentation metrics gathered for a script, each averaged over
+ * its requests, so that a heap that stays fragmented for long counts for
+ * more than one that is briefly fragmented.
+ */
+static void report_metrics(script_t *script) {
+    heap_metrics_t *metrics = script->metrics;
+    if (metrics->samples == 0) {
+        return;
+    }
+
+    double n = metrics->samples;
+    printf("\n  time-weighted utilization %.0f%%, peak committed %zu bytes (%zu pages)",
+        100 * metrics->utilization_sum / n, metrics->peak_committed,
+        (metrics->peak_committed + getpagesize() - 1) / getpagesize());
+    printf("\n  internal fragmentation %.0f%%, external fragmentation %.0f%%",
+        100 * metrics->internal_sum / n, 100 * metrics->external_sum / n);
+    printf("\n  free blocks %.1f on average, %zu at most", metrics->free_blocks_sum / n,
+        metrics->max_free_blocks);
+}
+
+
+/* Function: write_profile
+ * -----------------------
+ * Stops the heap profiler and writes its profile of the script to
+ * <script>.heap in the current directory, for pprof to read.  The live part
+ * of the profile is the blocks the script hadn't freed by its end (or by the
+ * request that failed).
+ */
+static void write_profile(script_t *script) {
+    heap_profile_stop();
+
+    char path[sizeof(script->name) + sizeof(".heap")];
+    snprintf(path, sizeof(path), "%s.heap", script->name);
+    FILE *out = fopen(path, "w");
+    if (out == NULL || !heap_profile_dump(out)) {
+        printf("\n  could not write the heap profile to %s", path);
+    } else {
+        printf("\n  heap profile written to %s", path);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+}
+
+/* Function: write_snapshot
+ * ------------------------
+ * Writes a snapshot of the heap as it stands after the requests serviced so
+ * far to <script>.<request>.heapdump, for heapmap to draw.
+ */
+static void write_snapshot(script_t *script) {
+    char path[sizeof(script->name) + sizeof(".18446744073709551615.heapdump")];
+    snprintf(path, sizeof(path), "%s.%lu.heapdump", script->name, script->num_serviced);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !mydump_heap_binary(fd)) {
+        printf("\n  could not write a heap snapshot to %s", path);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+/* BENCHMARK IMPLEMENTATION */
+
+
+/* Function: bench_scripts
+ * -----------------------
+ * Parses each script once and replays it `nruns` times with no validation,
+ * payload filling or checking, so that only the allocator is measured.  The
+ * heap is reset before each run, outside of the measured region.  Reports the
+ * time and, where hardware counters are permitted, the instructions spent in
+ * the allocator per request.  If `all_counters` is set, every counter in
+ * COUNTERS is read around the replay loop and reported per request for each
+ * script and for all of the scripts together.  Returns the number of scripts
+ * that failed.
+ */
+static int bench_scripts(char *script_names[], int num_script_names, int nruns,
+    bool all_counters) {
+    int nfailures = 0;
+
+    // the instruction count is always reported, the rest only when asked for
+    int fds[NUM_COUNTERS];
+    bool any_unavailable = false;
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        fds[c] = (c == INSTRUCTIONS_COUNTER || all_counters) ? open_counter(&COUNTERS[c]) : -1;
+        if (fds[c] < 0 && (c == INSTRUCTIONS_COUNTER || all_counters)) {
+            any_unavailable = true;
+        }
+    }
+
+    uint64_t all_ops = 0;
+    uint64_t all_ns = 0;
+    double all_counts[NUM_COUNTERS] = {0};
+
+    for (int i = 0; i < num_script_names; i++) {
+        script_t script = parse_script(script_names[i]);
+        void **ptrs = malloc(script.num_ids * sizeof(void *));
+        if (!ptrs) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+
+        printf("\nBenchmarking allocator on %s (%d runs)...", script.name, nruns);
+
+        uint64_t total_ns = 0;
+        double counts[NUM_COUNTERS] = {0};
+        bool success = true;
+
+        for (int run = 0; run < nruns && success; run++) {
+            init_heap_segment(HEAP_SIZE);
+            if (!myinit(heap_segment_start(), heap_segment_size())) {
+                allocator_error(&script, 0, "myinit() returned false");
+                success = false;
+                break;
+            }
+            memset(ptrs, 0, script.num_ids * sizeof(void *));
+
+            counter_reading_t before[NUM_COUNTERS];
+            counter_reading_t after[NUM_COUNTERS];
+            for (int c = 0; c < NUM_COUNTERS; c++) {
+                read_counter(fds[c], &before[c]);
+            }
+            uint64_t start = now_ns();
+            success = replay_script(&script, ptrs);
+            total_ns += now_ns() - start;
+            for (int c = 0; c < NUM_COUNTERS; c++) {
+                read_counter(fds[c], &after[c]);
+                counts[c] += counter_delta(&before[c], &after[c]);
+            }
+        }
+
+        if (success) {
+            uint64_t total_ops = (uint64_t)script.num_ops * nruns;
+            printf("serviced %lu requests in %.3f ms (%.1f ns/op", total_ops,
+                total_ns / 1e6, (double)total_ns / total_ops);
+            if (fds[INSTRUCTIONS_COUNTER] >= 0) {
+                printf(", %.1f instructions/op", counts[INSTRUCTIONS_COUNTER] / total_ops);
+            }
+            printf(")");
+            if (all_counters) {
+                report_counters(fds, counts, total_ops);
+            }
+
+            all_ops += total_ops;
+            all_ns += total_ns;
+            for (int c = 0; c < NUM_COUNTERS; c++) {
+                all_counts[c] += counts[c];
+            }
+        } else {
+            nfailures++;
+        }
+
+        free(ptrs);
+        free_script(&script);
+    }
+
+    if (all_counters && all_ops > 0) {
+        printf("\nAll scripts: %lu requests in %.3f ms (%.1f ns/op)", all_ops,
+            all_ns / 1e6, (double)all_ns / all_ops);
+        report_counters(fds, all_counts, all_ops);
+    }
+
+    if (any_unavailable) {
+        printf("\n(some hardware counters are unavailable or not permitted)");
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (fds[c] >= 0) {
+            close(fds[c]);
+        }
+    }
+    printf("\n");
+    return nfailures;
+}
+
+/* Function: replay_script
+ * -----------------------
+ * Sends every request in the script to the allocator, keeping the returned
+ * pointers in `ptrs` (indexed by block id) and nothing else.  Returns false
+ * if the heap was exhausted.
+ */
+static bool replay_script(script_t *script, void **ptrs) {
+    for (int req = 0; req < script->num_ops; req++) {
+        request_t *request = &script->ops[req];
+
+        if (request->op == ALLOC) {
+            ptrs[request->id] = mymalloc(request->size);
+        } else if (request->op == REALLOC) {
+            ptrs[request->id] = myrealloc(ptrs[request->id], request->size);
+        } else {
+            myfree(ptrs[request->id]);
+            ptrs[request->id] = NULL;
+            continue;
+        }
+
+        if (ptrs[request->id] == NULL && request->size != 0) {
+            allocator_error(script, request->lineno, "heap exhausted, returned NULL");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: report_counters
+ * -------------------------
+ * Prints the per-request average of every hardware counter in COUNTERS
+ * that was opened, and "n/a" for the rest.
+ */
+static void report_counters(int fds[], double counts[], uint64_t nops) {
+    printf("\n  per op:");
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (fds[c] >= 0) {
+            printf(" %s %.2f", COUNTERS[c].name, counts[c] / nops);
+        } else {
+            printf(" %s n/a", COUNTERS[c].name);
+        }
+        printf(c < NUM_COUNTERS - 1 ? "," : "");
+    }
+}
+
+/* Function: open_counter
+ * ----------------------
+ * Opens a hardware performance counter for this process, counting user-space
+ * events only.  Returns its file descriptor, or -1 if the counter isn't
+ * supported or we aren't permitted to use it.
+ */
+static int open_counter(const counter_t *counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // the kernel may time-share counters, so ask how long each one really ran
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return fd;
+}
+
+/* Function: read_counter
+ * ----------------------
+ * Reads the current value of an open counter, along with how long it has
+ * been enabled and running.  A counter that isn't open reads as all zeros.
+ */
+static void read_counter(int fd, counter_reading_t *reading) {
+    if (fd < 0 || read(fd, reading, sizeof(*reading)) != sizeof(*reading)) {
+        *reading = (counter_reading_t){0};
+    }
+}
+
+/* Function: counter_delta
+ * -----------------------
+ * Returns the number of events counted between two readings, scaled up for
+ * any time the counter was not running because it was time-shared.
+ */
+static double counter_delta(counter_reading_t *before, counter_reading_t *after) {
+    uint64_t value = after->value - before->value;
+    uint64_t enabled = after->enabled - before->enabled;
+    uint64_t running = after->running - before->running;
+    if (running == 0) {
+        return 0;
+    }
+    return (double)value * enabled / running;
+}
+
+
+/* THREADED BENCHMARK IMPLEMENTATION */
+
+
+/* Function: thread_scripts
+ * ------------------------
+ * Replays the scripts on 1, 2, 4, ... up to `max_threads` threads at once,
+ * with no checking, and reports how throughput scales.  Normally each script
+ * is run on its own, with its block ids split across the threads: a block
+ * belongs to thread id % T, which runs every request on it except remote
+ * frees, which the next thread along runs.  If `concurrent` is set, thread t
+ * instead replays the whole of script t % (number of scripts), all of them
+ * sharing one heap.  Returns the number of runs that failed.
+ */
+static int thread_scripts(char *script_names[], int num_script_names, int max_threads,
+    bool concurrent) {
+    int nscripts = concurrent ? num_script_names : 1;
+    script_t *scripts = malloc(num_script_names * sizeof(script_t));
+    int **seqs = malloc(num_script_names * sizeof(int *));
+    worker_t *workers = malloc(max_threads * sizeof(worker_t));
+    if (!scripts || !seqs || !workers) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < num_script_names; i++) {
+        scripts[i] = parse_script(script_names[i]);
+        seqs[i] = request_seqs(&scripts[i]);
+    }
+
+    int nfailures = 0;
+    for (int first = 0; first < num_script_names; first += nscripts) {
+        if (concurrent) {
+            printf("\nReplaying all %d scripts, one per thread:", nscripts);
+        } else {
+            printf("\nReplaying %s split across threads:", scripts[first].name);
+        }
+
+        double base_rate = 0;
+        for (int nthreads = 1; nthreads <= max_threads;
+            nthreads = next_thread_count(nthreads, max_threads)) {
+            uint64_t wall_ns;
+            if (!run_threads(scripts + first, seqs + first, nscripts, nthreads, concurrent,
+                workers, &wall_ns)) {
+                nfailures++;
+                break;
+            }
+
+            uint64_t total_ops = 0;
+            for (int t = 0; t < nthreads; t++) {
+                total_ops += workers[t].num_reqs;
+            }
+            double rate = total_ops / (wall_ns / 1e9);
+            if (nthreads == 1) {
+                base_rate = rate;
+            }
+            printf("\n  %2d threads: %lu requests in %.3f ms (%.2f Mops/s, %.2fx)", nthreads,
+                total_ops, wall_ns / 1e6, rate / 1e6, rate / base_rate);
+            for (int t = 0; t < nthreads; t++) {
+                uint64_t ns = workers[t].end_ns - workers[t].start_ns;
+                printf("\n    thread %d: %d requests, %.2f Mops/s", t, workers[t].num_reqs,
+                    workers[t].num_reqs / (ns / 1e9) / 1e6);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_script_names; i++) {
+        free(seqs[i]);
+        free_script(&scripts[i]);
+    }
+    free(scripts);
+    free(seqs);
+    free(workers);
+    printf("\n");
+    return nfailures;
+}
+
+/* Function: next_thread_count
+ * -----------------------------
+ * Returns the number of threads to try after `nthreads`: the next power of
+ * two, except that the last count tried is always `max_threads` itself.
+ */
+static int next_thread_count(int nthreads, int max_threads) {
+    if (nthreads == max_threads) {
+        return max_threads + 1;
+    }
+    return (nthreads * 2 < max_threads) ? nthreads * 2 : max_threads;
+}
+
+/* Function: request_seqs
+ * ----------------------
+ * Returns an array giving, for each request in the script, the number of
+ * requests on the same block id that come before it.  A thread waits until
+ * that many requests on the id have finished before running the request, so
+ * every block sees its requests in script order whichever thread runs them.
+ */
+static int *request_seqs(script_t *script) {
+    int *seq = malloc(script->num_ops * sizeof(int));
+    int *count = calloc(script->num_ids, sizeof(int));
+    if (!seq || !count) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int req = 0; req < script->num_ops; req++) {
+        seq[req] = count[script->ops[req].id]++;
+    }
+    free(count);
+    return seq;
+}
+
+/* Function: run_threads
+ * ---------------------
+ * Resets the heap, hands out the requests of the scripts to `nthreads`
+ * workers and runs them, all starting together.  Stores the time from when
+ * the first thread started until the last one finished in `wall_ns`, and
+ * returns false if any thread failed.
+ */
+static bool run_threads(script_t *scripts, int **seqs, int nscripts, int nthreads,
+    bool concurrent, worker_t *workers, uint64_t *wall_ns) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        allocator_error(&scripts[0], 0, "myinit() returned false");
+        return false;
+    }
+
+    // when concurrent, every thread has its own copy of its script's blocks
+    int ncopies = concurrent ? nthreads : 1;
+    void ***ptrs = malloc(ncopies * sizeof(void **));
+    int **done = malloc(ncopies * sizeof(int *));
+    if (!ptrs || !done) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int c = 0; c < ncopies; c++) {
+        script_t *script = &scripts[c % nscripts];
+        ptrs[c] = calloc(script->num_ids, sizeof(void *));
+        done[c] = calloc(script->num_ids, sizeof(int));
+        if (!ptrs[c] || !done[c]) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    threads_failed = false;
+
+    for (int t = 0; t < nthreads; t++) {
+        int copy = concurrent ? t : 0;
+        script_t *script = &scripts[copy % nscripts];
+        worker_t *worker = &workers[t];
+        *worker = (worker_t){ .script = script, .seq = seqs[copy % nscripts],
+            .ptrs = ptrs[copy], .done = done[copy], .start = &start, .num_reqs = 0 };
+        worker->reqs = malloc(script->num_ops * sizeof(int));
+        if (!worker->reqs) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+
+        for (int req = 0; req < script->num_ops; req++) {
+            request_t *request = &script->ops[req];
+            int owner = concurrent ? t : request->id % nthreads;
+            if (request->op == REMOTE_FREE && !concurrent) {
+                owner = (owner + 1) % nthreads;
+            }
+            if (owner == t) {
+                worker->reqs[worker->num_reqs++] = req;
+            }
+        }
+    }
+
+    pthread_t threads[nthreads];
+    for (int t = 0; t < nthreads; t++) {
+        if (pthread_create(&threads[t], NULL, replay_worker, &workers[t]) != 0) {
+            error(1, 0, "Could not create a thread.");
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    bool success = true;
+    uint64_t first_start = UINT64_MAX, last_end = 0;
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+        success = success && workers[t].success;
+        if (workers[t].start_ns < first_start) {
+            first_start = workers[t].start_ns;
+        }
+        if (workers[t].end_ns > last_end) {
+            last_end = workers[t].end_ns;
+        }
+    }
+    *wall_ns = last_end - first_start;
+
+    pthread_barrier_destroy(&start);
+    for (int t = 0; t < nthreads; t++) {
+        free(workers[t].reqs);
+    }
+    for (int c = 0; c < ncopies; c++) {
+        free(ptrs[c]);
+        free(done[c]);
+    }
+    free(ptrs);
+    free(done);
+    return success;
+}
+
+/* Function: replay_worker
+ * -----------------------
+ * Thread function that replays one worker's requests in order.  Before each
+ * request it waits for the requests on the same block that come earlier in
+ * the script, which may belong to other threads, to finish.  Every thread
+ * gives up if any of them exhausts the heap.
+ */
+static void *replay_worker(void *arg) {
+    worker_t *worker = arg;
+    worker->success = false;
+
+    pthread_barrier_wait(worker->start);
+    worker->start_ns = now_ns();
+
+    for (int i = 0; i < worker->num_reqs; i++) {
+        int req = worker->reqs[i];
+        request_t *request = &worker->script->ops[req];
+        int id = request->id;
+
+        while (__atomic_load_n(&worker->done[id], __ATOMIC_ACQUIRE) != worker->seq[req]) {
+            if (__atomic_load_n(&threads_failed, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+            sched_yield();
+        }
+
+        LOCK_ALLOCATOR();
+        if (request->op == ALLOC) {
+            worker->ptrs[id] = mymalloc(request->size);
+        } else if (request->op == REALLOC) {
+            worker->ptrs[id] = myrealloc(worker->ptrs[id], request->size);
+        } else {
+            myfree(worker->ptrs[id]);
+            worker->ptrs[id] = NULL;
+        }
+        UNLOCK_ALLOCATOR();
+
+        if (worker->ptrs[id] == NULL && request->size != 0 && request->op != FREE &&
+            request->op != REMOTE_FREE) {
+            allocator_error(worker->script, request->lineno, "heap exhausted, returned NULL");
+            __atomic_store_n(&threads_failed, true, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        __atomic_store_n(&worker->done[id], worker->seq[req] + 1, __ATOMIC_RELEASE);
+    }
+
+    worker->end_ns = now_ns();
+    worker->success = true;
+    return NULL;
+}
+
+
 /* SCRIPT PARSING IMPLEMENTATION */
 
 
@@ -427,9 +1824,10 @@ static void allocator_error(script_t *script, int lineno, char* format, ...) {
  * ---------------------
  * This function parses the script file at the specified path, and returns an
  * object with info about it.  It expects one request per line, and adds each
- * request's information to the ops array within the script.  This function
- * throws an error if the file can't be opened, if a line is malformed, or if
- * the file is too long to store each request on the heap.
+ * request's information to the ops array within the script.  A binary script
+ * (see script.h) is mapped into memory and used in place instead.  This
+ * function throws an error if the file can't be opened, if a line is
+ * malformed, or if the file is too long to store each request on the heap.
  */
 static script_t parse_script(const char *path) {
     FILE *fp = fopen(path, "r");
@@ -438,11 +1836,22 @@ static script_t parse_script(const char *path) {
     }
 
     // Initialize a script object to store the information about this script
-    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    script_t script = { .ops = NULL, .mapping = NULL, .blocks = NULL, .num_ops = 0,
+        .peak_size = 0, .timing = NULL};
     const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
     strncpy(script.name, basename, sizeof(script.name) - 1);
     script.name[sizeof(script.name) - 1] = '\0';
 
+    if (map_binary_script(path, fp, &script)) {
+        fclose(fp);
+        script.blocks = calloc(script.num_ids, sizeof(block_t));
+        if (!script.blocks) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        index_init(&script.index);
+        return script;
+    }
+
     int lineno = 0;
     int nallocated = 0;
     int maxid = 0;
@@ -478,10 +1887,178 @@ static script_t parse_script(const char *path) {
     if (!script.blocks) {
         error(1, 0, "Libc heap exhausted. Cannot continue.");
     }
+    index_init(&script.index);
+
+    return script;
+}
+
+/* Function: map_binary_script
+ * -----------------------------
+ * If the open file is a binary script, maps it into memory and points the
+ * script's ops at the records following its header, returning true.  Returns
+ * false, with the file rewound, if it is a text script.  Every record is
+ * checked before the script is run, since the replay loops index the block
+ * tables by id without checking.
+ */
+static bool map_binary_script(const char *path, FILE *fp, script_t *script) {
+    binary_script_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, BINARY_SCRIPT_MAGIC, sizeof(header.magic)) != 0) {
+        rewind(fp);
+        return false;
+    }
+
+    if (header.version != BINARY_SCRIPT_VERSION || header.record_size != sizeof(request_t)) {
+        error(1, 0, "Binary script \"%s\" was written for a different version or machine.", path);
+    }
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || header.num_ops > INT32_MAX || header.num_ids > INT32_MAX ||
+        (size_t)st.st_size < sizeof(header) + header.num_ops * sizeof(request_t)) {
+        error(1, 0, "Binary script \"%s\" is truncated or malformed.", path);
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (mapping == MAP_FAILED) {
+        error(1, 0, "Could not map binary script \"%s\".", path);
+    }
+
+    script->mapping = mapping;
+    script->mapping_size = st.st_size;
+    script->ops = (request_t *)((char *)mapping + sizeof(header));
+    script->num_ops = header.num_ops;
+    script->num_ids = header.num_ids;
+    check_binary_records(path, script->ops, script->num_ops, header.num_ids);
+    return true;
+}
+
+/* Function: check_binary_records
+ * ------------------------------
+ * Exits with an error unless each of the records is a request that a text
+ * script could hold, with an id below num_ids, so that a corrupt or
+ * hand-made binary script is rejected rather than run.
+ */
+static void check_binary_records(const char *path, const request_t ops[], size_t num_ops,
+    uint64_t num_ids) {
+    size_t bad = find_bad_record(ops, num_ops, num_ids, MAX_REQUEST_SIZE);
+    if (bad < num_ops) {
+        error(1, 0, "Binary script \"%s\" has a malformed request (line %d).", path,
+            ops[bad].lineno);
+    }
+}
+
+/* Function: free_script
+ * ---------------------
+ * Frees everything the script holds, unmapping its ops if they came from a
+ * binary script and closing its file if it was streamed.
+ */
+static void free_script(script_t *script) {
+    if (script->stream != NULL) {
+        fclose(script->stream);
+    }
+    if (script->mapping != NULL) {
+        munmap(script->mapping, script->mapping_size);
+    } else {
+        free(script->ops);
+    }
+    free(script->blocks);
+    index_free(&script->index);
+}
+
+/* Function: open_script_stream
+ * ------------------------------
+ * Opens the script file at the specified path to be read a chunk of requests
+ * at a time by next_chunk, rather than all at once.  Only one chunk of
+ * requests is held in memory, and the table of blocks grows as new ids
+ * appear.  Text and binary scripts can both be streamed.
+ */
+static script_t open_script_stream(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+
+    script_t script = { .ops = NULL, .mapping = NULL, .blocks = NULL, .num_ops = 0,
+        .num_ids = 0, .stream = fp, .peak_size = 0, .timing = NULL};
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script.name, basename, sizeof(script.name) - 1);
+    script.name[sizeof(script.name) - 1] = '\0';
+
+    binary_script_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, BINARY_SCRIPT_MAGIC, sizeof(header.magic)) == 0) {
+        if (header.version != BINARY_SCRIPT_VERSION || header.record_size != sizeof(request_t)) {
+            error(1, 0, "Binary script \"%s\" was written for a different version or machine.", path);
+        }
+        script.stream_binary = true;
+        script.stream_ids = header.num_ids;
+        script.stream_ops_left = header.num_ops;
+    } else {
+        rewind(fp);
+    }
 
+    script.ops = malloc(STREAM_CHUNK_OPS * sizeof(request_t));
+    if (!script.ops) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    index_init(&script.index);
     return script;
 }
 
+/* Function: next_chunk
+ * --------------------
+ * Makes the next requests to run available in script->ops, returning false
+ * once there are none left.  A script that was loaded whole is one chunk,
+ * while a streamed script's ops are refilled with up to STREAM_CHUNK_OPS
+ * requests from its file each time.  A binary stream must hold as many
+ * records as its header says, as a mapped one must.
+ */
+static bool next_chunk(script_t *script) {
+    if (script->stream == NULL) {
+        return script->num_serviced == 0 && script->num_ops > 0;
+    }
+
+    if (script->stream_binary) {
+        size_t num_wanted = script->stream_ops_left < STREAM_CHUNK_OPS ?
+            script->stream_ops_left : STREAM_CHUNK_OPS;
+        script->num_ops = fread(script->ops, sizeof(request_t), num_wanted, script->stream);
+        if (script->num_ops < num_wanted) {
+            error(1, 0, "Binary script \"%s\" is truncated or malformed.", script->name);
+        }
+        script->stream_ops_left -= script->num_ops;
+        check_binary_records(script->name, script->ops, script->num_ops, script->stream_ids);
+        return script->num_ops > 0;
+    }
+
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    script->num_ops = 0;
+    while (script->num_ops < STREAM_CHUNK_OPS &&
+        read_line(buffer, sizeof(buffer), script->stream, &script->stream_lineno)) {
+        script->ops[script->num_ops++] = parse_script_line(buffer, script->stream_lineno, script->name);
+    }
+    return script->num_ops > 0;
+}
+
+/* Function: grow_blocks
+ * ---------------------
+ * Makes sure the table of blocks has an entry for the given id, at least
+ * doubling it when it has to grow.  New entries start out empty.
+ */
+static void grow_blocks(script_t *script, int id) {
+    if (id < script->num_ids) {
+        return;
+    }
+
+    int num_ids = (script->num_ids * 2 > id) ? script->num_ids * 2 : id + 1;
+    block_t *blocks = realloc(script->blocks, num_ids * sizeof(block_t));
+    if (!blocks) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    memset(blocks + script->num_ids, 0, (num_ids - script->num_ids) * sizeof(block_t));
+    script->blocks = blocks;
+    script->num_ids = num_ids;
+}
+
 /* Function: read_line
  * --------------------
  * This function reads one line from the specified file and stores at most
@@ -537,6 +2114,8 @@ static request_t parse_script_line(char *buffer, int lineno,
         request.op = REALLOC;
     } else if (request_char == 'f' && nscanned == 2) {
         request.op = FREE;
+    } else if (request_char == 'x' && nscanned == 2) {
+        request.op = REMOTE_FREE;
     }
 
     if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
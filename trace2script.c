@@ -0,0 +1,293 @@
+/*
+ * File: trace2script.c
+ * --------------------
+ * Converts an allocation trace recorded by alloc_trace.c into a text script
+ * for the test harness, so that recorded traffic can be replayed against any
+ * of the allocators.  The records of all the threads are put back in the
+ * order the calls were made, and each block's address is given a script id,
+ * with the ids of freed blocks reused as gen_script does.  A block freed by
+ * a thread other than the one that allocated it is freed with a remote free.
+ *
+ * A trace can start after some blocks were allocated, so frees and reallocs
+ * of blocks it never saw allocated are left out (a realloc becomes an
+ * alloc).  If an address is handed out while it still has an id, the block
+ * that had it must have been freed without the trace seeing, for instance
+ * by myinit resetting the heap, so it is freed in the script first.
+ *
+ * Usage: trace2script <input.trace> [output.script]
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc_trace.h"
+
+// A record with its place in the file, which breaks ties between records
+// with the same time so that each thread's calls stay in the order it made them
+typedef struct {
+    trace_record_t record;
+    size_t seq;
+} entry_t;
+
+// The script id and allocating thread of a live block, in a table by address
+typedef struct {
+    uint64_t ptr;           // 0 if the slot is empty
+    int id;
+    uint32_t thread;
+} block_t;
+
+typedef struct {
+    block_t *slots;
+    size_t capacity;        // a power of two
+    size_t count;
+    int *free_ids;          // ids of freed blocks, to be reused
+    int num_free_ids;
+    int next_id;
+    FILE *out;
+} converter_t;
+
+
+/* Function: load_trace
+ * --------------------
+ * Reads every record of a trace file into memory, after checking its header.
+ */
+static entry_t *load_trace(const char *path, size_t *num_entries) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        error(1, errno, "Could not open trace file \"%s\"", path);
+    }
+
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        error(1, 0, "\"%s\" is not an allocation trace.", path);
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        error(1, 0, "\"%s\" was recorded in a different format (version %u, %u-byte records).",
+            path, header.version, header.record_size);
+    }
+
+    size_t capacity = 1024, count = 0;
+    entry_t *entries = malloc(capacity * sizeof(entry_t));
+    trace_record_t record;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        if (count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(entry_t));
+        }
+        if (entries == NULL) {
+            error(1, 0, "Out of memory reading \"%s\".", path);
+        }
+        entries[count].record = record;
+        entries[count].seq = count;
+        count++;
+    }
+    if (ferror(fp)) {
+        error(1, errno, "Could not read \"%s\"", path);
+    }
+    fclose(fp);
+
+    *num_entries = count;
+    return entries;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+    if (x->record.ns != y->record.ns) {
+        return x->record.ns < y->record.ns ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static size_t slot_for(converter_t *c, uint64_t ptr) {
+    return ((ptr ^ (ptr >> 17)) * 0x9e3779b97f4a7c15 >> 32) & (c->capacity - 1);
+}
+
+/* Function: find_block
+ * --------------------
+ * Returns the slot of the live block at ptr, or the empty slot it would go in.
+ */
+static block_t *find_block(converter_t *c, uint64_t ptr) {
+    size_t slot = slot_for(c, ptr);
+    while (c->slots[slot].ptr != 0 && c->slots[slot].ptr != ptr) {
+        slot = (slot + 1) & (c->capacity - 1);
+    }
+    return &c->slots[slot];
+}
+
+/* Function: add_block
+ * -------------------
+ * Gives the block at ptr a fresh id, reusing a freed id if there is one, and
+ * doubles the table whenever it gets half full.
+ */
+static int add_block(converter_t *c, uint64_t ptr, uint32_t thread) {
+    if (2 * (c->count + 1) > c->capacity) {
+        block_t *old = c->slots;
+        size_t old_capacity = c->capacity;
+        c->capacity *= 2;
+        c->slots = calloc(c->capacity, sizeof(block_t));
+        if (c->slots == NULL) {
+            error(1, 0, "Out of memory.");
+        }
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].ptr != 0) {
+                *find_block(c, old[i].ptr) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    int id = c->num_free_ids > 0 ? c->free_ids[--c->num_free_ids] : c->next_id++;
+    *find_block(c, ptr) = (block_t){ .ptr = ptr, .id = id, .thread = thread };
+    c->count++;
+    return id;
+}
+
+/* Function: remove_block
+ * ----------------------
+ * Takes the block in the given slot out of the table, shifting back the
+ * blocks after it that it was in the way of, and returns its id.  The id is
+ * only reused once the caller is done with it, with release_id.
+ */
+static int remove_block(converter_t *c, block_t *block) {
+    int id = block->id;
+    size_t hole = block - c->slots;
+    for (size_t slot = (hole + 1) & (c->capacity - 1); c->slots[slot].ptr != 0;
+        slot = (slot + 1) & (c->capacity - 1)) {
+        size_t home = slot_for(c, c->slots[slot].ptr);
+        if (((slot - home) & (c->capacity - 1)) >= ((slot - hole) & (c->capacity - 1))) {
+            c->slots[hole] = c->slots[slot];
+            hole = slot;
+        }
+    }
+    c->slots[hole].ptr = 0;
+    c->count--;
+    return id;
+}
+
+static void release_id(converter_t *c, int id) {
+    c->free_ids[c->num_free_ids++] = id;
+}
+
+/* Function: free_block
+ * --------------------
+ * Writes the free of a live block, as a remote free if a thread other than
+ * the one that allocated it frees it.
+ */
+static void free_block(converter_t *c, block_t *block, uint32_t thread) {
+    char op = block->thread == thread ? 'f' : 'x';
+    int id = remove_block(c, block);
+    fprintf(c->out, "%c %d\n", op, id);
+    release_id(c, id);
+}
+
+/* Function: alloc_block
+ * ---------------------
+ * Writes the alloc of a block at ptr, first freeing any block the trace
+ * still has at that address.
+ */
+static void alloc_block(converter_t *c, uint64_t ptr, size_t size, uint32_t thread) {
+    block_t *stale = find_block(c, ptr);
+    if (stale->ptr != 0) {
+        free_block(c, stale, stale->thread);
+    }
+    fprintf(c->out, "a %d %zu\n", add_block(c, ptr, thread), size);
+}
+
+/* Function: convert
+ * -----------------
+ * Writes the script for the records, which are in the order of their calls,
+ * and returns the number of frees and reallocs of unseen blocks left out.
+ */
+static size_t convert(converter_t *c, entry_t *entries, size_t num_entries) {
+    size_t num_unseen = 0;
+
+    for (size_t i = 0; i < num_entries; i++) {
+        trace_record_t *r = &entries[i].record;
+        if (r->op == TRACE_ALLOC) {
+            alloc_block(c, r->ptr, r->size, r->thread);
+        } else if (r->op == TRACE_FREE) {
+            block_t *block = find_block(c, r->ptr);
+            if (block->ptr == 0) {
+                num_unseen++;
+            } else {
+                free_block(c, block, r->thread);
+            }
+        } else if (r->op == TRACE_REALLOC) {
+            block_t *block = find_block(c, r->ptr);
+            if (r->ptr == 0 || block->ptr == 0) {
+                // realloc of NULL, or of a block the trace never saw, allocates
+                num_unseen += (r->ptr != 0);
+                if (r->new_ptr != 0) {
+                    alloc_block(c, r->new_ptr, r->size, r->thread);
+                }
+            } else if (r->new_ptr == 0) {
+                // realloc to size 0 frees, and a failed realloc leaves the block be
+                if (r->size == 0) {
+                    free_block(c, block, r->thread);
+                }
+            } else {
+                int id = remove_block(c, block);
+                block_t *stale = find_block(c, r->new_ptr);
+                if (stale->ptr != 0) {
+                    free_block(c, stale, stale->thread);
+                }
+                fprintf(c->out, "r %d %zu\n", id, (size_t)r->size);
+                *find_block(c, r->new_ptr) = (block_t){ .ptr = r->new_ptr, .id = id,
+                    .thread = r->thread };
+                c->count++;
+            }
+        } else {
+            error(1, 0, "Record %zu has an unknown op %u.", entries[i].seq, r->op);
+        }
+    }
+    return num_unseen;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        error(1, 0, "Usage: %s <input.trace> [output.script]", argv[0]);
+    }
+
+    size_t num_entries;
+    entry_t *entries = load_trace(argv[1], &num_entries);
+    qsort(entries, num_entries, sizeof(entry_t), compare_entries);
+
+    uint32_t num_threads = 0;
+    for (size_t i = 0; i < num_entries; i++) {
+        if (entries[i].record.thread >= num_threads) {
+            num_threads = entries[i].record.thread + 1;
+        }
+    }
+
+    converter_t c = { .capacity = 1024 };
+    c.slots = calloc(c.capacity, sizeof(block_t));
+    c.free_ids = malloc((num_entries + 1) * sizeof(int));
+    c.out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (c.slots == NULL || c.free_ids == NULL) {
+        error(1, 0, "Out of memory.");
+    }
+    if (c.out == NULL) {
+        error(1, errno, "Could not create script \"%s\"", argv[2]);
+    }
+
+    fprintf(c.out, "# trace2script %s: %zu calls from %u threads\n", argv[1], num_entries,
+        num_threads);
+    size_t num_unseen = convert(&c, entries, num_entries);
+
+    if (fclose(c.out) != 0) {
+        error(1, errno, "Could not write the script");
+    }
+    if (num_unseen > 0) {
+        fprintf(stderr, "Left out %zu frees and reallocs of blocks allocated before the trace began.\n",
+            num_unseen);
+    }
+
+    free(entries);
+    free(c.slots);
+    free(c.free_ids);
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * File: tune_classes.c
+ * --------------------
+ * Fits the size from which the implicit and explicit allocators give blocks
+ * whole pages by the page heap, rather than a place in an arena, to the
+ * request sizes of scripts or allocation traces.  The result is written as
+ * the header of size classes for the allocators to be built with, so that
+ * each workload can have a threshold of its own:
+ *
+ *     tune_classes -o service_classes.h service.trace
+ *     make SIZE_CLASSES=service_classes.h
+ *
+ * Every request is charged the bytes its block takes beyond the bytes asked
+ * for: its header for a block in an arena, or the rest of its last page for
+ * a block given whole pages.  The threshold of 1, 2 or 4 pages that wastes
+ * the fewest bytes over all the requests is kept.
+ *
+ * The header written never has a table of classes for small blocks to be
+ * rounded up to.  Without one a small block is padded only to ALIGNMENT, so
+ * by the bytes each request is charged a table can only add padding, at any
+ * threshold.  What classes might buy back, freed blocks that fit the next
+ * request of their class exactly, only shows when the allocators run, so a
+ * hand-written table is best judged with the test harness's -f.
+ *
+ * Usage: tune_classes [-t threshold] [-o output] [input ...]
+ *
+ * Inputs may be text scripts, binary scripts or traces, in any mix.  -t
+ * fixes the threshold in bytes rather than trying 1, 2 and 4 pages.
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "alloc_trace.h"
+#include "script.h"
+#include "span.h"
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+// Size of the header in front of every block in an arena
+#define BLOCK_HEADER_SIZE 8
+
+// Largest threshold tried, beyond which small blocks would crowd the arenas
+#define MAX_THRESHOLD (4 * PAGE_SIZE)
+
+// The requests read from the inputs.  Sizes are counted once rounded up to
+// ALIGNMENT, which every table pays alike, so that padding is kept apart.
+typedef struct {
+    uint64_t counts[MAX_THRESHOLD / ALIGNMENT];  // requests by rounded size / ALIGNMENT
+    uint64_t num_requests;
+    uint64_t requested_bytes;
+    uint64_t align_waste;   // bytes added by rounding up to ALIGNMENT
+    uint64_t huge_waste;    // page rounding of blocks too big for any threshold
+} histogram_t;
+
+// A threshold, with the bytes it wastes
+typedef struct {
+    size_t threshold;
+    uint64_t waste;
+} table_t;
+
+
+static void add_request(histogram_t *hist, size_t size) {
+    if (size == 0 || size > MAX_REQUEST_SIZE) {
+        return;
+    }
+    size_t needed = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    hist->num_requests++;
+    hist->requested_bytes += size;
+    hist->align_waste += needed - size;
+    if (needed < MAX_THRESHOLD) {
+        hist->counts[needed / ALIGNMENT]++;
+    } else {
+        hist->huge_waste += ((needed + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1)) - needed;
+    }
+}
+
+/* Function: read_input
+ * --------------------
+ * Adds the size of every alloc and realloc in the file at path to the
+ * histogram, telling traces and binary scripts apart from text scripts by
+ * the magic bytes they start with.
+ */
+static void read_input(histogram_t *hist, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        error(1, errno, "Could not open \"%s\"", path);
+    }
+
+    char magic[8] = { 0 };
+    size_t nread = fread(magic, 1, sizeof(magic), fp);
+    rewind(fp);
+
+    if (nread == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+        trace_header_t header;
+        if (fread(&header, sizeof(header), 1, fp) != 1 || header.version != TRACE_VERSION ||
+            header.record_size != sizeof(trace_record_t)) {
+            error(1, 0, "\"%s\" was recorded in a different trace format.", path);
+        }
+        trace_record_t record;
+        while (fread(&record, sizeof(record), 1, fp) == 1) {
+            // a realloc that failed or freed its block asked for no new block
+            if (record.op == TRACE_ALLOC ||
+                (record.op == TRACE_REALLOC && record.new_ptr != 0)) {
+                add_request(hist, record.size);
+            }
+        }
+    } else if (nread == sizeof(magic) && memcmp(magic, BINARY_SCRIPT_MAGIC, sizeof(magic)) == 0) {
+        binary_script_header_t header;
+        if (fread(&header, sizeof(header), 1, fp) != 1 ||
+            header.version != BINARY_SCRIPT_VERSION || header.record_size != sizeof(request_t)) {
+            error(1, 0, "\"%s\" was written in a different binary script format.", path);
+        }
+        request_t request;
+        while (fread(&request, sizeof(request), 1, fp) == 1) {
+            if (request.op == ALLOC || request.op == REALLOC) {
+                add_request(hist, request.size);
+            }
+        }
+    } else {
+        char buffer[MAX_SCRIPT_LINE_LEN];
+        while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+            char request_char;
+            int id;
+            size_t size;
+            if (sscanf(buffer, " %c %d %zu", &request_char, &id, &size) == 3 &&
+                (request_char == 'a' || request_char == 'r')) {
+                add_request(hist, size);
+            }
+        }
+    }
+
+    if (ferror(fp)) {
+        error(1, errno, "Could not read \"%s\"", path);
+    }
+    fclose(fp);
+}
+
+/* Function: fit_table
+ * -------------------
+ * Fills in the bytes the table's threshold wastes over every request,
+ * leaving out the padding to ALIGNMENT.  Blocks below the threshold are
+ * charged their headers, and the rest the rest of their last page.
+ */
+static void fit_table(const histogram_t *hist, table_t *table) {
+    uint64_t small_requests = 0;
+    table->waste = hist->huge_waste;
+    for (size_t needed = ALIGNMENT; needed < MAX_THRESHOLD; needed += ALIGNMENT) {
+        uint64_t n = hist->counts[needed / ALIGNMENT];
+        if (needed < table->threshold) {
+            small_requests += n;
+        } else {
+            size_t pages = (needed + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+            table->waste += n * (pages - needed);
+        }
+    }
+    table->waste += small_requests * BLOCK_HEADER_SIZE;
+}
+
+static double percent(uint64_t waste, const histogram_t *hist) {
+    return hist->requested_bytes == 0 ? 0 : 100.0 * waste / hist->requested_bytes;
+}
+
+/* Function: write_header
+ * ----------------------
+ * Writes the threshold as a header that the allocators include, with the
+ * command that made it so that it can be made again.
+ */
+static void write_header(FILE *out, const table_t *table, const histogram_t *hist,
+    uint64_t default_waste, int argc, char *argv[]) {
+    fprintf(out, "/* File: size_classes.h\n");
+    fprintf(out, " * --------------------\n");
+    fprintf(out, " * Size classes for the implicit and explicit allocators, written by\n");
+    const char *name = strrchr(argv[0], '/');
+    fprintf(out, " *\n *     %s", (name != NULL) ? name + 1 : argv[0]);
+    for (int i = 1; i < argc; i++) {
+        fprintf(out, " %s", argv[i]);
+    }
+    fprintf(out, "\n *\n");
+    if (hist->num_requests > 0) {
+        fprintf(out, " * Fitted to %lu requests, which it pads by %.1f%% of the bytes asked for,\n",
+            hist->num_requests, percent(table->waste + hist->align_waste, hist));
+        fprintf(out, " * against %.1f%% with the threshold at one page.\n",
+            percent(default_waste + hist->align_waste, hist));
+    }
+    fprintf(out, " * Don't edit it; run tune_classes again instead.\n");
+    fprintf(out, " */\n");
+    fprintf(out, "#ifndef _SIZE_CLASSES_H\n#define _SIZE_CLASSES_H\n\n");
+    fprintf(out, "#include <stdint.h> // for uint8_t, uint32_t\n\n");
+
+    fprintf(out, "// Blocks of at least this many bytes are given whole pages by the page heap\n");
+    fprintf(out, "#define LARGE_BLOCK_SIZE %zu\n\n", table->threshold);
+    fprintf(out, "// Number of classes smaller blocks are rounded up to, or 0 if they are\n");
+    fprintf(out, "// only rounded up to ALIGNMENT\n");
+    fprintf(out, "#define NUM_SIZE_CLASSES 0\n");
+    fprintf(out, "\n#endif\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *outpath = NULL;
+    size_t fixed_threshold = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "t:o:")) != EOF) {
+        switch (c) {
+            case 't': fixed_threshold = strtoul(optarg, NULL, 0); break;
+            case 'o': outpath = optarg; break;
+            default:
+                error(1, 0, "Usage: %s [-t threshold] [-o output] [input ...]", argv[0]);
+        }
+    }
+    if (fixed_threshold != 0 && (fixed_threshold % PAGE_SIZE != 0 ||
+        fixed_threshold > MAX_THRESHOLD)) {
+        error(1, 0, "The threshold must be a whole number of pages, up to %d bytes.",
+            MAX_THRESHOLD);
+    }
+
+    histogram_t hist = { .num_requests = 0 };
+    for (int i = optind; i < argc; i++) {
+        read_input(&hist, argv[i]);
+    }
+
+    // the allocators as they are built by default
+    table_t by_default = { .threshold = PAGE_SIZE };
+    fit_table(&hist, &by_default);
+
+    table_t best = { .waste = UINT64_MAX };
+    for (size_t threshold = PAGE_SIZE; threshold <= MAX_THRESHOLD; threshold *= 2) {
+        if (fixed_threshold != 0 && threshold != fixed_threshold) {
+            continue;
+        }
+        table_t table = { .threshold = threshold };
+        fit_table(&hist, &table);
+        fprintf(stderr, "threshold %5zu pads requests by %5.1f%%\n", threshold,
+            percent(table.waste + hist.align_waste, &hist));
+        if (table.waste < best.waste) {
+            best = table;
+        }
+    }
+    if (best.waste == UINT64_MAX) {
+        error(1, 0, "The threshold must be 1, 2 or 4 pages.");
+    }
+    fprintf(stderr, "%lu requests; chose threshold %zu\n", hist.num_requests, best.threshold);
+
+    FILE *out = stdout;
+    if (outpath != NULL && (out = fopen(outpath, "w")) == NULL) {
+        error(1, errno, "Could not create \"%s\"", outpath);
+    }
+    write_header(out, &best, &hist, by_default.waste, argc, argv);
+    if (fclose(out) != 0) {
+        error(1, errno, "Could not write the header");
+    }
+    return 0;
+}